@@ -0,0 +1,162 @@
+/* libguestfs
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Test C<edit_files_perl> against a scratch disk in the appliance:
+ * a batch which commits, a batch with a failing expression which
+ * must not change anything, and a batch which fails while renaming
+ * the files into place, whose uploaded files must be removed.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <guestfs.h>
+
+#include "guestfs-utils.h"
+
+#include "file-edit.h"
+
+#define CHECK(expr)                                                     \
+  do {                                                                  \
+    if (!(expr)) {                                                      \
+      fprintf (stderr, "%s:%d: test failed: %s\n",                      \
+               __FILE__, __LINE__, #expr);                              \
+      exit (EXIT_FAILURE);                                              \
+    }                                                                   \
+  } while (0)
+
+static void
+check_content (guestfs_h *g, const char *path, const char *expected)
+{
+  CLEANUP_FREE char *content = guestfs_cat (g, path);
+
+  CHECK (content != NULL);
+  if (STRNEQ (content, expected)) {
+    fprintf (stderr, "%s: expected \"%s\", got \"%s\"\n",
+             path, expected, content);
+    exit (EXIT_FAILURE);
+  }
+}
+
+/* Check that the root directory contains exactly these files, so
+ * that no uploaded file was left behind.
+ */
+static void
+check_files (guestfs_h *g, const char *const *expected)
+{
+  CLEANUP_FREE_STRING_LIST char **files = guestfs_ls (g, "/");
+  size_t i;
+
+  CHECK (files != NULL);
+  for (i = 0; files[i] != NULL && expected[i] != NULL; ++i) {
+    if (STRNEQ (files[i], expected[i])) {
+      fprintf (stderr, "/: expected file %s, got %s\n",
+               expected[i], files[i]);
+      exit (EXIT_FAILURE);
+    }
+  }
+  CHECK (files[i] == NULL && expected[i] == NULL);
+}
+
+int
+main (void)
+{
+  guestfs_h *g;
+
+  g = guestfs_create ();
+  CHECK (g != NULL);
+  CHECK (guestfs_add_drive_scratch (g, 64 * 1024 * 1024, -1) == 0);
+  CHECK (guestfs_launch (g) == 0);
+  CHECK (guestfs_mkfs (g, "ext4", "/dev/sda") == 0);
+  CHECK (guestfs_mount (g, "/dev/sda", "/") == 0);
+  CHECK (guestfs_rmdir (g, "/lost+found") == 0);
+
+  CHECK (guestfs_write (g, "/a", "a\nb\n", 4) == 0);
+  CHECK (guestfs_write (g, "/b", "a\nb\n", 4) == 0);
+  CHECK (guestfs_write (g, "/c", "c\n", 2) == 0);
+
+  /* Commit.  "/a" is edited twice (in-process, then by Perl) and
+   * backed up once, and "/c" is left unchanged, so is not rewritten
+   * or backed up.
+   */
+  {
+    struct file_edit edits[] = {
+      { "/a", "s/a/A/", -1 },
+      { "/b", "s/b/B/", -1 },
+      { "/a", "$_ = uc $_", -1 },
+      { "/c", "s/x/y/", -1 },
+    };
+    const char *const files[] = { "a", "a.bak", "b", "b.bak", "c", NULL };
+
+    CHECK (edit_files_perl (g, edits, 4, ".bak", 0) == 0);
+    CHECK (edits[0].result == 0);
+    CHECK (edits[1].result == 0);
+    CHECK (edits[2].result == 0);
+    CHECK (edits[3].result == 1);
+    check_content (g, "/a", "A\nB\n");
+    check_content (g, "/a.bak", "a\nb\n");
+    check_content (g, "/b", "a\nB\n");
+    check_content (g, "/b.bak", "a\nb\n");
+    check_content (g, "/c", "c\n");
+    check_files (g, files);
+  }
+
+  /* An expression fails, so nothing is changed in the guest. */
+  {
+    struct file_edit edits[] = {
+      { "/a", "s/A/Z/", -1 },
+      { "/b", "die", -1 },
+    };
+    const char *const files[] = { "a", "a.bak", "b", "b.bak", "c", NULL };
+
+    CHECK (edit_files_perl (g, edits, 2, ".old", 0) == -1);
+    check_content (g, "/a", "A\nB\n");
+    check_content (g, "/b", "a\nB\n");
+    check_files (g, files);
+  }
+
+  /* Backing up "/b" fails because "/b.old/b" is a directory, after
+   * "/a" has been renamed into place.  The uploaded copy of "/b" must
+   * be removed and "/b" left as it was.
+   */
+  {
+    struct file_edit edits[] = {
+      { "/a", "s/A/Z/", -1 },
+      { "/b", "s/a/Z/", -1 },
+    };
+    const char *const files[] = {
+      "a", "a.bak", "a.old", "b", "b.bak", "b.old", "c", NULL
+    };
+
+    CHECK (guestfs_mkdir_p (g, "/b.old/b") == 0);
+    CHECK (edit_files_perl (g, edits, 2, ".old", 0) == -1);
+    check_content (g, "/a", "Z\nB\n");
+    check_content (g, "/a.old", "A\nB\n");
+    check_content (g, "/b", "a\nB\n");
+    check_files (g, files);
+  }
+
+  CHECK (guestfs_shutdown (g) == 0);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
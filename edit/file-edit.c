@@ -22,7 +22,8 @@
  * and L<virt-builder(1)>.
  *
  * It contains the code for both interactive-(editor-)based editing
- * and non-interactive editing using Perl snippets.
+ * and non-interactive editing using Perl snippets.  Simple Perl
+ * snippets are run in-process by F<line-edit.c>.
  */
 
 #include <config.h>
@@ -38,14 +39,28 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <utime.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <spawn.h>
 
 #include "guestfs-utils.h"
 
 #include "file-edit.h"
+#include "line-edit.h"
 
+static int edit_file_line_edit (guestfs_h *g, const char *filename,
+                                const struct line_edit *le,
+                                const char *backup_extension, int verbose);
+static int run_perl (const char *perl_expr, const char *infile,
+                     const char *outfile, int verbose);
+static int run_tar (const char *root, const char *listfile,
+                    const char *tarfile, int verbose);
 static int do_download (guestfs_h *g, const char *filename, char **tempfile);
+static int files_identical (const char *file1, const char *file2);
 static int do_upload (guestfs_h *g, const char *filename, const char *tempfile,
                       const char *backup_extension);
 static char *generate_random_name (const char *filename);
@@ -147,17 +162,32 @@ edit_file_editor (guestfs_h *g, const char *filename, const char *editor,
  * If C<backup_extension> is not null, then a copy of C<filename> is
  * saved with C<backup_extension> appended to its file name.
  *
- * Returns C<-1> for failure, C<0> on success.
+ * If C<perl_expr> is simple enough (see F<line-edit.c>) it is run
+ * in-process instead of starting Perl.
+ *
+ * If the expression does not change the content of the file, then
+ * the file is not uploaded or renamed, so its inode, timestamps and
+ * disk blocks are untouched.
+ *
+ * Returns C<-1> for failure, C<0> on success, C<1> if the expression
+ * did not change the file.
  */
 int
 edit_file_perl (guestfs_h *g, const char *filename, const char *perl_expr,
                 const char *backup_extension, int verbose)
 {
   CLEANUP_UNLINK_FREE char *tmpfilename = NULL;
-  CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *outfile = NULL;
+  struct line_edit *le;
   int r;
 
+  le = line_edit_compile (perl_expr);
+  if (le != NULL) {
+    r = edit_file_line_edit (g, filename, le, backup_extension, verbose);
+    line_edit_free (le);
+    return r;
+  }
+
   /* Download the file and write it to a temporary. */
   if (do_download (g, filename, &tmpfilename) == -1)
     return -1;
@@ -167,47 +197,755 @@ edit_file_perl (guestfs_h *g, const char *filename, const char *perl_expr,
     return -1;
   }
 
-  /* Pass the expression to Perl via the environment.  This sidesteps
-   * any quoting problems with the already complex Perl command line.
+  if (run_perl (perl_expr, tmpfilename, outfile, verbose) == -1)
+    return -1;
+
+  r = files_identical (tmpfilename, outfile);
+  if (r == -1)
+    return -1;
+  if (r == 1) {
+    unlink (outfile);
+    return 1;
+  }
+
+  if (rename (outfile, tmpfilename) == -1) {
+    perror ("rename");
+    return -1;
+  }
+
+  if (do_upload (g, filename, tmpfilename, backup_extension) == -1)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * State of one edit in a batch of edits (see C<edit_files_perl>).
+ */
+struct batch_entry {
+  struct file_edit *edit;
+  char *path;                   /* real path of the file in the guest */
+  struct batch_entry *prev;     /* earlier edit of the same file, or NULL */
+  bool last;                    /* true if no later edit of the same file */
+  size_t generation;            /* number of earlier edits of the same file */
+  char *infile;                 /* local input: downloaded, or prev->outfile */
+  char *outfile;                /* local copy of the edited file */
+  char *newname;                /* random name next to C<path> */
+  struct line_edit *le;         /* NULL if the expression needs Perl */
+  int r;                        /* -1 error, 0 changed, 1 unchanged */
+  bool upload;                  /* this or an earlier edit changed the file */
+};
+
+/* Queue of in-process edits shared by the worker threads. */
+struct batch_queue {
+  pthread_mutex_t mutex;
+  struct batch_entry *entries;
+  size_t nr_entries;
+  size_t generation;            /* only run edits of this generation */
+  size_t next;
+};
+
+static int edit_batch (guestfs_h *g, struct batch_entry *entries,
+                       size_t nr_entries, const char *backup_extension,
+                       int verbose);
+static int run_generation (struct batch_entry *entries, size_t nr_entries,
+                           size_t generation, int verbose);
+static void *batch_thread (void *queuev);
+static void run_batch_entry (struct batch_entry *entry);
+static int make_parent_dirs (const char *root, const char *path);
+static int remove_dir (const char *dir);
+
+/**
+ * Edit several files, running the corresponding Perl expression over
+ * each one, as a single transaction.
+ *
+ * This has the same effect as calling C<edit_file_perl> on each
+ * element of C<edits> in turn, except that when a file is edited more
+ * than once, only one backup (of the original file) is made.  The
+ * files are all downloaded first and edited locally (the in-process
+ * expressions in parallel, one thread per host CPU).  A file which
+ * appears several times is downloaded once, and each edit runs on the
+ * output of the previous one.  The final version of each changed
+ * file is then uploaded to the appliance in a single
+ * L<guestfs(3)/guestfs_tar_in> stream, and finally given the
+ * attributes of the original and renamed over it, as
+ * C<edit_file_perl> does.
+ *
+ * Compared to C<edit_file_perl>, this saves one round trip to the
+ * appliance per changed file (the upload), starting Perl for each
+ * simple expression, and the repeated downloads and uploads of files
+ * which are edited more than once.  Each changed file still costs
+ * four round trips (realpath, download, copy-attributes and mv, plus
+ * another mv for the backup), and each unchanged file two (realpath
+ * and download, one more than C<edit_file_perl>).
+ *
+ * No file is changed in the guest unless every expression ran
+ * successfully.  If uploading or renaming fails, some files may have
+ * been changed already.
+ *
+ * On success, C<edits[i].result> is set to C<0> if the expression
+ * changed the file, or C<1> if it did not.  A file which was not
+ * changed by any of its edits is not rewritten.
+ *
+ * Returns C<0> on success, C<-1> for failure.
+ */
+int
+edit_files_perl (guestfs_h *g, struct file_edit *edits, size_t nr_edits,
+                 const char *backup_extension, int verbose)
+{
+  struct batch_entry *entries;
+  size_t i, j;
+  int r = -1;
+
+  entries = calloc (nr_edits, sizeof *entries);
+  if (entries == NULL) {
+    perror ("calloc");
+    return -1;
+  }
+
+  for (i = 0; i < nr_edits; ++i) {
+    entries[i].edit = &edits[i];
+    entries[i].path = guestfs_realpath (g, edits[i].filename);
+    if (entries[i].path == NULL)
+      goto out;
+
+    /* Chain together the edits of the same file. */
+    entries[i].last = true;
+    for (j = i; j-- > 0; ) {
+      if (STREQ (entries[j].path, entries[i].path)) {
+        entries[i].prev = &entries[j];
+        entries[i].generation = entries[j].generation + 1;
+        entries[j].last = false;
+        break;
+      }
+    }
+  }
+
+  r = edit_batch (g, entries, nr_edits, backup_extension, verbose);
+
+ out:
+  for (i = 0; i < nr_edits; ++i)
+    free (entries[i].path);
+  free (entries);
+  return r;
+}
+
+/**
+ * Run all the edits in C<entries>, then upload and rename the files
+ * which changed.
+ */
+static int
+edit_batch (guestfs_h *g, struct batch_entry *entries, size_t nr_entries,
+            const char *backup_extension, int verbose)
+{
+  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g);
+  CLEANUP_FREE char *staging = NULL;
+  CLEANUP_FREE char *root = NULL;
+  CLEANUP_FREE char *listfile = NULL;
+  CLEANUP_FREE char *tarfile = NULL;
+  CLEANUP_FCLOSE FILE *list = NULL;
+  size_t nr_changed = 0, max_generation = 0;
+  size_t i;
+  int r = -1;
+
+  if (nr_entries == 0)
+    return 0;
+
+  if (asprintf (&staging, "%s/libguestfsXXXXXX", tmpdir) == -1) {
+    perror ("asprintf");
+    return -1;
+  }
+  if (mkdtemp (staging) == NULL) {
+    perror ("mkdtemp");
+    return -1;
+  }
+  if (asprintf (&root, "%s/root", staging) == -1 ||
+      asprintf (&listfile, "%s/list", staging) == -1 ||
+      asprintf (&tarfile, "%s/edits.tar", staging) == -1) {
+    perror ("asprintf");
+    goto out;
+  }
+
+  /* Download each file once. */
+  for (i = 0; i < nr_entries; ++i) {
+    struct batch_entry *entry = &entries[i];
+
+    if (asprintf (&entry->outfile, "%s/out%zu", staging, i) == -1) {
+      perror ("asprintf");
+      goto out;
+    }
+    if (entry->prev != NULL) {
+      entry->infile = strdup (entry->prev->outfile);
+      if (entry->infile == NULL) {
+        perror ("strdup");
+        goto out;
+      }
+    }
+    else {
+      if (asprintf (&entry->infile, "%s/in%zu", staging, i) == -1) {
+        perror ("asprintf");
+        goto out;
+      }
+      if (guestfs_download (g, entry->path, entry->infile) == -1)
+        goto out;
+    }
+
+    entry->le = line_edit_compile (entry->edit->perl_expr);
+    max_generation = MAX (max_generation, entry->generation);
+  }
+
+  /* Don't change anything in the guest unless all edits succeeded. */
+  for (i = 0; i <= max_generation; ++i)
+    if (run_generation (entries, nr_entries, i, verbose) == -1)
+      goto out;
+
+  /* Upload the final version of each changed file with a new name,
+   * in one go.
+   */
+  list = fopen (listfile, "w");
+  if (list == NULL) {
+    perror (listfile);
+    goto out;
+  }
+  for (i = 0; i < nr_entries; ++i) {
+    struct batch_entry *entry = &entries[i];
+    CLEANUP_FREE char *dest = NULL;
+
+    entry->edit->result = entry->r;
+    entry->upload =
+      entry->r == 0 || (entry->prev != NULL && entry->prev->upload);
+    if (!entry->last || !entry->upload)
+      continue;
+
+    entry->newname = generate_random_name (entry->path);
+    if (entry->newname == NULL)
+      goto out;
+    if (asprintf (&dest, "%s%s", root, entry->newname) == -1) {
+      perror ("asprintf");
+      goto out;
+    }
+    if (make_parent_dirs (root, entry->newname) == -1)
+      goto out;
+    if (rename (entry->outfile, dest) == -1) {
+      perror (dest);
+      goto out;
+    }
+    fprintf (list, ".%s%c", entry->newname, '\0');
+    nr_changed++;
+  }
+  if (fclose (list) == EOF) {
+    list = NULL;
+    perror (listfile);
+    goto out;
+  }
+  list = NULL;
+
+  if (nr_changed == 0) {
+    r = 0;
+    goto out;
+  }
+
+  if (run_tar (root, listfile, tarfile, verbose) == -1)
+    goto out;
+  if (guestfs_tar_in (g, tarfile, "/") == -1)
+    goto remove_uploads;
+
+  /* Set the attributes of the new files and rename them into place.
+   * This is the same as the end of do_upload, per file.
+   */
+  for (i = 0; i < nr_entries; ++i) {
+    struct batch_entry *entry = &entries[i];
+
+    if (!entry->last || !entry->upload)
+      continue;
+
+    if (guestfs_copy_attributes (g, entry->path, entry->newname,
+                                 GUESTFS_COPY_ATTRIBUTES_ALL, 1, -1) == -1)
+      goto remove_uploads;
+
+    if (backup_extension) {
+      CLEANUP_FREE char *backupname = NULL;
+
+      backupname = generate_backup_name (entry->path, backup_extension);
+      if (backupname == NULL)
+        goto remove_uploads;
+
+      if (guestfs_mv (g, entry->path, backupname) == -1)
+        goto remove_uploads;
+    }
+    if (guestfs_mv (g, entry->newname, entry->path) == -1)
+      goto remove_uploads;
+
+    entry->upload = false;      /* renamed, so nothing to remove */
+  }
+
+  r = 0;
+  goto out;
+
+ remove_uploads:
+  /* Don't leave the uploaded files which were not renamed into place
+   * lying around in the guest.
    */
-  setenv ("virt_edit_expr", perl_expr, 1);
-
-  /* Call out to a canned Perl script. */
-  if (asprintf (&cmd,
-                "perl -e '"
-                "$lineno = 0; "
-                "$expr = $ENV{virt_edit_expr}; "
-                "while (<STDIN>) { "
-                "  $lineno++; "
-                "  eval $expr; "
-                "  die if $@; "
-                "  print STDOUT $_ or die \"print: $!\"; "
-                "} "
-                "close STDOUT or die \"close: $!\"; "
-                "' < %s > %s",
-                tmpfilename, outfile) == -1) {
+  for (i = 0; i < nr_entries; ++i)
+    if (entries[i].last && entries[i].upload)
+      guestfs_rm_f (g, entries[i].newname);
+
+ out:
+  for (i = 0; i < nr_entries; ++i) {
+    free (entries[i].newname);
+    free (entries[i].infile);
+    free (entries[i].outfile);
+    line_edit_free (entries[i].le);
+    entries[i].newname = entries[i].infile = entries[i].outfile = NULL;
+    entries[i].le = NULL;
+  }
+  remove_dir (staging);
+  return r;
+}
+
+/**
+ * Run the edits of one generation, that is the edits which are the
+ * C<generation>'th edit of their file.  The in-process edits run in
+ * parallel in worker threads, and the Perl edits one at a time in
+ * this thread meanwhile.
+ *
+ * Returns C<-1> if any of the edits failed.
+ */
+static int
+run_generation (struct batch_entry *entries, size_t nr_entries,
+                size_t generation, int verbose)
+{
+  struct batch_queue queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .entries = entries,
+    .nr_entries = nr_entries,
+    .generation = generation,
+  };
+  CLEANUP_FREE pthread_t *threads = NULL;
+  size_t nr_threads = 0, nr_line_edits = 0;
+  long ncpus;
+  size_t i;
+
+  for (i = 0; i < nr_entries; ++i)
+    if (entries[i].generation == generation && entries[i].le != NULL)
+      nr_line_edits++;
+
+  ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+  nr_threads = MIN (nr_line_edits, ncpus > 0 ? (size_t) ncpus : 1);
+  if (nr_threads > 0) {
+    threads = calloc (nr_threads, sizeof *threads);
+    if (threads == NULL) {
+      perror ("calloc");
+      nr_threads = 0;
+    }
+  }
+  for (i = 0; i < nr_threads; ++i) {
+    const int err = pthread_create (&threads[i], NULL, batch_thread, &queue);
+    if (err != 0) {
+      errno = err;
+      perror ("pthread_create");
+      break;
+    }
+  }
+  nr_threads = i;
+  /* If no thread could be started, run the in-process edits here. */
+  if (nr_threads == 0)
+    batch_thread (&queue);
+
+  for (i = 0; i < nr_entries; ++i) {
+    struct batch_entry *entry = &entries[i];
+
+    if (entry->generation != generation || entry->le != NULL)
+      continue;
+    if (run_perl (entry->edit->perl_expr, entry->infile, entry->outfile,
+                  verbose) == -1)
+      entry->r = -1;
+    else
+      entry->r = files_identical (entry->infile, entry->outfile);
+  }
+
+  for (i = 0; i < nr_threads; ++i)
+    pthread_join (threads[i], NULL);
+
+  for (i = 0; i < nr_entries; ++i)
+    if (entries[i].generation == generation && entries[i].r == -1)
+      return -1;
+  return 0;
+}
+
+/**
+ * Worker thread for C<edit_batch>, running in-process edits until
+ * the queue is empty.
+ */
+static void *
+batch_thread (void *queuev)
+{
+  struct batch_queue *queue = queuev;
+
+  for (;;) {
+    struct batch_entry *entry = NULL;
+
+    pthread_mutex_lock (&queue->mutex);
+    while (queue->next < queue->nr_entries) {
+      entry = &queue->entries[queue->next++];
+      if (entry->le != NULL && entry->generation == queue->generation)
+        break;
+      entry = NULL;
+    }
+    pthread_mutex_unlock (&queue->mutex);
+
+    if (entry == NULL)
+      return NULL;
+
+    run_batch_entry (entry);
+  }
+}
+
+/**
+ * Run the in-process edit of a single batch entry, between local
+ * files.
+ */
+static void
+run_batch_entry (struct batch_entry *entry)
+{
+  CLEANUP_FCLOSE FILE *in = NULL;
+  FILE *out;
+  bool changed;
+
+  entry->r = -1;
+
+  in = fopen (entry->infile, "r");
+  if (in == NULL) {
+    perror (entry->infile);
+    return;
+  }
+  out = fopen (entry->outfile, "w");
+  if (out == NULL) {
+    perror (entry->outfile);
+    return;
+  }
+  if (line_edit_run (entry->le, in, out, &changed) == -1) {
+    perror (entry->edit->filename);
+    fclose (out);
+    return;
+  }
+  if (fclose (out) == EOF) {
+    perror (entry->outfile);
+    return;
+  }
+
+  entry->r = changed ? 0 : 1;
+}
+
+/**
+ * Create the directories leading to C<root> followed by the absolute
+ * C<path>, not including the last element of C<path>.
+ */
+static int
+make_parent_dirs (const char *root, const char *path)
+{
+  CLEANUP_FREE char *dir = NULL;
+  const size_t rootlen = strlen (root);
+  char *p;
+
+  if (asprintf (&dir, "%s%s", root, path) == -1) {
     perror ("asprintf");
     return -1;
   }
 
+  for (p = dir + 1; (p = strchr (p, '/')) != NULL; ++p) {
+    if ((size_t) (p - dir) < rootlen)
+      continue;
+    *p = '\0';
+    if (mkdir (dir, 0700) == -1 && errno != EEXIST) {
+      perror (dir);
+      return -1;
+    }
+    *p = '/';
+  }
+
+  return 0;
+}
+
+static int
+remove_file (const char *fpath, const struct stat *sb,
+             int typeflag, struct FTW *ftwbuf)
+{
+  return remove (fpath);
+}
+
+/**
+ * Remove the local directory C<dir> and its contents.
+ */
+static int
+remove_dir (const char *dir)
+{
+  return nftw (dir, remove_file, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+/**
+ * Run C<perl_expr> over each line of the local file C<infile> using
+ * Perl, writing the result to C<outfile>.
+ *
+ * This may be called while C<edit_files_perl> has worker threads
+ * running, so it must not change the environment.  The expression is
+ * passed to Perl as an argument, and Perl is started directly rather
+ * than through the shell, which sidesteps any quoting problems.
+ */
+static int
+run_perl (const char *perl_expr, const char *infile, const char *outfile,
+          int verbose)
+{
+  static const char script[] =
+    "$lineno = 0; "
+    "$expr = shift @ARGV; "
+    "while (<STDIN>) { "
+    "  $lineno++; "
+    "  eval $expr; "
+    "  die if $@; "
+    "  print STDOUT $_ or die \"print: $!\"; "
+    "} "
+    "close STDOUT or die \"close: $!\"; ";
+  char *const argv[] = {
+    (char *) "perl", (char *) "-e", (char *) script,
+    (char *) "--", (char *) perl_expr, NULL
+  };
+  posix_spawn_file_actions_t actions;
+  pid_t pid;
+  int err, status;
+
   if (verbose)
-    fprintf (stderr, "%s\n", cmd);
+    fprintf (stderr, "perl -e '%s' -- '%s' < %s > %s\n",
+             script, perl_expr, infile, outfile);
 
-  r = system (cmd);
-  if (r == -1 || !WIFEXITED (r) || WEXITSTATUS (r) != 0)
+  err = posix_spawn_file_actions_init (&actions);
+  if (err != 0) {
+    errno = err;
+    perror ("posix_spawn_file_actions_init");
     return -1;
+  }
+  err = posix_spawn_file_actions_addopen (&actions, 0, infile,
+                                          O_RDONLY, 0);
+  if (err == 0)
+    err = posix_spawn_file_actions_addopen (&actions, 1, outfile,
+                                            O_WRONLY|O_CREAT|O_TRUNC, 0600);
+  if (err == 0)
+    err = posix_spawnp (&pid, "perl", &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy (&actions);
+  if (err != 0) {
+    errno = err;
+    perror ("perl");
+    return -1;
+  }
 
-  if (rename (outfile, tmpfilename) == -1) {
-    perror ("rename");
+  if (waitpid (pid, &status, 0) == -1) {
+    perror ("waitpid");
     return -1;
   }
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    return -1;
 
-  if (do_upload (g, filename, tmpfilename, backup_extension) == -1)
+  return 0;
+}
+
+/**
+ * Create the tarball C<tarfile> of the files under the local
+ * directory C<root> which are listed (relative to C<root>, separated
+ * by C<\0> characters) in C<listfile>.
+ *
+ * Only the files are listed, so no directory in the guest has its
+ * metadata replaced.  The owner and permissions are fixed up
+ * afterwards with C<guestfs_copy_attributes>.  As in C<run_perl>, tar
+ * is started directly, so the paths (which come from C<$TMPDIR>) need
+ * no quoting.
+ */
+static int
+run_tar (const char *root, const char *listfile, const char *tarfile,
+         int verbose)
+{
+  char *const argv[] = {
+    (char *) "tar", (char *) "-C", (char *) root,
+    (char *) "--no-recursion", (char *) "--null",
+    (char *) "-T", (char *) listfile,
+    (char *) "--owner=0", (char *) "--group=0", (char *) "--numeric-owner",
+    (char *) "--mode=0600",
+    (char *) "-cf", (char *) tarfile, NULL
+  };
+  pid_t pid;
+  int err, status;
+
+  if (verbose)
+    fprintf (stderr, "tar -C '%s' --no-recursion --null -T '%s' "
+             "--owner=0 --group=0 --numeric-owner --mode=0600 -cf '%s'\n",
+             root, listfile, tarfile);
+
+  err = posix_spawnp (&pid, "tar", NULL, NULL, argv, environ);
+  if (err != 0) {
+    errno = err;
+    perror ("tar");
+    return -1;
+  }
+
+  if (waitpid (pid, &status, 0) == -1) {
+    perror ("waitpid");
+    return -1;
+  }
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+    fprintf (stderr, "%s: tar failed\n", tarfile);
     return -1;
+  }
 
   return 0;
 }
 
+/**
+ * Create an anonymous temporary file.  Where possible this is a
+ * memfd, so the file contents never touch the local disk.
+ */
+static int
+make_anonymous_temp (guestfs_h *g)
+{
+  CLEANUP_FREE char *tmpdir = NULL;
+  CLEANUP_FREE char *tmpfilename = NULL;
+  int fd;
+
+#ifdef MFD_CLOEXEC
+  fd = memfd_create ("libguestfs-edit", MFD_CLOEXEC);
+  if (fd >= 0)
+    return fd;
+#endif
+
+  tmpdir = guestfs_get_tmpdir (g);
+  if (asprintf (&tmpfilename, "%s/libguestfsXXXXXX", tmpdir) == -1) {
+    perror ("asprintf");
+    return -1;
+  }
+  fd = mkstemp (tmpfilename);
+  if (fd == -1) {
+    perror ("mkstemp");
+    return -1;
+  }
+  unlink (tmpfilename);
+  return fd;
+}
+
+/**
+ * Edit C<filename> using the compiled line editor expression C<le>.
+ * The file is downloaded into, and uploaded from, anonymous
+ * temporary files.
+ */
+static int
+edit_file_line_edit (guestfs_h *g, const char *filename,
+                     const struct line_edit *le,
+                     const char *backup_extension, int verbose)
+{
+  CLEANUP_FCLOSE FILE *in = NULL;
+  CLEANUP_FCLOSE FILE *out = NULL;
+  char buf[256];
+  bool changed;
+  int fd;
+
+  if (verbose)
+    fprintf (stderr, "editing %s in-process\n", filename);
+
+  fd = make_anonymous_temp (g);
+  if (fd == -1)
+    return -1;
+  in = fdopen (fd, "r");
+  if (in == NULL) {
+    perror ("fdopen");
+    close (fd);
+    return -1;
+  }
+  snprintf (buf, sizeof buf, "/dev/fd/%d", fd);
+  if (guestfs_download (g, filename, buf) == -1)
+    return -1;
+
+  fd = make_anonymous_temp (g);
+  if (fd == -1)
+    return -1;
+  out = fdopen (fd, "w");
+  if (out == NULL) {
+    perror ("fdopen");
+    close (fd);
+    return -1;
+  }
+
+  if (line_edit_run (le, in, out, &changed) == -1 || fflush (out) == EOF) {
+    perror (filename);
+    return -1;
+  }
+  if (!changed)
+    return 1;
+
+  snprintf (buf, sizeof buf, "/dev/fd/%d", fd);
+  if (do_upload (g, filename, buf, backup_extension) == -1)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Compare two local files.  Returns C<1> if they have the same
+ * content, C<0> if not, or C<-1> on error.
+ *
+ * The files are compared directly rather than by hashing them: both
+ * have to be read in full either way, and this cannot collide.
+ */
+static int
+files_identical (const char *file1, const char *file2)
+{
+  CLEANUP_CLOSE int fd1 = -1;
+  CLEANUP_CLOSE int fd2 = -1;
+  struct stat st1, st2;
+  CLEANUP_FREE char *buf = NULL;
+  const size_t bufsize = 65536;
+
+  fd1 = open (file1, O_RDONLY|O_CLOEXEC);
+  if (fd1 == -1 || fstat (fd1, &st1) == -1) {
+    perror (file1);
+    return -1;
+  }
+  fd2 = open (file2, O_RDONLY|O_CLOEXEC);
+  if (fd2 == -1 || fstat (fd2, &st2) == -1) {
+    perror (file2);
+    return -1;
+  }
+  if (st1.st_size != st2.st_size)
+    return 0;
+
+  buf = malloc (2 * bufsize);
+  if (buf == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+
+  for (;;) {
+    const ssize_t n = read (fd1, buf, bufsize);
+    ssize_t m, r;
+
+    if (n == -1) {
+      perror (file1);
+      return -1;
+    }
+    if (n == 0)
+      return 1;
+
+    for (m = 0; m < n; m += r) {
+      r = read (fd2, buf + bufsize + m, n - m);
+      if (r == -1) {
+        perror (file2);
+        return -1;
+      }
+      if (r == 0)               /* file2 was truncated */
+        return 0;
+    }
+
+    if (memcmp (buf, buf + bufsize, n) != 0)
+      return 0;
+  }
+}
+
 static int
 do_download (guestfs_h *g, const char *filename, char **tempfile)
 {
@@ -29,4 +29,15 @@ extern int edit_file_perl (guestfs_h *g, const char *filename,
                            const char *perl_expr,
                            const char *backup_extension, int verbose);
 
+/* One file in a batch of edits, see edit_files_perl. */
+struct file_edit {
+  const char *filename;         /* File to edit. */
+  const char *perl_expr;        /* Perl expression to run over it. */
+  int result;                   /* Set to 0 if changed, 1 if unchanged. */
+};
+
+extern int edit_files_perl (guestfs_h *g, struct file_edit *edits,
+                            size_t nr_edits, const char *backup_extension,
+                            int verbose);
+
 #endif
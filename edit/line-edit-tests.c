@@ -0,0 +1,289 @@
+/* libguestfs
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Differential tests of the in-process line editor.
+ *
+ * Each expression is run over each input both by C<line_edit_run>
+ * and by the same Perl script that F<file-edit.c> runs when an
+ * expression cannot be handled in-process, and the outputs must be
+ * identical.  Note that in that script (unlike C<perl -pe>) C<next>
+ * skips printing the line.  Expressions which Perl would interpolate
+ * must be rejected by C<line_edit_compile>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "line-edit.h"
+
+/* Expressions which must be handled in-process. */
+static const char *exprs[] = {
+  "s/a/b/",
+  "s/a/b/g",
+  "s/x*/-/g",
+  "s/\\b/|/g",
+  "s/^/> /",
+  "s/$/;/",
+  "s/$/;/g",
+  "s/\\n/<NL>/",
+  "s/.$/X/",
+  "s/\\s+$//",
+  "s/^(\\w+)=(.*)$/$2=$1/",
+  "s/(a)(b)?/[${1}${2}]/g",
+  "s/[aeiou]+/<$&>/g",
+  "s/(\\d+)/${1}0/g",
+  "s/(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)/$10$1/",
+  "s/A/b/i",
+  "s/^b.*$/Z/m",
+  "s/a.b/X/s",
+  "s/ a b /X/x",
+  "s#/#\\\\#g",
+  "s,a,\\t,g",
+  "s/a/\\$\\@/",
+  "s/(\\w)\\1/double/g",
+  "next if /^#/; s/a/b/g",
+  "next unless /a/; s/$/!/",
+  "$_ = \"\" if /^b/",
+  "$_ = '' unless /a/",
+  "s/a/b/; s/b/c/g; $_ = \"\" if /^c$/",
+};
+
+/* Expressions which Perl would interpolate, or which are otherwise
+ * not supported, and so must be rejected.
+ */
+static const char *rejects[] = {
+  "s/a/$x/",
+  "s/a/@x/",
+  "s/a/@{x}/",
+  "s/$x/b/",
+  "s/@x/b/",
+  "s/a/$$/",
+  "s/a/$0/",
+  "s/a/${0}/",
+  "s/(a)/$01/",
+  "s/(a)/${01}/",
+  "s/a/b/e",
+  "s/a/b/r",
+  "tr/a/b/",
+  "print",
+  "s(a)(b)",
+  "s'a'$x'",
+  "next if $x",
+  "$_ = \"x\" if /a/",
+  "m/x$/ and 1",
+  "",
+};
+
+static const char *inputs[] = {
+  "",
+  "\n",
+  "a\n",
+  "abc\n",
+  "aab ab abb\n",
+  "no newline at end",
+  "a\nb\nc\n",
+  "# comment\nkey=value\nfoo=bar baz\n\n",
+  "xxaxx\nx\n",
+  "  trailing spaces   \n\ttab\t\n",
+  "a.b\na\nb\n",
+  "a/b/c\n",
+  "aa bb cc 123 4\n",
+  "AbA aBa\nbAb",
+  "b\nab\nba\nc\n",
+  "a\r\nb\r\n",
+};
+
+/* The script from run_perl in file-edit.c. */
+static const char perl_script[] =
+  "$lineno = 0; "
+  "$expr = shift @ARGV; "
+  "while (<STDIN>) { "
+  "  $lineno++; "
+  "  eval $expr; "
+  "  die if $@; "
+  "  print STDOUT $_ or die \"print: $!\"; "
+  "} "
+  "close STDOUT or die \"close: $!\"; ";
+
+static int
+run_perl (const char *expr, const char *input, char **output, size_t *len)
+{
+  char infile[] = "/tmp/line-edit-tests-in.XXXXXX";
+  char outfile[] = "/tmp/line-edit-tests-out.XXXXXX";
+  int infd, outfd, status;
+  pid_t pid;
+  FILE *fp;
+  long size;
+
+  infd = mkstemp (infile);
+  outfd = mkstemp (outfile);
+  if (infd == -1 || outfd == -1) {
+    perror ("mkstemp");
+    exit (EXIT_FAILURE);
+  }
+  if (write (infd, input, strlen (input)) != (ssize_t) strlen (input) ||
+      lseek (infd, 0, SEEK_SET) == -1) {
+    perror (infile);
+    exit (EXIT_FAILURE);
+  }
+
+  pid = fork ();
+  if (pid == -1) {
+    perror ("fork");
+    exit (EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    dup2 (infd, 0);
+    dup2 (outfd, 1);
+    execlp ("perl", "perl", "-e", perl_script, "--", expr, NULL);
+    _exit (127);
+  }
+  if (waitpid (pid, &status, 0) == -1) {
+    perror ("waitpid");
+    exit (EXIT_FAILURE);
+  }
+  close (infd);
+  unlink (infile);
+
+  fp = fdopen (outfd, "r");
+  if (fp == NULL || fseek (fp, 0, SEEK_END) == -1 ||
+      (size = ftell (fp)) == -1 || fseek (fp, 0, SEEK_SET) == -1) {
+    perror (outfile);
+    exit (EXIT_FAILURE);
+  }
+  *output = malloc (size + 1);
+  if (*output == NULL) {
+    perror ("malloc");
+    exit (EXIT_FAILURE);
+  }
+  *len = fread (*output, 1, size, fp);
+  fclose (fp);
+  unlink (outfile);
+
+  return WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+}
+
+static int
+test_expr (const char *expr)
+{
+  struct line_edit *le;
+  size_t i;
+  int errors = 0;
+
+  le = line_edit_compile (expr);
+  if (le == NULL) {
+    fprintf (stderr, "line_edit_compile: unexpectedly rejected: %s\n", expr);
+    return 1;
+  }
+
+  for (i = 0; i < sizeof inputs / sizeof inputs[0]; ++i) {
+    FILE *in, *out;
+    char *actual = NULL, *expected = NULL;
+    size_t actual_len = 0, expected_len;
+    bool changed;
+
+    if (run_perl (expr, inputs[i], &expected, &expected_len) != 0) {
+      fprintf (stderr, "perl: '%s' failed\n", expr);
+      errors++;
+      free (expected);
+      continue;
+    }
+
+    /* fmemopen cannot open an empty buffer. */
+    if (strlen (inputs[i]) > 0)
+      in = fmemopen ((void *) inputs[i], strlen (inputs[i]), "r");
+    else
+      in = fopen ("/dev/null", "r");
+    out = open_memstream (&actual, &actual_len);
+    if (in == NULL || out == NULL) {
+      perror ("fmemopen");
+      exit (EXIT_FAILURE);
+    }
+    if (line_edit_run (le, in, out, &changed) == -1) {
+      perror ("line_edit_run");
+      exit (EXIT_FAILURE);
+    }
+    fclose (in);
+    fclose (out);
+
+    if (actual_len != expected_len ||
+        memcmp (actual, expected, actual_len) != 0) {
+      fprintf (stderr,
+               "mismatch: expr '%s' input \"%s\"\n"
+               "  perl:      \"%.*s\"\n"
+               "  line_edit: \"%.*s\"\n",
+               expr, inputs[i],
+               (int) expected_len, expected, (int) actual_len, actual);
+      errors++;
+    }
+    else if (changed != (actual_len != strlen (inputs[i]) ||
+                         memcmp (actual, inputs[i], actual_len) != 0)) {
+      fprintf (stderr, "wrong 'changed' flag: expr '%s' input \"%s\"\n",
+               expr, inputs[i]);
+      errors++;
+    }
+
+    free (actual);
+    free (expected);
+  }
+
+  line_edit_free (le);
+  return errors;
+}
+
+int
+main (int argc __attribute__((unused)), char *argv[])
+{
+  char *output;
+  size_t i, len;
+  int errors = 0;
+
+  /* Skip the test if there is no Perl to compare against. */
+  if (run_perl ("", "", &output, &len) != 0) {
+    fprintf (stderr, "%s: test skipped because perl is not available\n",
+             argv[0]);
+    exit (77);
+  }
+  free (output);
+
+  for (i = 0; i < sizeof exprs / sizeof exprs[0]; ++i)
+    errors += test_expr (exprs[i]);
+
+  for (i = 0; i < sizeof rejects / sizeof rejects[0]; ++i) {
+    struct line_edit *le = line_edit_compile (rejects[i]);
+
+    if (le != NULL) {
+      fprintf (stderr, "line_edit_compile: unexpectedly accepted: %s\n",
+               rejects[i]);
+      line_edit_free (le);
+      errors++;
+    }
+  }
+
+  exit (errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
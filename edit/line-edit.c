@@ -0,0 +1,680 @@
+/* libguestfs - shared file editing
+ * Copyright (C) 2009-2019 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * This file implements an in-process line editor for the simple Perl
+ * expressions which are most often passed to C<edit_file_perl>, so
+ * that they can be run without starting a Perl interpreter for every
+ * file.
+ *
+ * Only a subset of Perl is understood.  The expression must be a
+ * sequence of statements separated by C<;>, each of which is one of:
+ *
+ *  s/REGEXP/REPLACEMENT/FLAGS
+ *  next if /REGEXP/FLAGS
+ *  next unless /REGEXP/FLAGS
+ *  $_ = "" if /REGEXP/FLAGS
+ *  $_ = "" unless /REGEXP/FLAGS
+ *
+ * C</REGEXP/> may also be written C<m/REGEXP/>, and most punctuation
+ * characters can be used as delimiters instead of C</>.  C<FLAGS>
+ * are any of C<imsx>, and C<g> for substitutions.  The replacement
+ * may refer to C<$1>, C<${1}> and C<$&>, and use the usual
+ * backslash escapes.
+ *
+ * Anything else, in particular anything which would interpolate a
+ * Perl variable, is rejected by C<line_edit_compile>, and the caller
+ * must fall back to running Perl.  Regular expressions are handled by
+ * PCRE2, which is compatible with Perl for the expressions accepted
+ * here.  As in Perl, each line is matched including its trailing
+ * newline.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#include "c-ctype.h"
+#include "guestfs-utils.h"
+
+#include "line-edit.h"
+
+enum statement_type {
+  STMT_SUBST,                   /* s/re/repl/ */
+  STMT_NEXT,                    /* next if|unless /re/ */
+  STMT_CLEAR,                   /* $_ = "" if|unless /re/ */
+};
+
+/* A piece of the replacement string: either literal text, or a
+ * capture group.
+ */
+struct repl_part {
+  int group;                    /* -1 for literal text */
+  size_t offset, len;           /* literal text in statement->literals */
+};
+
+struct statement {
+  enum statement_type type;
+  pcre2_code *re;
+  bool unless;                  /* STMT_NEXT, STMT_CLEAR: negate the match */
+  bool global;                  /* STMT_SUBST: /g flag */
+  char *literals;
+  struct repl_part *parts;
+  size_t nr_parts;
+};
+
+struct line_edit {
+  struct statement *stmts;
+  size_t nr_stmts;
+  uint32_t max_pairs;           /* match data size for all statements */
+};
+
+/* A growable byte buffer. */
+struct buffer {
+  char *data;
+  size_t len, alloc;
+};
+
+static int
+buffer_append (struct buffer *buf, const char *data, size_t len)
+{
+  if (buf->len + len > buf->alloc) {
+    size_t alloc = buf->alloc ? buf->alloc : 256;
+    char *p;
+
+    while (alloc < buf->len + len)
+      alloc *= 2;
+    p = realloc (buf->data, alloc);
+    if (p == NULL)
+      return -1;
+    buf->data = p;
+    buf->alloc = alloc;
+  }
+  memcpy (&buf->data[buf->len], data, len);
+  buf->len += len;
+  return 0;
+}
+
+static void
+skip_spaces (const char **p)
+{
+  while (c_isspace (**p))
+    (*p)++;
+}
+
+/* Is the string at p the keyword kw, followed by a non-word char? */
+static bool
+skip_keyword (const char **p, const char *kw)
+{
+  const size_t len = strlen (kw);
+
+  if (strncmp (*p, kw, len) != 0 ||
+      c_isalnum ((*p)[len]) || (*p)[len] == '_')
+    return false;
+  *p += len;
+  return true;
+}
+
+/* Delimiters which mean the same thing in Perl as '/'.  Brackets
+ * (which nest) and quotes (which change interpolation) are not
+ * allowed, nor are regular expression metacharacters.
+ */
+static bool
+is_delimiter (char c)
+{
+  return c != '\0' && strchr ("/#!,:%~=", c) != NULL;
+}
+
+/* Read the text up to the next unescaped delimiter, leaving
+ * backslashes in place.
+ */
+static char *
+parse_delimited (const char **p, char delim)
+{
+  const char *start = *p, *q;
+  char *ret;
+
+  for (q = start; *q != delim; ++q) {
+    if (*q == '\0')
+      return NULL;
+    if (*q == '\\' && q[1] != '\0')
+      ++q;
+  }
+
+  ret = strndup (start, q - start);
+  *p = q + 1;
+  return ret;
+}
+
+static bool
+parse_flags (const char **p, bool allow_global, uint32_t *options,
+             bool *global)
+{
+  *options = 0;
+  if (global)
+    *global = false;
+
+  for (; c_isalpha (**p); (*p)++) {
+    switch (**p) {
+    case 'i': *options |= PCRE2_CASELESS; break;
+    case 'm': *options |= PCRE2_MULTILINE; break;
+    case 's': *options |= PCRE2_DOTALL; break;
+    case 'x': *options |= PCRE2_EXTENDED; break;
+    case 'g':
+      if (!allow_global)
+        return false;
+      *global = true;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Reject patterns where Perl would interpolate a variable. */
+static bool
+check_pattern (const char *pattern)
+{
+  const char *p;
+
+  for (p = pattern; *p; ++p) {
+    switch (*p) {
+    case '\\':
+      if (p[1] != '\0')
+        ++p;
+      break;
+    case '$':
+      if (p[1] != '\0' && p[1] != ')' && p[1] != '|')
+        return false;
+      break;
+    case '@':
+      if (c_isalnum (p[1]) ||
+          (p[1] != '\0' && strchr ("_{$:", p[1]) != NULL))
+        return false;
+      break;
+    }
+  }
+  return true;
+}
+
+static pcre2_code *
+compile_pattern (const char *pattern, uint32_t options)
+{
+  int errorcode;
+  PCRE2_SIZE erroroffset;
+  pcre2_compile_context *ccontext;
+  pcre2_code *re;
+
+  if (!check_pattern (pattern))
+    return NULL;
+
+  /* Perl only treats "\n" as a newline for $, ^ and /m, whatever
+   * newline convention PCRE2 was built with.
+   */
+  ccontext = pcre2_compile_context_create (NULL);
+  if (ccontext == NULL)
+    return NULL;
+  pcre2_set_newline (ccontext, PCRE2_NEWLINE_LF);
+
+  re = pcre2_compile ((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED,
+                      options, &errorcode, &erroroffset, ccontext);
+  pcre2_compile_context_free (ccontext);
+  return re;
+}
+
+static int
+add_part (struct statement *stmt, int group, size_t offset, size_t len)
+{
+  struct repl_part *parts;
+
+  /* Extend the previous piece of literal text if possible. */
+  if (group == -1 && stmt->nr_parts > 0 &&
+      stmt->parts[stmt->nr_parts-1].group == -1) {
+    stmt->parts[stmt->nr_parts-1].len += len;
+    return 0;
+  }
+
+  parts = realloc (stmt->parts, (stmt->nr_parts + 1) * sizeof *parts);
+  if (parts == NULL)
+    return -1;
+  stmt->parts = parts;
+  parts[stmt->nr_parts].group = group;
+  parts[stmt->nr_parts].offset = offset;
+  parts[stmt->nr_parts].len = len;
+  stmt->nr_parts++;
+  return 0;
+}
+
+/* Parse the replacement part of s///, which Perl treats as a double
+ * quoted string.  Returns false if it uses anything not supported.
+ */
+static bool
+parse_replacement (struct statement *stmt, const char *repl)
+{
+  const char *p = repl;
+  char *lit;
+  size_t nr_lit = 0;
+
+  /* The literal text is never longer than the replacement. */
+  lit = malloc (strlen (repl) + 1);
+  if (lit == NULL)
+    return false;
+  stmt->literals = lit;
+
+  while (*p) {
+    char c = *p++;
+    long group;
+
+    switch (c) {
+    case '\\':
+      c = *p++;
+      switch (c) {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case 'f': c = '\f'; break;
+      case 'a': c = '\a'; break;
+      case 'e': c = '\033'; break;
+      case '\0':
+        return false;
+      default:
+        /* \x, \u, \L, \1 etc. are not supported. */
+        if (c_isalnum (c))
+          return false;
+      }
+      break;
+
+    case '$':
+      if (*p == '&') {
+        group = 0;
+        p++;
+      }
+      /* $0 is the program name in Perl, and Perl does not read
+       * group numbers with leading zeroes the same way.
+       */
+      else if (*p == '0' || (*p == '{' && p[1] == '0'))
+        return false;
+      else if (c_isdigit (*p)) {
+        group = strtol (p, (char **) &p, 10);
+      }
+      else if (*p == '{' && c_isdigit (p[1])) {
+        group = strtol (p+1, (char **) &p, 10);
+        if (*p != '}')
+          return false;
+        p++;
+      }
+      else
+        return false;
+      if (group > 65535)
+        return false;
+      if (add_part (stmt, group, 0, 0) == -1)
+        return false;
+      continue;
+
+    case '@':
+      if (c_isalnum (*p) || (*p != '\0' && strchr ("_{$:", *p) != NULL))
+        return false;
+      break;
+    }
+
+    lit[nr_lit] = c;
+    if (add_part (stmt, -1, nr_lit, 1) == -1)
+      return false;
+    nr_lit++;
+  }
+
+  return true;
+}
+
+/* Parse "/re/flags" or "mXreXflags". */
+static pcre2_code *
+parse_match (const char **p)
+{
+  CLEANUP_FREE char *pattern = NULL;
+  uint32_t options;
+  char delim;
+
+  if (**p == 'm' && is_delimiter ((*p)[1]))
+    (*p)++;
+  else if (**p != '/')
+    return NULL;
+  delim = *(*p)++;
+
+  pattern = parse_delimited (p, delim);
+  if (pattern == NULL)
+    return NULL;
+  if (!parse_flags (p, false, &options, NULL))
+    return NULL;
+
+  return compile_pattern (pattern, options);
+}
+
+static bool
+parse_statement (const char **p, struct statement *stmt)
+{
+  if (**p == 's' && is_delimiter ((*p)[1])) {
+    CLEANUP_FREE char *pattern = NULL, *repl = NULL;
+    uint32_t options;
+    char delim;
+
+    (*p)++;
+    delim = *(*p)++;
+    stmt->type = STMT_SUBST;
+    pattern = parse_delimited (p, delim);
+    if (pattern == NULL)
+      return false;
+    repl = parse_delimited (p, delim);
+    if (repl == NULL)
+      return false;
+    if (!parse_flags (p, true, &options, &stmt->global))
+      return false;
+    if (!parse_replacement (stmt, repl))
+      return false;
+    stmt->re = compile_pattern (pattern, options);
+    return stmt->re != NULL;
+  }
+
+  if (skip_keyword (p, "next"))
+    stmt->type = STMT_NEXT;
+  else if (STRPREFIX (*p, "$_")) {
+    *p += 2;
+    skip_spaces (p);
+    if (**p != '=')
+      return false;
+    (*p)++;
+    skip_spaces (p);
+    if (!STRPREFIX (*p, "\"\"") && !STRPREFIX (*p, "''"))
+      return false;
+    *p += 2;
+    stmt->type = STMT_CLEAR;
+  }
+  else
+    return false;
+
+  skip_spaces (p);
+  if (skip_keyword (p, "if"))
+    stmt->unless = false;
+  else if (skip_keyword (p, "unless"))
+    stmt->unless = true;
+  else
+    return false;
+  skip_spaces (p);
+
+  stmt->re = parse_match (p);
+  return stmt->re != NULL;
+}
+
+/**
+ * Parse and compile C<perl_expr>.
+ *
+ * Returns C<NULL> if the expression is not one which can be run
+ * in-process (see the description at the top of this file), in which
+ * case the caller should run it using Perl.
+ */
+struct line_edit *
+line_edit_compile (const char *perl_expr)
+{
+  struct line_edit *le;
+  const char *p = perl_expr;
+  size_t i;
+
+  le = calloc (1, sizeof *le);
+  if (le == NULL)
+    return NULL;
+
+  for (;;) {
+    struct statement *stmts;
+
+    skip_spaces (&p);
+    if (*p == '\0')
+      break;
+
+    stmts = realloc (le->stmts, (le->nr_stmts + 1) * sizeof *stmts);
+    if (stmts == NULL)
+      goto error;
+    le->stmts = stmts;
+    memset (&stmts[le->nr_stmts], 0, sizeof *stmts);
+    le->nr_stmts++;
+
+    if (!parse_statement (&p, &stmts[le->nr_stmts-1]))
+      goto error;
+
+    skip_spaces (&p);
+    if (*p == ';')
+      p++;
+    else if (*p != '\0')
+      goto error;
+  }
+
+  if (le->nr_stmts == 0)
+    goto error;
+
+  /* Groups above the capture count never match, so this is enough
+   * for all the statements.
+   */
+  le->max_pairs = 1;
+  for (i = 0; i < le->nr_stmts; ++i) {
+    uint32_t count;
+
+    if (pcre2_pattern_info (le->stmts[i].re, PCRE2_INFO_CAPTURECOUNT,
+                            &count) == 0 && count + 1 > le->max_pairs)
+      le->max_pairs = count + 1;
+  }
+
+  return le;
+
+ error:
+  line_edit_free (le);
+  return NULL;
+}
+
+void
+line_edit_free (struct line_edit *le)
+{
+  size_t i;
+
+  if (le == NULL)
+    return;
+
+  for (i = 0; i < le->nr_stmts; ++i) {
+    pcre2_code_free (le->stmts[i].re);
+    free (le->stmts[i].literals);
+    free (le->stmts[i].parts);
+  }
+  free (le->stmts);
+  free (le);
+}
+
+static int
+append_replacement (const struct statement *stmt, pcre2_match_data *md,
+                    const char *subject, int rc, struct buffer *out)
+{
+  const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer (md);
+  size_t i;
+
+  for (i = 0; i < stmt->nr_parts; ++i) {
+    const struct repl_part *part = &stmt->parts[i];
+
+    if (part->group == -1) {
+      if (buffer_append (out, &stmt->literals[part->offset], part->len) == -1)
+        return -1;
+    }
+    /* Groups which don't exist or didn't match are empty, as in Perl. */
+    else if (part->group < rc && ovector[2*part->group] != PCRE2_UNSET) {
+      const size_t start = ovector[2*part->group];
+      const size_t end = ovector[2*part->group+1];
+
+      if (buffer_append (out, &subject[start], end - start) == -1)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Run s/// on the line in 'in', writing the result to 'out'.  This
+ * follows Perl's rules for empty matches with /g.  Returns the number
+ * of substitutions made, or -1 on error.
+ */
+static int
+substitute (const struct statement *stmt, pcre2_match_data *md,
+            const struct buffer *in, struct buffer *out)
+{
+  const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer (md);
+  size_t start = 0, copied = 0;
+  uint32_t options = 0;
+  int rc, n = 0;
+
+  out->len = 0;
+
+  while (start <= in->len) {
+    rc = pcre2_match (stmt->re, (PCRE2_SPTR) in->data, in->len, start,
+                      options, md, NULL);
+    if (rc == PCRE2_ERROR_NOMATCH) {
+      if (options == 0)
+        break;
+      /* Retry after an empty match: move on one character. */
+      start++;
+      options = 0;
+      continue;
+    }
+    if (rc < 0) {
+      errno = rc == PCRE2_ERROR_NOMEMORY ? ENOMEM : EINVAL;
+      return -1;
+    }
+    if (rc == 0)                /* ovector too small, can't happen */
+      rc = pcre2_get_ovector_count (md);
+
+    if (buffer_append (out, &in->data[copied], ovector[0] - copied) == -1 ||
+        append_replacement (stmt, md, in->data, rc, out) == -1)
+      return -1;
+    copied = ovector[1];
+    n++;
+
+    if (!stmt->global)
+      break;
+
+    start = ovector[1];
+    options = ovector[0] == ovector[1] ?
+      PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED : 0;
+  }
+
+  if (buffer_append (out, &in->data[copied], in->len - copied) == -1)
+    return -1;
+  return n;
+}
+
+/**
+ * Run the compiled expression over each line of C<in>, writing the
+ * result to C<out>.  C<*changed> is set to true if the output differs
+ * from the input.
+ *
+ * C<le> is not modified, so several threads may run the same
+ * compiled expression at once.
+ *
+ * Returns C<0> on success, or C<-1> on error with C<errno> set.
+ */
+int
+line_edit_run (const struct line_edit *le, FILE *in, FILE *out,
+               bool *changed)
+{
+  struct buffer bufs[2] = { { .data = NULL }, { .data = NULL } };
+  struct buffer *line = &bufs[0], *tmp = &bufs[1];
+  pcre2_match_data *match_data;
+  CLEANUP_FREE char *input = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+  size_t i;
+  int r = -1;
+
+  *changed = false;
+
+  match_data = pcre2_match_data_create (le->max_pairs, NULL);
+  if (match_data == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  while ((len = getline (&input, &allocsize, in)) != -1) {
+    bool print = true;
+
+    line->len = 0;
+    if (buffer_append (line, input, len) == -1)
+      goto out;
+
+    for (i = 0; i < le->nr_stmts && print; ++i) {
+      const struct statement *stmt = &le->stmts[i];
+      struct buffer *swap;
+      int rc;
+
+      switch (stmt->type) {
+      case STMT_SUBST:
+        rc = substitute (stmt, match_data, line, tmp);
+        if (rc == -1)
+          goto out;
+        /* Only compare the lines if something was substituted. */
+        if (rc > 0 && !*changed)
+          *changed = tmp->len != line->len ||
+            memcmp (tmp->data, line->data, line->len) != 0;
+        swap = line;
+        line = tmp;
+        tmp = swap;
+        break;
+
+      case STMT_NEXT:
+      case STMT_CLEAR:
+        rc = pcre2_match (stmt->re, (PCRE2_SPTR) line->data, line->len, 0, 0,
+                          match_data, NULL);
+        if (rc < 0 && rc != PCRE2_ERROR_NOMATCH) {
+          errno = rc == PCRE2_ERROR_NOMEMORY ? ENOMEM : EINVAL;
+          goto out;
+        }
+        if ((rc >= 0) != stmt->unless) {
+          if (line->len > 0)
+            *changed = true;
+          if (stmt->type == STMT_NEXT)
+            print = false;
+          else
+            line->len = 0;
+        }
+        break;
+      }
+    }
+
+    if (print && line->len > 0 &&
+        fwrite (line->data, 1, line->len, out) != line->len)
+      goto out;
+  }
+
+  if (!ferror (in))
+    r = 0;
+
+ out:
+  pcre2_match_data_free (match_data);
+  free (bufs[0].data);
+  free (bufs[1].data);
+  return r;
+}
@@ -0,0 +1,32 @@
+/* libguestfs - shared file editing
+ * Copyright (C) 2009-2019 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FISH_LINE_EDIT_H
+#define FISH_LINE_EDIT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+struct line_edit;
+
+extern struct line_edit *line_edit_compile (const char *perl_expr);
+extern int line_edit_run (const struct line_edit *le, FILE *in, FILE *out,
+                          bool *changed);
+extern void line_edit_free (struct line_edit *le);
+
+#endif
@@ -122,9 +122,28 @@ let run (g : G.guestfs) root (ops : ops) =
     )
   in
 
+  (* Files which --edit did not change, and so were not rewritten. *)
+  let unchanged_edits = ref 0 in
+
+  (* Consecutive --edit operations are done together, which is much
+   * faster than editing the files one at a time.
+   *)
+  let pending_edits = ref [] in
+  let flush_edits () =
+    if !pending_edits <> [] then (
+      let edits = List.rev !pending_edits in
+      pending_edits := [];
+      let changed = Perl_edit.edit_files g#ocaml_handle edits in
+      List.iter (fun changed -> if not changed then incr unchanged_edits)
+        changed
+    )
+  in
+
   (* Perform the remaining customizations in command-line order. *)
   List.iter (
-    function
+    fun op ->
+    (match op with `Edit _ -> () | _ -> flush_edits ());
+    match op with
     | `AppendLine (path, line) ->
        (* It's an error if it's not a single line.  This is
         * to prevent incorrect line endings being added to a file.
@@ -185,7 +204,7 @@ let run (g : G.guestfs) root (ops : ops) =
       if not (g#is_file ~followsymlinks:true path) then
         error (f_"%s is not a regular file in the guest") path;
 
-      Perl_edit.edit_file g#ocaml_handle path expr
+      List.push_front (path, expr) pending_edits
 
     | `FirstbootCommand cmd ->
       message (f_"Installing firstboot command: %s") cmd;
@@ -346,6 +365,11 @@ let run (g : G.guestfs) root (ops : ops) =
       message (f_"Writing: %s") path;
       g#write path content
   ) ops.ops;
+  flush_edits ();
+
+  if !unchanged_edits > 0 then
+    message (f_"Files not changed by --edit (not rewritten): %d")
+      !unchanged_edits;
 
   (* Set all the passwords at the end. *)
   if Hashtbl.length passwords > 0 then (
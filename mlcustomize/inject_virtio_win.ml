@@ -443,12 +443,15 @@ and virtio_iso_path_matches_guest_os t path =
      * this driver is for.  Paths can be things like:
      * "./NetKVM/2k12R2/amd64/netkvm.sys" (on the ISO) or
      * "./drivers/by-os/amd64/2k12R2/netkvm.sys" (in /usr/share/virtio-win).
-     * Note we check lowercase paths.
+     * Note we check lowercase paths.  The path is split into its
+     * directory names once, rather than searching the whole path
+     * for each name we look for.
      *)
-    let pathelem elem =
-      String.find lc_path ("/" ^ elem ^ "/") >= 0 ||
-      String.starts_with (elem ^ "/") lc_path
-    in
+    let dirs =
+      match List.rev (String.nsplit "/" lc_path) with
+      | [] -> []
+      | _ :: dirs -> dirs in
+    let pathelem elem = List.mem elem dirs in
     let p_arch =
       if pathelem "x86" || pathelem "i386" then "i386"
       else if pathelem "amd64" then "x86_64"
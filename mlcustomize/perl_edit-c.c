@@ -44,5 +44,51 @@ virt_customize_edit_file_perl (value verbosev, value gv, value gpv,
   if (r == -1)
     caml_failwith (guestfs_last_error (g) ? : "edit_file_perl: unknown error");
 
-  CAMLreturn (Val_unit);
+  /* r == 1 means the file was not changed. */
+  CAMLreturn (Val_bool (r == 0));
+}
+
+value
+virt_customize_edit_files_perl (value verbosev, value gv, value gpv,
+                                value editsv)
+{
+  CAMLparam4 (verbosev, gv, gpv, editsv);
+  CAMLlocal3 (rv, consv, v);
+  guestfs_h *g = (guestfs_h *) (intptr_t) Int64_val (gpv);
+  struct file_edit *edits;
+  size_t i, nr_edits = 0;
+  int r;
+
+  for (v = editsv; v != Val_emptylist; v = Field (v, 1))
+    nr_edits++;
+
+  edits = malloc (nr_edits * sizeof *edits);
+  if (edits == NULL)
+    caml_raise_out_of_memory ();
+
+  /* The strings are not copied, but nothing below can trigger a
+   * garbage collection until we have finished with them.
+   */
+  for (i = 0, v = editsv; i < nr_edits; ++i, v = Field (v, 1)) {
+    edits[i].filename = String_val (Field (Field (v, 0), 0));
+    edits[i].perl_expr = String_val (Field (Field (v, 0), 1));
+  }
+
+  r = edit_files_perl (g, edits, nr_edits, NULL, Bool_val (verbosev));
+  if (r == -1) {
+    free (edits);
+    caml_failwith (guestfs_last_error (g) ? : "edit_files_perl: unknown error");
+  }
+
+  /* Build the list of results back to front. */
+  rv = Val_emptylist;
+  for (i = nr_edits; i > 0; --i) {
+    consv = caml_alloc (2, 0);
+    Store_field (consv, 0, Val_bool (edits[i-1].result == 0));
+    Store_field (consv, 1, rv);
+    rv = consv;
+  }
+  free (edits);
+
+  CAMLreturn (rv);
 }
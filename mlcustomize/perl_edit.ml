@@ -20,7 +20,7 @@ open Std_utils
 open Tools_utils
 
 external c_edit_file : verbose:bool -> Guestfs.t -> int64 -> string -> string
-                       -> unit
+                       -> bool
   = "virt_customize_edit_file_perl"
 let edit_file g file expr =
   (* Note we pass original 'g' even though it is not used by the
@@ -29,3 +29,10 @@ let edit_file g file expr =
    * function.
    *)
   c_edit_file (verbose ()) g (Guestfs.c_pointer g) file expr
+
+external c_edit_files : verbose:bool -> Guestfs.t -> int64 ->
+                        (string * string) list -> bool list
+  = "virt_customize_edit_files_perl"
+let edit_files g edits =
+  (* See comment in edit_file above. *)
+  c_edit_files (verbose ()) g (Guestfs.c_pointer g) edits
@@ -16,4 +16,18 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  *)
 
-val edit_file : Guestfs.t -> string -> string -> unit
+val edit_file : Guestfs.t -> string -> string -> bool
+(** [edit_file g file expr] edits [file] in the guest using the Perl
+    expression [expr].
+
+    Returns [false] if the expression did not change the file, in
+    which case the file was not rewritten. *)
+
+val edit_files : Guestfs.t -> (string * string) list -> bool list
+(** [edit_files g edits] edits each [(file, expr)] in [edits] in the
+    same way as {!edit_file}, but downloads and uploads the files in
+    bulk, which is much faster when there are many of them.  No file
+    is changed unless all the expressions succeed.
+
+    Returns whether each file was changed, in the same order as
+    [edits]. *)
@@ -59,22 +59,31 @@ and usb_device = {
 
 let re_inf = PCRE.compile ~caseless:true "^(.*)\\.inf$"
 
-let re_pci_cc = PCRE.compile ~caseless:true "^cc_([[:xdigit:]]{4,6})$"
-let re_pci_ven = PCRE.compile ~caseless:true "^ven_([[:xdigit:]]{4})$"
-let re_pci_dev = PCRE.compile ~caseless:true "^dev_([[:xdigit:]]{4})$"
-let re_pci_subsys = PCRE.compile ~caseless:true "^subsys_([[:xdigit:]]{8})$"
-let re_pci_rev = PCRE.compile ~caseless:true "^rev_([[:xdigit:]]{2})$"
+(* Each set classifies one element of a device ID.  The index of the
+ * pattern which matched selects the field in the functions below.
+ *)
+let re_pci = PCRE.Set.compile ~caseless:true [
+  "^cc_([[:xdigit:]]{4,6})$";
+  "^ven_([[:xdigit:]]{4})$";
+  "^dev_([[:xdigit:]]{4})$";
+  "^subsys_([[:xdigit:]]{8})$";
+  "^rev_([[:xdigit:]]{2})$";
+]
 
-let re_hid_vid = PCRE.compile ~caseless:true "^vid_([[:xdigit:]]{4})$"
-let re_hid_pid = PCRE.compile ~caseless:true "^pid_([[:xdigit:]]{4})$"
-let re_hid_rev = PCRE.compile ~caseless:true "^rev_([[:xdigit:]]{2})$"
-let re_hid_col = PCRE.compile ~caseless:true "^col([[:xdigit:]]{2})$"
-let re_hid_multi = PCRE.compile ~caseless:true "^mi_([[:xdigit:]]{2})$"
+let re_hid = PCRE.Set.compile ~caseless:true [
+  "^vid_([[:xdigit:]]{4})$";
+  "^pid_([[:xdigit:]]{4})$";
+  "^rev_([[:xdigit:]]{2})$";
+  "^col([[:xdigit:]]{2})$";
+  "^mi_([[:xdigit:]]{2})$";
+]
 
-let re_usb_vid = PCRE.compile ~caseless:true "^vid_([[:xdigit:]]{4})$"
-let re_usb_pid = PCRE.compile ~caseless:true "^pid_([[:xdigit:]]{4})$"
-let re_usb_rev = PCRE.compile ~caseless:true "^rev_([[:xdigit:]]{2})$"
-let re_usb_multi = PCRE.compile ~caseless:true "^mi_([[:xdigit:]]{2})$"
+let re_usb = PCRE.Set.compile ~caseless:true [
+  "^vid_([[:xdigit:]]{4})$";
+  "^pid_([[:xdigit:]]{4})$";
+  "^rev_([[:xdigit:]]{2})$";
+  "^mi_([[:xdigit:]]{2})$";
+]
 
 let rec detect_drivers (g : G.guestfs) root =
   assert (g#inspect_get_type root = "windows");
@@ -200,18 +209,14 @@ and pci_to_hardware = function
      let empty = { pci_class = None; pci_vendor = None; pci_device = None;
                    pci_subsys = None; pci_rev = None } in
      let f pci key =
-       if PCRE.matches re_pci_cc key then
-         { pci with pci_class = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_pci_ven key then
-         { pci with pci_vendor = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_pci_dev key then
-         { pci with pci_device = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_pci_subsys key then
-         { pci with pci_subsys = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_pci_rev key then
-         { pci with pci_rev = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else
-         pci
+       let hex () = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) in
+       match PCRE.Set.matches re_pci key with
+       | Some 0 -> { pci with pci_class = hex () }
+       | Some 1 -> { pci with pci_vendor = hex () }
+       | Some 2 -> { pci with pci_device = hex () }
+       | Some 3 -> { pci with pci_subsys = hex () }
+       | Some 4 -> { pci with pci_rev = hex () }
+       | _ -> pci
      in
      PCI (List.fold_left f empty keys)
   | path -> Other ("PCI" :: path)
@@ -222,18 +227,14 @@ and hid_to_hardware = function
      let empty = { hid_vendor = None; hid_product = None;
                    hid_rev = None; hid_col = None; hid_multi = None } in
      let f hid key =
-       if PCRE.matches re_hid_vid key then
-         { hid with hid_vendor = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_hid_pid key then
-         { hid with hid_product = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_hid_rev key then
-         { hid with hid_rev = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_hid_col key then
-         { hid with hid_col = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_hid_multi key then
-         { hid with hid_multi = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else
-         hid
+       let hex () = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) in
+       match PCRE.Set.matches re_hid key with
+       | Some 0 -> { hid with hid_vendor = hex () }
+       | Some 1 -> { hid with hid_product = hex () }
+       | Some 2 -> { hid with hid_rev = hex () }
+       | Some 3 -> { hid with hid_col = hex () }
+       | Some 4 -> { hid with hid_multi = hex () }
+       | _ -> hid
      in
      HID (List.fold_left f empty keys)
 
@@ -245,16 +246,13 @@ and usb_to_hardware = function
      let empty = { usb_vendor = None; usb_product = None;
                    usb_rev = None; usb_multi = None } in
      let f usb key =
-       if PCRE.matches re_usb_vid key then
-         { usb with usb_vendor = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_usb_pid key then
-         { usb with usb_product = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_usb_rev key then
-         { usb with usb_rev = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else if PCRE.matches re_usb_multi key then
-         { usb with usb_multi = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) }
-       else
-         usb
+       let hex () = Some (sscanf (PCRE.sub 1) "%Lx" Fun.id) in
+       match PCRE.Set.matches re_usb key with
+       | Some 0 -> { usb with usb_vendor = hex () }
+       | Some 1 -> { usb with usb_product = hex () }
+       | Some 2 -> { usb with usb_rev = hex () }
+       | Some 3 -> { usb with usb_multi = hex () }
+       | _ -> usb
      in
      USB (List.fold_left f empty keys)
 
@@ -27,35 +27,72 @@ external matches : ?offset:int -> regexp -> string -> bool = "guestfs_int_pcre_m
 external sub : int -> string = "guestfs_int_pcre_sub"
 external subi : int -> int * int = "guestfs_int_pcre_subi"
 
-let rec replace ?(global = false) patt subst subj =
-  if not (matches patt subj) then
+module Match = struct
+  type t = {
+    subject : string;
+    offsets : int array;        (* start and end of each substring *)
+  }
+
+  let count { offsets } = Array.length offsets / 2
+
+  let subi { offsets } n =
+    if n < 0 then invalid_arg "PCRE.Match.subi: n must be >= 0";
+    if 2*n >= Array.length offsets || offsets.(2*n) < 0 then raise Not_found;
+    offsets.(2*n), offsets.(2*n+1)
+
+  let sub ({ subject } as m) n =
+    let i1, i2 = subi m n in
+    String.sub subject i1 (i2 - i1)
+end
+
+external c_exec : bool -> int option -> regexp -> string -> int array
+  = "guestfs_int_pcre_exec"
+
+let exec ?offset patt subject =
+  let offsets = c_exec false offset patt subject in
+  if offsets = [||] then None else Some { Match.subject; offsets }
+
+external match_spans : int -> regexp -> string -> int array
+  = "guestfs_int_pcre_match_spans"
+
+let replace ?(global = false) patt subst subj =
+  (* All the matches are found in one pass, and then the result is
+   * built in one pass, so this is linear in the length of [subj].
+   *)
+  let spans = match_spans (if global then 0 else 1) patt subj in
+  let n = Array.length spans / 2 in
+  if n = 0 then
     (* Return original string unchanged if patt doesn't match. *)
     subj
   else (
-    (* If patt matches "yyyy" in the original string then we have
-     * the following situation, where "xxxx" is the part of the
-     * original string before the match, and "zzzz..." is the
-     * part after the match:
-     * "xxxxyyyyzzzzzzzzzzzzz"
-     *      ^   ^
-     *      i1  i2
-     *)
-    let i1, i2 = subi 0 in
-    let xs = String.sub subj 0 i1 (* "xxxx", part before the match *) in
-    let zs = String.sub subj i2 (String.length subj - i2) (* after *) in
-
-    (* If the global flag was set, we want to continue substitutions
-     * in the rest of the string.
-     *)
-    let zs = if global then replace ~global patt subst zs else zs in
-
-    xs ^ subst ^ zs
+    let len = String.length subj in
+    let buf = Buffer.create (len + n * String.length subst) in
+    let pos = ref 0 in
+    for i = 0 to n-1 do
+      let i1 = spans.(2*i) and i2 = spans.(2*i+1) in
+      Buffer.add_substring buf subj !pos (i1 - !pos);
+      Buffer.add_string buf subst;
+      pos := i2
+    done;
+    Buffer.add_substring buf subj !pos (len - !pos);
+    Buffer.contents buf
   )
 
-let rec split patt subj =
-  if not (matches patt subj) then
-    subj, ""
-  else (
+let matches_all patt subj =
+  let spans = match_spans 0 patt subj in
+  let rec loop i acc =
+    if i < 0 then acc
+    else (
+      let i1 = spans.(2*i) and i2 = spans.(2*i+1) in
+      loop (i-1) (String.sub subj i1 (i2 - i1) :: acc)
+    )
+  in
+  loop (Array.length spans / 2 - 1) []
+
+let split patt subj =
+  match exec patt subj with
+  | None -> subj, ""
+  | Some m ->
     (* If patt matches "yyyy" in the original string then we have
      * the following situation, where "xxxx" is the part of the
      * original string before the match, and "zzzz..." is the
@@ -64,26 +101,81 @@ let rec split patt subj =
      *      ^   ^
      *      i1  i2
      *)
-    let i1, i2 = subi 0 in
+    let i1, i2 = Match.subi m 0 in
     let xs = String.sub subj 0 i1 (* "xxxx", part before the match *) in
     let zs = String.sub subj i2 (String.length subj - i2) (* after *) in
     xs, zs
-  )
 
-and nsplit ?(max = 0) patt subj =
+let nsplit ?(max = 0) patt subj =
   if max < 0 then
     invalid_arg "PCRE.nsplit: max parameter should not be negative";
 
-  (* If we reached the limit, OR if the pattern does not match the string
-   * at all, return the rest of the string as a single element list.
+  (* As in Perl, an empty match at either end of the string, or just
+   * after the previous match, does not split it.  At most one such
+   * match can come before each match which does split, so [2*max]
+   * matches are always enough.
    *)
-  if max = 1 || not (matches patt subj) then
-    [subj]
-  else (
-    let s1, s2 = split patt subj in
-    let max = if max = 0 then 0 else max - 1 in
-    s1 :: nsplit ~max patt s2
-  )
+  let len = String.length subj in
+  let spans = match_spans (2*max) patt subj in
+  let n = Array.length spans / 2 in
+  let rec loop i pos nr acc =
+    if i >= n || (max > 0 && nr >= max) then
+      List.rev (String.sub subj pos (len - pos) :: acc)
+    else (
+      let i1 = spans.(2*i) and i2 = spans.(2*i+1) in
+      if i1 = i2 && (i1 = pos || i1 = len) then
+        loop (i+1) pos nr acc
+      else
+        loop (i+1) i2 (nr+1) (String.sub subj pos (i1 - pos) :: acc)
+    )
+  in
+  loop 0 0 1 []
+
+module Set = struct
+  type t = regexp
+
+  external set_matches : ?offset:int -> regexp -> string -> int
+    = "guestfs_int_pcre_set_matches"
+
+  let compile ?anchored ?caseless ?dotall ?extended ?multiline patts =
+    if patts = [] then
+      invalid_arg "PCRE.Set.compile: no patterns";
+
+    (* Compile each pattern on its own first, so that an error is
+     * reported against the pattern which caused it.
+     *)
+    List.iter (
+      fun patt ->
+        ignore (compile ?caseless ?dotall ?extended ?multiline patt)
+    ) patts;
+
+    (* Combine the patterns into one alternation.  Each branch is
+     * marked with its index, which the C code returns.  The "(?|"
+     * group makes the captures of each branch start from 1, so
+     * captures and backreferences work as in the separate pattern.
+     * In extended mode, a trailing comment in a pattern must not
+     * swallow the closing parenthesis.
+     *)
+    let close = if extended = Some true then "\n)" else ")" in
+    let branches =
+      List.mapi (
+        fun i patt -> "(*MARK:" ^ string_of_int i ^ ")(?:" ^ patt ^ close
+      ) patts in
+    compile ?anchored ?caseless ?dotall ?extended ?multiline
+            ("(?|" ^ String.concat "|" branches ^ ")")
+
+  let matches ?offset set str =
+    let i = set_matches ?offset set str in
+    if i >= 0 then Some i else None
+
+  let exec ?offset set subject =
+    let r = c_exec true offset set subject in
+    if r = [||] then None
+    else (
+      let offsets = Array.sub r 1 (Array.length r - 1) in
+      Some (r.(0), { Match.subject; offsets })
+    )
+end
 
 let () =
   Callback.register_exception "PCRE.Error" (Error ("", 0))
@@ -38,6 +38,17 @@ v}
     call to {!matches} and {!sub}.  This is stored in thread
     local storage so it is safe provided there are no other calls
     to {!matches} in the same thread.
+
+    {!exec} returns the match instead, which avoids the global
+    state:
+
+{v
+match PCRE.exec re "ccaaaabb" with
+| Some m ->
+  let whole = PCRE.Match.sub m 0 in (* returns "aaaab" *)
+  ...
+| None -> ...
+v}
 *)
 
 exception Error of string * int
@@ -59,7 +70,10 @@ val compile : ?anchored:bool -> ?caseless:bool -> ?dotall:bool ->
     The flags [?anchored], [?caseless], [?dotall], [?extended], [?multiline]
     correspond to the [pcre_compile] flags [PCRE_ANCHORED] etc.
     See pcre2api(3) for details of what they do.
-    All flags default to false. *)
+    All flags default to false.
+
+    Where PCRE supports it, the pattern is also JIT-compiled, so it
+    is worth compiling patterns once and reusing them. *)
 
 val matches : ?offset:int -> regexp -> string -> bool
 (** Test whether the regular expression matches the string.  This
@@ -100,6 +114,43 @@ val subi : int -> int * int
 
     If there was no nth substring then this raises [Not_found]. *)
 
+(** The result of a successful match by {!exec}. *)
+module Match : sig
+  type t
+  (** An immutable match.  It holds the subject string (which is
+      not copied) and the offsets of the match and its captures. *)
+
+  val count : t -> int
+  (** The number of substrings, that is the whole match plus the
+      captures up to the highest numbered one which was set. *)
+
+  val sub : t -> int -> string
+  (** [sub m n] returns the nth substring (capture) of the match,
+      or the whole match if [n = 0].
+
+      If there was no nth substring then this raises [Not_found]. *)
+
+  val subi : t -> int -> int * int
+  (** [subi m n] is the same as {!sub} but returns the indexes into
+      the subject string of the first character of the substring
+      and the first character after it.
+
+      If there was no nth substring then this raises [Not_found]. *)
+end
+
+val exec : ?offset:int -> regexp -> string -> Match.t option
+(** Match the regular expression against the string, returning
+    the match or [None] if it does not match.
+
+    Unlike {!matches} this does not use or change any hidden state,
+    so matches can be kept and used in any order, and from any
+    thread.
+
+    The [?offset] flag is used to change the start of the search,
+    as for {!matches}.
+
+    This can raise {!Error} if PCRE returns an error. *)
+
 val replace : ?global:bool -> regexp -> string -> string -> string
 (** [replace ?global patt subst subj] performs a search and replace
     on the subject string ([subj]).  Where [patt] matches the
@@ -111,7 +162,18 @@ val replace : ?global:bool -> regexp -> string -> string -> string
     then every instance of [patt] in the string is replaced.
 
     Note that this function does not allow backreferences.
-    Any captures in [patt] are ignored. *)
+    Any captures in [patt] are ignored.
+
+    The string is scanned once, so this takes time linear in the
+    length of [subj] however many matches there are.  It does not
+    change the substrings returned by {!sub}. *)
+
+val matches_all : regexp -> string -> string list
+(** [matches_all patt subj] returns every non-overlapping match of
+    [patt] in [subj], from left to right, like Perl's [m//g] for a
+    pattern without captures.
+
+    It does not change the substrings returned by {!sub}. *)
 
 val split : regexp -> string -> string * string
 val nsplit : ?max:int -> regexp -> string -> string list
@@ -130,4 +192,59 @@ val nsplit : ?max:int -> regexp -> string -> string list
 
     [nsplit] has an optional [?max] parameter which controls
     the maximum length of the returned list.  The final element
-    contains the remainder of the string. *)
+    contains the remainder of the string.
+
+    [nsplit] finds all the matches in a single scan of the string,
+    so [^] and lookbehind assertions see the whole string (as in
+    Perl's [split]), not just the part after the previous match.
+    A pattern which matches the empty string splits the string
+    between characters, but not at either end. *)
+
+(** Sets of regular expressions matched in a single pass.
+
+    This is useful for classifying a string against many patterns,
+    which would otherwise be matched one after another:
+
+{v
+let set = PCRE.Set.compile [ "^ven_(\\w+)$"; "^dev_(\\w+)$" ] in
+...
+
+match PCRE.Set.matches set "dev_1af4" with
+| Some 0 -> (* vendor is PCRE.sub 1 *)
+| Some 1 -> (* device is PCRE.sub 1, which returns "1af4" *)
+| _ -> (* no pattern matched *)
+v}
+*)
+module Set : sig
+  type t
+  (** The type of a compiled set of regular expressions. *)
+
+  val compile : ?anchored:bool -> ?caseless:bool -> ?dotall:bool ->
+                ?extended:bool -> ?multiline:bool -> string list -> t
+  (** Compile a non-empty list of regular expressions into a set.
+      The flags apply to all the patterns, as in {!PCRE.compile}.
+      This can raise {!Error}.
+
+      The patterns are combined into a single alternation, so they
+      must not use [(*MARK)] or other backtracking control verbs,
+      and named captures may not be shared between patterns. *)
+
+  val matches : ?offset:int -> t -> string -> int option
+  (** Match the set against the string in a single pass.
+
+      This returns [Some i] where [i] is the index in the list of
+      the pattern which matched earliest in the string, or if
+      several patterns match at the same place, the first of them
+      in the list.  It returns [None] if no pattern matches.
+
+      On a match, {!PCRE.sub} and {!PCRE.subi} return the captures
+      of the pattern which matched, numbered as in that pattern
+      alone.
+
+      This can raise {!Error} if PCRE returns an error. *)
+
+  val exec : ?offset:int -> t -> string -> (int * Match.t) option
+  (** The same as {!matches}, but like {!PCRE.exec} it returns the
+      match (with the captures numbered as in the pattern which
+      matched) instead of saving it for {!PCRE.sub}. *)
+end
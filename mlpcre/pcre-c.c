@@ -40,23 +40,54 @@
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 
 /* Data on the most recent match is stored in this thread-local
- * variable.  It is freed either by the next call to PCRE.matches or
- * by (clean) thread exit.
+ * variable.  It is freed by (clean) thread exit.
+ *
+ * To avoid allocating anything in the common case, each thread has
+ * two match slots which are reused.  PCRE.matches matches into the
+ * slot which does not hold the last successful match, and only if
+ * the match succeeds does that slot become the last match.
  */
 static pthread_key_t last_match;
 
-struct last_match {
-  char *subject;                /* subject string */
+struct match_slot {
   pcre2_match_data *match_data; /* match offsets */
+  uint32_t nr_pairs;            /* size of match_data */
+  char *subject;                /* copy of the matched part of subject */
+  size_t subject_offset;        /* offset of the copy in the subject */
+  size_t subject_alloc;         /* allocated size of subject */
   int r;                        /* value returned by pcre2_match */
 };
 
+struct last_match {
+  struct match_slot slots[2];
+  int last;                     /* slot with the last match, or -1 */
+
+  /* Scratch match_data used by PCRE.exec, which returns its results
+   * directly instead of saving them here.
+   */
+  pcre2_match_data *exec_match_data;
+  uint32_t exec_nr_pairs;
+
+  /* Match context with a larger JIT stack, allocated the first time
+   * a match in this thread runs out of the default JIT stack.
+   */
+  pcre2_match_context *match_context;
+  pcre2_jit_stack *jit_stack;
+};
+
 static void
 free_last_match (struct last_match *data)
 {
+  size_t i;
+
   if (data) {
-    free (data->subject);
-    pcre2_match_data_free (data->match_data);
+    for (i = 0; i < 2; ++i) {
+      free (data->slots[i].subject);
+      pcre2_match_data_free (data->slots[i].match_data);
+    }
+    pcre2_match_data_free (data->exec_match_data);
+    pcre2_match_context_free (data->match_context);
+    pcre2_jit_stack_free (data->jit_stack);
     free (data);
   }
 }
@@ -105,12 +136,17 @@ raise_pcre_other_error (const char *msg)
 }
 
 /* Wrap and unwrap pcre regular expression handles, with a finalizer. */
-#define Regexp_val(rv) (*(pcre2_code **)Data_custom_val(rv))
+struct regexp {
+  pcre2_code *re;
+  uint32_t nr_pairs;            /* number of captures + 1 */
+};
+
+#define Regexp_val(rv) ((struct regexp *)Data_custom_val(rv))
 
 static void
 regexp_finalize (value rev)
 {
-  pcre2_code *re = Regexp_val (rev);
+  pcre2_code *re = Regexp_val (rev)->re;
   if (re) pcre2_code_free (re);
 }
 
@@ -129,9 +165,14 @@ Val_regexp (pcre2_code *re)
 {
   CAMLparam0 ();
   CAMLlocal1 (rv);
+  uint32_t count;
+
+  if (pcre2_pattern_info (re, PCRE2_INFO_CAPTURECOUNT, &count) != 0)
+    count = 0;
 
-  rv = caml_alloc_custom (&custom_operations, sizeof (pcre2_code *), 0, 1);
-  Regexp_val (rv) = re;
+  rv = caml_alloc_custom (&custom_operations, sizeof (struct regexp), 0, 1);
+  Regexp_val (rv)->re = re;
+  Regexp_val (rv)->nr_pairs = count + 1;
 
   CAMLreturn (rv);
 }
@@ -186,6 +227,14 @@ guestfs_int_pcre_compile (value anchoredv, value caselessv,
   if (re == NULL)
     raise_pcre_error (errcode);
 
+  /* JIT-compile the pattern, which makes matching several times
+   * faster.  pcre2_match uses the JIT code automatically.  If JIT
+   * is not available on this platform or the pattern cannot be
+   * JIT-compiled, the interpreter is used instead, so ignore errors.
+   * See match_re for what happens if the JIT code runs out of stack.
+   */
+  pcre2_jit_compile (re, PCRE2_JIT_COMPLETE);
+
   CAMLreturn (Val_regexp (re));
 }
 
@@ -197,65 +246,200 @@ guestfs_int_pcre_compile_byte (value *argv, int argn)
                                    argv[3], argv[4], argv[5]);
 }
 
-value
-guestfs_int_pcre_matches (value offsetv, value rev, value strv)
+/* Return the last match data for this thread, allocating it the
+ * first time.
+ */
+static struct last_match *
+get_last_match (void)
 {
-  CAMLparam3 (offsetv, rev, strv);
-  pcre2_code *re = Regexp_val (rev);
-  struct last_match *m, *oldm;
-  size_t len = caml_string_length (strv);
-  int r;
+  struct last_match *m = pthread_getspecific (last_match);
 
-  m = calloc (1, sizeof *m);
-  if (m == NULL)
-    caml_raise_out_of_memory ();
+  if (m == NULL) {
+    m = calloc (1, sizeof *m);
+    if (m == NULL)
+      caml_raise_out_of_memory ();
+    m->last = -1;
+    pthread_setspecific (last_match, m);
+  }
 
-  /* We will need the original subject string when fetching
-   * substrings, so take a copy.
-   */
-  m->subject = malloc (len+1);
-  if (m->subject == NULL) {
-    free_last_match (m);
-    caml_raise_out_of_memory ();
+  return m;
+}
+
+/* Largest JIT stack that a single thread will allocate. */
+#define JIT_STACK_MAX (8 * 1024 * 1024)
+
+/* Wrapper around pcre2_match.
+ *
+ * The JIT code uses a 32K machine stack by default, which patterns
+ * that recurse once per character (eg. "(a|b)*c") exhaust on long
+ * subjects.  In that case retry with this thread's larger JIT stack,
+ * and if even that is not enough, with the interpreter, which keeps
+ * its backtracking state on the heap.
+ */
+static int
+match_re (struct last_match *m, const pcre2_code *re,
+          PCRE2_SPTR subject, PCRE2_SIZE len, PCRE2_SIZE offset,
+          uint32_t options, pcre2_match_data *match_data)
+{
+  int r;
+
+  r = pcre2_match (re, subject, len, offset, options, match_data, NULL);
+  if (r != PCRE2_ERROR_JIT_STACKLIMIT)
+    return r;
+
+  if (m->match_context == NULL) {
+    m->jit_stack = pcre2_jit_stack_create (32 * 1024, JIT_STACK_MAX, NULL);
+    if (m->jit_stack != NULL)
+      m->match_context = pcre2_match_context_create (NULL);
+    if (m->match_context != NULL)
+      pcre2_jit_stack_assign (m->match_context, NULL, m->jit_stack);
+    else {
+      pcre2_jit_stack_free (m->jit_stack);
+      m->jit_stack = NULL;
+    }
+  }
+  if (m->match_context != NULL) {
+    r = pcre2_match (re, subject, len, offset, options, match_data,
+                     m->match_context);
+    if (r != PCRE2_ERROR_JIT_STACKLIMIT)
+      return r;
   }
-  memcpy (m->subject, String_val (strv), len+1);
 
-  /* Allocate the match_data. */
-  m->match_data = pcre2_match_data_create_from_pattern (re, NULL);
-  if (m->match_data == NULL) {
-    free_last_match (m);
-    caml_raise_out_of_memory ();
+  return pcre2_match (re, subject, len, offset, options | PCRE2_NO_JIT,
+                      match_data, NULL);
+}
+
+/* Return the slot holding the last successful match in this thread,
+ * or raise an error.
+ */
+static const struct match_slot *
+get_last_slot (const char *fn)
+{
+  const struct last_match *m = pthread_getspecific (last_match);
+
+  if (m == NULL || m->last == -1) {
+    char msg[64];
+
+    snprintf (msg, sizeof msg, "%s called without calling PCRE.matches", fn);
+    raise_pcre_other_error (msg);
   }
 
-  m->r = pcre2_match (re, (PCRE2_SPTR) m->subject, len,
-                      Optint_val (offsetv, 0), 0,
-                      m->match_data, NULL);
-  if (m->r < 0 && m->r != PCRE2_ERROR_NOMATCH) {
-    int ret = m->r;
-    free_last_match (m);
-    raise_pcre_error (ret);
+  return &m->slots[m->last];
+}
+
+/* Reuse *match_data if it has room for nr_pairs, otherwise replace
+ * it with a larger one.
+ */
+static void
+reserve_match_data (pcre2_match_data **match_data, uint32_t *nr_pairs_r,
+                    uint32_t nr_pairs)
+{
+  if (*nr_pairs_r < nr_pairs) {
+    pcre2_match_data_free (*match_data);
+    *nr_pairs_r = 0;
+    *match_data = pcre2_match_data_create (nr_pairs, NULL);
+    if (*match_data == NULL)
+      caml_raise_out_of_memory ();
+    *nr_pairs_r = nr_pairs;
   }
+}
+
+/* Match the regexp against the string, and if it matches make it
+ * the last match in this thread.  Returns the slot holding the
+ * match, or NULL if there was no match.  This can raise an
+ * exception.
+ */
+static const struct match_slot *
+do_match (value offsetv, value rev, value strv)
+{
+  const struct regexp *re = Regexp_val (rev);
+  struct last_match *m = get_last_match ();
+  const int i = m->last == 0 ? 1 : 0;
+  struct match_slot *slot = &m->slots[i];
+  const size_t len = caml_string_length (strv);
+  const PCRE2_SIZE *vec;
+  size_t lo, hi;
+  int j, r;
+
+  reserve_match_data (&slot->match_data, &slot->nr_pairs, re->nr_pairs);
+
+  /* Nothing allocates on the OCaml heap during the match, so the
+   * string cannot move and we can match it in place.
+   */
+  r = match_re (m, re->re, (PCRE2_SPTR) String_val (strv), len,
+                Optint_val (offsetv, 0), 0, slot->match_data);
+  if (r == PCRE2_ERROR_NOMATCH)
+    return NULL;
+  if (r < 0)
+    raise_pcre_error (r);
 
   /* This error would indicate that pcre_exec ran out of space in the
    * vector.  However if we are calculating the size of the vector
    * correctly above, then this should never happen.
    */
-  assert (m->r != 0);
+  assert (r != 0);
 
-  r = m->r != PCRE2_ERROR_NOMATCH;
-
-  /* Replace the old TLS match data, but only if we're going
-   * to return a match.
+  /* PCRE.sub may need the captured substrings later, after the
+   * string has moved or been freed, so copy the part of the subject
+   * they span.
    */
-  if (r) {
-    oldm = pthread_getspecific (last_match);
-    free_last_match (oldm);
-    pthread_setspecific (last_match, m);
+  vec = pcre2_get_ovector_pointer (slot->match_data);
+  lo = len;
+  hi = 0;
+  for (j = 0; j < 2*r; ++j) {
+    if (vec[j] == PCRE2_UNSET)
+      continue;
+    if (vec[j] < lo) lo = vec[j];
+    if (vec[j] > hi) hi = vec[j];
   }
-  else
-    free_last_match (m);
+  if (lo > hi)
+    lo = hi;
+  if (slot->subject_alloc < hi - lo + 1) {
+    char *subject = realloc (slot->subject, hi - lo + 1);
+    if (subject == NULL)
+      caml_raise_out_of_memory ();
+    slot->subject = subject;
+    slot->subject_alloc = hi - lo + 1;
+  }
+  memcpy (slot->subject, String_val (strv) + lo, hi - lo);
+  slot->subject_offset = lo;
+  slot->r = r;
+
+  /* Only now replace the last match. */
+  m->last = i;
+
+  return slot;
+}
+
+value
+guestfs_int_pcre_matches (value offsetv, value rev, value strv)
+{
+  CAMLparam3 (offsetv, rev, strv);
+
+  CAMLreturn (do_match (offsetv, rev, strv) ? Val_true : Val_false);
+}
 
-  CAMLreturn (r ? Val_true : Val_false);
+/* Used by PCRE.Set.matches.  The patterns in the set are combined
+ * into one regexp where each branch starts with (*MARK:n), so the
+ * mark tells which pattern matched.  Returns n, or -1 if there was
+ * no match.
+ */
+value
+guestfs_int_pcre_set_matches (value offsetv, value rev, value strv)
+{
+  CAMLparam3 (offsetv, rev, strv);
+  const struct match_slot *slot;
+  PCRE2_SPTR mark;
+
+  slot = do_match (offsetv, rev, strv);
+  if (slot == NULL)
+    CAMLreturn (Val_int (-1));
+
+  mark = pcre2_get_mark (slot->match_data);
+  if (mark == NULL)
+    raise_pcre_other_error ("PCRE.Set.matches: no pattern was marked");
+
+  CAMLreturn (Val_int (atoi ((const char *) mark)));
 }
 
 value
@@ -264,35 +448,25 @@ guestfs_int_pcre_sub (value nv)
   CAMLparam1 (nv);
   const int n = Int_val (nv);
   CAMLlocal1 (strv);
-  const struct last_match *m = pthread_getspecific (last_match);
+  const struct match_slot *m = get_last_slot ("PCRE.sub");
+  const PCRE2_SIZE *vec;
   PCRE2_SIZE len;
-  int r;
-
-  if (m == NULL)
-    raise_pcre_other_error ("PCRE.sub called without calling PCRE.matches");
 
   if (n < 0)
     caml_invalid_argument ("PCRE.sub: n must be >= 0");
 
-  r = pcre2_substring_length_bynumber (m->match_data, n, &len);
-  if (r == PCRE2_ERROR_NOSUBSTRING || r == PCRE2_ERROR_UNSET)
+  /* Substrings above the return value of pcre2_match are unset. */
+  if (n >= m->r)
     caml_raise_not_found ();
-  if (r < 0)
-    raise_pcre_error (r);
-
-  strv = caml_alloc_string (len);
 
-  /* This is fine.  OCaml allocates space for the trailing \0
-   * and pcre expects that the buffer will be large enough to
-   * store it.
-   */
-  len++;
+  vec = pcre2_get_ovector_pointer (m->match_data);
+  if (vec[n*2] == PCRE2_UNSET)
+    caml_raise_not_found ();
 
-  r = pcre2_substring_copy_bynumber (m->match_data, n,
-                                     (PCRE2_UCHAR *) String_val (strv),
-                                     &len);
-  if (r < 0)
-    raise_pcre_error (r);
+  len = vec[n*2+1] - vec[n*2];
+  strv = caml_alloc_string (len);
+  memcpy ((char *) String_val (strv),
+          m->subject + vec[n*2] - m->subject_offset, len);
 
   CAMLreturn (strv);
 }
@@ -303,12 +477,9 @@ guestfs_int_pcre_subi (value nv)
   CAMLparam1 (nv);
   const int n = Int_val (nv);
   CAMLlocal1 (rv);
-  const struct last_match *m = pthread_getspecific (last_match);
+  const struct match_slot *m = get_last_slot ("PCRE.subi");
   PCRE2_SIZE *vec;
 
-  if (m == NULL)
-    raise_pcre_other_error ("PCRE.subi called without calling PCRE.matches");
-
   if (n < 0)
     caml_invalid_argument ("PCRE.subi: n must be >= 0");
 
@@ -326,3 +497,135 @@ guestfs_int_pcre_subi (value nv)
 
   CAMLreturn (rv);
 }
+
+/* Find up to max (or all if max == 0) non-overlapping matches of
+ * the regexp in the string in a single pass, returning the offsets
+ * of the whole matches as [| start0; end0; start1; end1; ... |].
+ *
+ * This does not change the last match used by PCRE.sub.
+ */
+value
+guestfs_int_pcre_match_spans (value maxv, value rev, value strv)
+{
+  CAMLparam3 (maxv, rev, strv);
+  CAMLlocal1 (rv);
+  const struct regexp *re = Regexp_val (rev);
+  struct last_match *m = get_last_match ();
+  const size_t max = Int_val (maxv);
+  const size_t len = caml_string_length (strv);
+  pcre2_match_data *match_data;
+  const PCRE2_SIZE *vec;
+  /* Not CLEANUP_FREE, since that would not run if an exception is
+   * raised.
+   */
+  size_t *spans = NULL;
+  size_t nr_spans = 0, alloc = 0, i;
+  PCRE2_SIZE offset = 0;
+  uint32_t options = 0;
+  int r;
+
+  /* Only the whole match is needed. */
+  match_data = pcre2_match_data_create (1, NULL);
+  if (match_data == NULL)
+    caml_raise_out_of_memory ();
+  vec = pcre2_get_ovector_pointer (match_data);
+
+  /* Nothing allocates on the OCaml heap in this loop, so the string
+   * cannot move.
+   */
+  while (max == 0 || nr_spans < max) {
+    r = match_re (m, re->re, (PCRE2_SPTR) String_val (strv), len, offset,
+                  options, match_data);
+    if (r == PCRE2_ERROR_NOMATCH) {
+      if (options == 0 || offset >= len)
+        break;
+      /* There is no non-empty match here, so move on one character. */
+      offset++;
+      options = 0;
+      continue;
+    }
+    if (r < 0) {
+      pcre2_match_data_free (match_data);
+      free (spans);
+      raise_pcre_error (r);
+    }
+
+    if (nr_spans >= alloc) {
+      size_t *new_spans;
+
+      alloc = alloc == 0 ? 16 : 2 * alloc;
+      new_spans = realloc (spans, 2 * alloc * sizeof *spans);
+      if (new_spans == NULL) {
+        pcre2_match_data_free (match_data);
+        free (spans);
+        caml_raise_out_of_memory ();
+      }
+      spans = new_spans;
+    }
+    spans[2*nr_spans] = vec[0];
+    spans[2*nr_spans+1] = vec[1];
+    nr_spans++;
+
+    /* After an empty match, as in Perl, look for a non-empty match
+     * at the same position before moving on, so this always
+     * terminates.
+     */
+    offset = vec[1];
+    options = vec[0] == vec[1] ? PCRE2_NOTEMPTY_ATSTART|PCRE2_ANCHORED : 0;
+  }
+
+  pcre2_match_data_free (match_data);
+
+  rv = caml_alloc (2*nr_spans, 0);
+  for (i = 0; i < 2*nr_spans; ++i)
+    Store_field (rv, i, Val_long (spans[i]));
+  free (spans);
+
+  CAMLreturn (rv);
+}
+
+/* Implements PCRE.exec and PCRE.Set.exec.  This does not use or
+ * change the last match.  It returns the offsets of the match and
+ * each capture as [| start0; end0; start1; end1; ... |], with -1 for
+ * captures which are unset, or an empty array if there was no match.
+ *
+ * If markv is true, the mark (see guestfs_int_pcre_set_matches) is
+ * prepended to the array.
+ */
+value
+guestfs_int_pcre_exec (value markv, value offsetv, value rev, value strv)
+{
+  CAMLparam4 (markv, offsetv, rev, strv);
+  CAMLlocal1 (rv);
+  const struct regexp *re = Regexp_val (rev);
+  struct last_match *m = get_last_match ();
+  const int with_mark = Bool_val (markv);
+  const PCRE2_SIZE *vec;
+  PCRE2_SPTR mark;
+  int i, r;
+
+  reserve_match_data (&m->exec_match_data, &m->exec_nr_pairs, re->nr_pairs);
+
+  r = match_re (m, re->re, (PCRE2_SPTR) String_val (strv),
+                caml_string_length (strv),
+                Optint_val (offsetv, 0), 0, m->exec_match_data);
+  if (r == PCRE2_ERROR_NOMATCH)
+    CAMLreturn (caml_alloc (0, 0));
+  if (r < 0)
+    raise_pcre_error (r);
+  assert (r != 0);
+
+  vec = pcre2_get_ovector_pointer (m->exec_match_data);
+  rv = caml_alloc (2*r + with_mark, 0);
+  if (with_mark) {
+    mark = pcre2_get_mark (m->exec_match_data);
+    if (mark == NULL)
+      raise_pcre_other_error ("PCRE.Set.exec: no pattern was marked");
+    Store_field (rv, 0, Val_int (atoi ((const char *) mark)));
+  }
+  for (i = 0; i < 2*r; ++i)
+    Store_field (rv, i + with_mark,
+                 vec[i] == PCRE2_UNSET ? Val_int (-1) : Val_long (vec[i]));
+
+  CAMLreturn (rv);
+}
@@ -121,7 +121,6 @@ let () =
             (* = "this-is-a-FUNNY-name-" if UTF-8 worked *)
             = "this-is-a--FUNNY-name-");
 
-    (* This also tests PCRE.split since that is used by nsplit. *)
     assert (nsplit ~max:1 ws "a b c" = [ "a b c" ]);
     assert (nsplit ~max:2 ws "a b c" = [ "a"; "b c" ]);
     assert (nsplit ~max:3 ws "a b c" = [ "a"; "b"; "c" ]);
@@ -134,6 +133,57 @@ let () =
     assert (nsplit ws "the " = [ "the"; "" ]);
     assert (nsplit ws " the" = [ ""; "the" ]);
     assert (nsplit ws "    \t  the" = [ ""; "the" ]);
+    assert (nsplit (compile "^ ") "  the" = [ ""; " the" ]);
+    assert (nsplit (compile "") "abc" = [ "a"; "b"; "c" ]);
+    assert (nsplit (compile "x*") "axxb" = [ "a"; "b" ]);
+    assert (nsplit ~max:2 (compile "") "abc" = [ "a"; "bc" ]);
+
+    assert (split ws "the cat sat" = ("the", "cat sat"));
+    assert (split ws "the" = ("the", ""));
+
+    assert (replace ~global:true (compile "x*") "-" "abc" = "-a-b-c-");
+    assert (replace ~global:true (compile "^a") "b" "aaa" = "baa");
+    assert (replace ~global:true ws " " "  a \t b  " = " a b ");
+
+    assert (PCRE.matches_all re0 "xabaabyab" = [ "ab"; "aab"; "ab" ]);
+    assert (PCRE.matches_all re0 "xyz" = []);
+    assert (PCRE.matches_all (compile "a*") "baa" = [ ""; "aa"; "" ]);
+
+    let set = PCRE.Set.compile ~caseless:true
+                [ "^ven_([[:xdigit:]]{4})$"; "^dev_([[:xdigit:]]{4})$";
+                  "(a)\\1(b)"; "b" ] in
+    assert (PCRE.Set.matches set "VEN_1AF4" = Some 0);
+    assert (sub 1 = "1AF4");
+    assert (PCRE.Set.matches set "dev_1000" = Some 1);
+    assert (sub 1 = "1000");
+    assert (PCRE.Set.matches set "xyz" = None);
+    assert (sub 1 = "1000");
+    assert (PCRE.Set.matches set "cbaab" = Some 3);
+    assert (PCRE.Set.matches set "caab" = Some 2);
+    assert (sub 2 = "b");
+    assert (PCRE.Set.matches ~offset:2 set "caab" = Some 3);
+
+    (* PCRE.exec does not change the state used by sub. *)
+    assert (matches re1 "ccaaabb" = true);
+    let m1 = Option.get (PCRE.exec re2 "ccabbc") in
+    let m2 = Option.get (PCRE.exec re2 "ccac") in
+    assert (PCRE.exec re0 "xyz" = None);
+    assert (sub 1 = "aaa");
+    assert (PCRE.Match.count m1 = 3);
+    assert (PCRE.Match.sub m1 0 = "abb");
+    assert (PCRE.Match.sub m1 2 = "bb");
+    assert (PCRE.Match.sub m2 2 = "");
+    assert (PCRE.Match.subi m2 1 = (2, 3));
+    assert (PCRE.Match.sub (Option.get (PCRE.exec ~offset:5 re0 "aaabcabc")) 0
+            = "ab");
+    (match PCRE.Set.exec set "xdev_b" with
+     | None -> assert false
+     | Some (i, m) ->
+        assert (i = 3);
+        assert (PCRE.Match.subi m 0 = (5, 6)));
+    (match PCRE.Set.exec set "DEV_abcd" with
+     | None -> assert false
+     | Some (i, m) -> assert (i = 1 && PCRE.Match.sub m 1 = "abcd"));
   with
   | Not_found ->
      failwith "one of the PCRE.sub functions unexpectedly raised Not_found"
@@ -151,7 +201,12 @@ let () =
   (try ignore (sub 3) with Not_found -> ());
   (try ignore (sub (-1)) with Invalid_argument _ -> ());
   (try ignore (subi 3) with Not_found -> ());
-  (try ignore (subi (-1)) with Invalid_argument _ -> ())
+  (try ignore (subi (-1)) with Invalid_argument _ -> ());
+  let m = Option.get (PCRE.exec (compile "(x)|(y)") "y") in
+  (try ignore (PCRE.Match.sub m 1); assert false with Not_found -> ());
+  (try ignore (PCRE.Match.sub m 3); assert false with Not_found -> ());
+  (try ignore (PCRE.Match.subi m (-1)); assert false
+   with Invalid_argument _ -> ())
 
 (* Compile some bad regexps and check that an exception is thrown.
  * It would be nice to check the error message is right but
@@ -165,6 +220,65 @@ let () =
         try ignore (PCRE.compile patt); assert false
         with PCRE.Error (m, c) -> m, c in
       eprintf "patt: %s -> exception: %s (%d)\n%!" patt msg code
-  ) [ "("; ")"; "+"; "*"; "(abc" ]
+  ) [ "("; ")"; "+"; "*"; "(abc" ];
+  (try ignore (PCRE.Set.compile [ "a"; "(b" ]); assert false
+   with PCRE.Error _ -> ())
+
+(* Patterns which recurse once per character exhaust the default JIT
+ * stack on long subjects.  Check that these still match, through
+ * each of the matching functions.  The PCRE functions are called
+ * directly to avoid printing the subject.
+ *)
+let () =
+  let re = compile "(a|b)*c" in
+  let str = String.make 1_000_000 'a' ^ "c" in
+  let len = String.length str in
+  assert (PCRE.matches re str);
+  assert (PCRE.subi 0 = (0, len));
+  assert (PCRE.sub 1 = "a");
+  assert (PCRE.Match.subi (Option.get (PCRE.exec re str)) 0 = (0, len));
+  assert (PCRE.nsplit re ("x" ^ str ^ "y") = [ "x"; "y" ])
+
+(* Benchmark matching a path pattern against a list of kernel module
+ * paths, as for example Linux_kernels.detect_kernels does.  This
+ * just prints the time taken.
+ *)
+let () =
+  let re = PCRE.compile "^/lib/modules/([^/]+)/.*\\.ko(?:\\.xz)?$" in
+  let paths =
+    Array.init 1000 (
+      fun i ->
+        sprintf "/lib/modules/5.14.0-%d.el9.x86_64/kernel/drivers/mod%d.ko%s"
+                (i mod 10) i (if i mod 3 = 0 then ".xz" else "")
+    ) in
+  let iterations = 200 in
+  let nr_matches = ref 0 in
+  let start = Sys.time () in
+  for _i = 1 to iterations do
+    Array.iter (
+      fun path ->
+        if PCRE.matches re path && String.length (PCRE.sub 1) > 0 then
+          incr nr_matches
+    ) paths
+  done;
+  let elapsed = Sys.time () -. start in
+  assert (!nr_matches = iterations * Array.length paths);
+  eprintf "benchmark: %d matches in %.3f s\n%!" !nr_matches elapsed
+
+(* Splitting and replacing in a large string should take linear
+ * time.
+ *)
+let () =
+  let nl = PCRE.compile "\n" in
+  let lines = Array.init 100_000 (sprintf "/usr/lib/file%d") in
+  let str = String.concat "\n" (Array.to_list lines) in
+  let start = Sys.time () in
+  let fields = PCRE.nsplit nl str in
+  let str' = PCRE.replace ~global:true nl "\r\n" str in
+  let elapsed = Sys.time () -. start in
+  assert (fields = Array.to_list lines);
+  assert (String.length str' = String.length str + Array.length lines - 1);
+  eprintf "benchmark: split and replaced %d lines in %.3f s\n%!"
+          (Array.length lines) elapsed
 
 let () = Gc.compact ()
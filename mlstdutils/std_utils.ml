@@ -229,37 +229,153 @@ module String = struct
       and len = length str in
       len >= sufflen && sub str (len - sufflen) sufflen = suffix
 
+    (* Naive search, which is fastest for short strings. *)
+    let find_naive str pos sub =
+      let sublen = length sub in
+      let found = ref 0 in
+      let len = length str in
+      try
+        for i = pos to len - sublen do
+          let j = ref 0 in
+          while unsafe_get str (i + !j) = unsafe_get sub !j do
+            incr j;
+            if !j = sublen then begin found := i; raise Exit; end;
+          done;
+        done;
+        -1
+      with
+        Exit -> !found
+
+    (* Two-way string matching (Crochemore and Perrin), as used by
+     * memmem in glibc and musl.  It takes linear time in the worst
+     * case, and skips through the string like Boyer-Moore on typical
+     * inputs.  [two_way sub] preprocesses [sub], which must be at
+     * least 2 bytes long, and returns a function which finds [sub]
+     * in a string starting at a given position.
+     *)
+    let two_way sub =
+      let imax (a : int) b = if a > b then a else b in
+      let l = length sub in
+      let code i = Char.code (unsafe_get sub i) in
+
+      (* Compute the maximal suffix of [sub] and its period, using
+       * the ordering [gt] of the alphabet.
+       *)
+      let maximal_suffix gt =
+        let ip = ref (-1) and jp = ref 0 and k = ref 1 and p = ref 1 in
+        while !jp + !k < l do
+          let a = code (!ip + !k) and b = code (!jp + !k) in
+          if a = b then (
+            if !k = !p then (jp := !jp + !p; k := 1) else incr k
+          )
+          else if gt a b then (
+            jp := !jp + !k; k := 1; p := !jp - !ip
+          )
+          else (
+            ip := !jp; incr jp; k := 1; p := 1
+          )
+        done;
+        !ip, !p
+      in
+      let ms1, p1 = maximal_suffix (>) in
+      let ms2, p2 = maximal_suffix (<) in
+      (* The critical factorization is [0..ms] and [ms+1..l-1]. *)
+      let ms, p = if ms2 > ms1 then ms2, p2 else ms1, p1 in
+
+      (* If [sub] is periodic, matches can be shifted by the period
+       * while remembering how much of the left half is known to
+       * match ([mem0]).
+       *)
+      let rec periodic i =
+        i > ms || (unsafe_get sub i = unsafe_get sub (p+i) && periodic (i+1))
+      in
+      let p, mem0 =
+        if periodic 0 then p, l - p else max ms (l - ms - 1) + 1, 0 in
+
+      (* [shift.(c)] is 1 + the index of the last [c] in [sub], or 0. *)
+      let shift = Array.make 256 0 in
+      for i = 0 to l-1 do shift.(code i) <- i + 1 done;
+
+      fun str pos ->
+        let len = length str in
+        let rec search h mem =
+          if len - h < l then -1
+          else (
+            let s = Array.unsafe_get shift
+                      (Char.code (unsafe_get str (h + l - 1))) in
+            if s = 0 then search (h + l) 0
+            else if s < l then search (h + imax (l - s) mem) 0
+            else (
+              (* Compare the right half, then the left half. *)
+              let k = ref (imax (ms + 1) mem) in
+              while !k < l && unsafe_get sub !k = unsafe_get str (h + !k) do
+                incr k
+              done;
+              if !k < l then search (h + !k - ms) 0
+              else (
+                let k = ref (ms + 1) in
+                while !k > mem &&
+                      unsafe_get sub (!k-1) = unsafe_get str (h + !k - 1) do
+                  decr k
+                done;
+                if !k <= mem then h else search (h + p) mem0
+              )
+            )
+          )
+        in
+        search pos 0
+
+    (* [searcher sub] returns a function which finds [sub] in a
+     * string starting at a given position, for searching repeatedly
+     * for the same [sub].
+     *)
+    let searcher sub =
+      match length sub with
+      | 0 -> fun _ _ -> 0
+      | 1 ->
+         let c = unsafe_get sub 0 in
+         fun str pos ->
+           if pos >= length str then -1
+           else (
+             match index_from_opt str pos c with
+             | Some i -> i
+             | None -> -1
+           )
+      | _ -> two_way sub
+
     let find_from str pos sub =
       let sublen = length sub in
       if sublen = 0 then
         0
-      else (
-        let found = ref 0 in
-        let len = length str in
-        try
-          for i = pos to len - sublen do
-            let j = ref 0 in
-            while unsafe_get str (i + !j) = unsafe_get sub !j do
-              incr j;
-              if !j = sublen then begin found := i; raise Exit; end;
-            done;
-          done;
-          -1
-        with
-          Exit -> !found
-      )
+      else if length str - pos < 256 then
+        (* Not worth preprocessing [sub] for a short string. *)
+        find_naive str pos sub
+      else
+        searcher sub str pos
 
     let find str sub = find_from str 0 sub
 
-    let rec replace s s1 s2 =
+    let replace s s1 s2 =
       let len = length s in
       let sublen = length s1 in
-      let i = find s s1 in
+      let search = searcher s1 in
+      let i = if sublen = 0 then -1 else search s 0 in
       if i = -1 then s
       else (
-        let s' = sub s 0 i in
-        let s'' = sub s (i+sublen) (len-i-sublen) in
-        s' ^ s2 ^ replace s'' s1 s2
+        (* Build the result in one pass. *)
+        let buf = Buffer.create len in
+        let rec loop posn i =
+          if i = -1 then
+            Buffer.add_substring buf s posn (len - posn)
+          else (
+            Buffer.add_substring buf s posn (i - posn);
+            Buffer.add_string buf s2;
+            let posn = i + sublen in
+            loop posn (search s posn)
+          )
+        in
+        loop 0 i;
+        Buffer.contents buf
       )
 
     let replace_char s c1 c2 =
@@ -294,6 +410,7 @@ module String = struct
 
       let len = String.length str in
       let seplen = String.length sep in
+      let find_from = searcher sep in
 
       let rec loop iters posn acc =
         (* If we reached the limit, OR if the pattern does not match
@@ -305,7 +422,7 @@ module String = struct
           List.rev (rest :: acc)
         )
         else (
-          let end_ = find_from str posn sep in
+          let end_ = find_from str posn in
           if end_ = -1 then (
             let rest =
               if posn = 0 then str else String.sub str posn (len-posn) in
@@ -692,21 +809,40 @@ let with_openfile filename flags perms f =
   Fun.protect (fun () -> f fd) ~finally:(fun () -> Unix.close fd)
 
 let read_whole_file path =
-  let buf = Buffer.create 16384 in
   with_open_in path (
     fun chan ->
-      let maxlen = 16384 in
-      let b = Bytes.create maxlen in
-      let rec loop () =
-        let r = input chan b 0 maxlen in
-        if r > 0 then (
-          Buffer.add_substring buf (Bytes.to_string b) 0 r;
-          loop ()
+      (* Allocate the result once using the size of the file.  The
+       * size is only a hint: it is 0 for pipes and for files in
+       * /proc, and the file might change while we are reading it.
+       *)
+      let size = try in_channel_length chan with Sys_error _ -> 0 in
+      let rec loop b n =
+        let len = Bytes.length b in
+        if n < len then (
+          let r = input chan b n (len - n) in
+          if r = 0 then b, n else loop b (n + r)
+        )
+        else (
+          (* The buffer is full, so check for EOF before growing it. *)
+          match input_char chan with
+          | exception End_of_file -> b, n
+          | c ->
+             let b = Bytes.extend b 0 (max 16384 len) in
+             Bytes.unsafe_set b n c;
+             loop b (n + 1)
         )
       in
-      loop ()
-  );
-  Buffer.contents buf
+      let b, n = loop (Bytes.create size) 0 in
+      if n = Bytes.length b then Bytes.unsafe_to_string b
+      else Bytes.sub_string b 0 n
+  )
+
+let map_whole_file path =
+  with_openfile path [Unix.O_RDONLY] 0 (
+    fun fd ->
+      let ga = Unix.map_file fd Bigarray.char Bigarray.c_layout false [|-1|] in
+      Bigarray.array1_of_genarray ga
+  )
 
 (* Compare two version strings intelligently. *)
 let rex_numbers = Str.regexp "^\\([0-9]+\\)\\(.*\\)$"
@@ -440,6 +440,18 @@ val with_openfile : string -> Unix.open_flag list -> Unix.file_perm -> (Unix.fil
 val read_whole_file : string -> string
 (** Read in the whole file as a string. *)
 
+val map_whole_file : string ->
+                     (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout)
+                     Bigarray.Array1.t
+(** Map the whole file into memory, for scanning large files without
+    copying them onto the OCaml heap.
+
+    The mapping is private, so changes to the array are not written
+    back to the file.  It is unmapped when the array is garbage
+    collected.  This only works for regular files: special files
+    (such as pipes) raise [Unix.Unix_error], and files in [/proc]
+    appear to be empty, so use {!read_whole_file} for those. *)
+
 val compare_version : string -> string -> int
 (** Compare two version strings. *)
 
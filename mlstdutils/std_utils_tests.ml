@@ -112,7 +112,44 @@ let () =
   assert_equal_int 1 (String.find "foo" "o");
   assert_equal_int 3 (String.find "foobar" "bar");
   assert_equal_int (-1) (String.find "" "baz");
-  assert_equal_int (-1) (String.find "foobar" "baz")
+  assert_equal_int (-1) (String.find "foobar" "baz");
+
+  (* Long strings use a different search algorithm, so compare it
+   * against a naive search over small alphabets, where periodic
+   * patterns and near misses are common.
+   *)
+  let naive_find_from str pos sub =
+    let len = String.length str and sublen = String.length sub in
+    let rec loop i =
+      if i > len - sublen then -1
+      else if String.sub str i sublen = sub then i
+      else loop (i+1)
+    in
+    loop pos
+  in
+  let random_string alphabet n =
+    let n_alpha = String.length alphabet in
+    Stdlib.String.init n (fun _ -> alphabet.[Random.int n_alpha])
+  in
+  let rs = Random.get_state () in
+  Random.init 42;
+  for _i = 1 to 2000 do
+    let alphabet = if Random.bool () then "ab" else "abc" in
+    let str = random_string alphabet (256 + Random.int 1000) in
+    let sub = random_string alphabet (1 + Random.int 12) in
+    let pos = Random.int 64 in
+    assert_equal_int (naive_find_from str pos sub)
+      (String.find_from str pos sub)
+  done;
+  Random.set_state rs;
+
+  (* Worst case for a naive search: this used to take quadratic time. *)
+  let str = String.make 4_000_000 'a' ^ "b" in
+  let sub = String.make 1000 'a' ^ "b" in
+  let t = Sys.time () in
+  assert_equal_int (4_000_001 - 1001) (String.find str sub);
+  assert_equal_int (-1) (String.find str (String.make 1000 'a' ^ "c"));
+  eprintf "String.find: 4 MB worst case took %.3fs\n" (Sys.time () -. t)
 
 (* Test Std_utils.String.break. *)
 let () =
@@ -154,7 +191,34 @@ let () =
   (* Test that nsplit can handle large strings. *)
   let xs = Array.to_list (Array.make 10_000_000 "xyz") in
   let xs_concat = String.concat " " xs in
-  assert_equal_stringlist xs (String.nsplit " " xs_concat)
+  assert_equal_stringlist xs (String.nsplit " " xs_concat);
+
+  (* Same with a multi-byte separator. *)
+  let xs = Array.to_list (Array.make 1_000_000 "xyz") in
+  let xs_concat = String.concat ", " xs in
+  let t = Sys.time () in
+  assert_equal_stringlist xs (String.nsplit ", " xs_concat);
+  eprintf "String.nsplit: %d MB took %.3fs\n"
+    (String.length xs_concat / 1_000_000) (Sys.time () -. t)
+
+(* Test Std_utils.String.replace. *)
+let () =
+  assert_equal_string "" (String.replace "" "a" "b");
+  assert_equal_string "abc" (String.replace "abc" "" "x");
+  assert_equal_string "abc" (String.replace "abc" "d" "x");
+  assert_equal_string "xbc" (String.replace "abc" "a" "x");
+  assert_equal_string "xbxbx" (String.replace "ababa" "a" "x");
+  assert_equal_string "aba" (String.replace "aaaba" "aa" "");
+  assert_equal_string "foo/bar/baz" (String.replace "foo\\bar\\baz" "\\" "/");
+  assert_equal_string "aXXa" (String.replace "aYa" "Y" "XX");
+
+  (* Replace in a large string. *)
+  let xs = Array.to_list (Array.make 1_000_000 "xyz") in
+  let str = String.concat "::" xs in
+  let t = Sys.time () in
+  assert_equal_string (String.concat "/" xs) (String.replace str "::" "/");
+  eprintf "String.replace: %d MB took %.3fs\n"
+    (String.length str / 1_000_000) (Sys.time () -. t)
 
 (* Test Std_utils.String.lines_split. *)
 let () =
@@ -255,3 +319,22 @@ let () =
   assert_equal_string "3" (List.last ["1"; "2"; "3"]);
   assert_equal_string "1" (List.last ["1"]);
   assert_raises (Invalid_argument "List.last") (fun () -> List.last [])
+
+(* Test Std_utils.read_whole_file and Std_utils.map_whole_file. *)
+let () =
+  let test size =
+    let data = Stdlib.String.init size (fun i -> Char.chr (i land 0xff)) in
+    let tmpfile = Filename.temp_file "std_utils_tests" ".data" in
+    with_open_out tmpfile (fun chan -> output_string chan data);
+    assert_equal_string data (read_whole_file tmpfile);
+    let ba = map_whole_file tmpfile in
+    assert_equal_int size (Bigarray.Array1.dim ba);
+    let mapped = Stdlib.String.init size (Bigarray.Array1.get ba) in
+    assert_equal_string data mapped;
+    Unix.unlink tmpfile
+  in
+  List.iter test [0; 1; 4095; 4096; 16384; 16385; 1_000_000];
+
+  (* Files in /proc have size 0 but are not empty. *)
+  if Sys.file_exists "/proc/self/status" then
+    assert_nonempty_string (read_whole_file "/proc/self/status")
@@ -34,90 +34,117 @@ type output_format =
   | Indented
 
 
-let spaces_for_indent level =
-  let len = level * 2 in
-  let b = Bytes.create len in
-  Bytes.fill b 0 len ' ';
-  Bytes.to_string b
-
-let print_dict_after_start ~fmt ~indent ~size =
-  match size, fmt with
-    | 0, Compact -> ""
-    | _, Compact -> " "
-    | _, Indented -> "\n"
-
-let print_dict_before_end ~fmt ~indent ~size =
-  match size, fmt with
-    | 0, _ -> ""
-    | _, Compact -> " "
-    | _, Indented -> "\n"
-
-let print_indent ~fmt ~indent =
+(* The generator writes to any output which provides these functions,
+ * so that documents can be streamed to a channel or a buffer without
+ * building intermediate strings.
+ *)
+type writer = {
+  add_char : char -> unit;
+  add_string : string -> unit;
+  add_substring : string -> int -> int -> unit;
+}
+
+let buffer_writer buf = {
+  add_char = Buffer.add_char buf;
+  add_string = Buffer.add_string buf;
+  add_substring = Buffer.add_substring buf;
+}
+
+let channel_writer chan = {
+  add_char = output_char chan;
+  add_string = output_string chan;
+  add_substring = output_substring chan;
+}
+
+let write_indent w ~fmt ~indent =
   match fmt with
-  | Compact -> ""
-  | Indented -> spaces_for_indent indent
-
-(* JSON quoting. *)
-let json_escape_string str =
-  let res = ref "" in
-  for i = 0 to String.length str - 1 do
-    res := !res ^ (match str.[i] with
-      | '"' -> "\\\""
-      | '\\' -> "\\\\"
-      | '\b' -> "\\b"
-      | '\n' -> "\\n"
-      | '\r' -> "\\r"
-      | '\t' -> "\\t"
-      | c -> String.make 1 c)
-  done;
-  !res
-
-let json_quote_string str =
-  "\"" ^ (json_escape_string str) ^ "\""
-
-let rec output_dict fields ~fmt ~indent =
-  let size = List.length fields in
-  let newlinesep =
-    match fmt with
-    | Compact -> ", "
-    | Indented -> ",\n" in
-  "{" ^ (print_dict_after_start ~fmt ~indent ~size) ^
-    String.concat newlinesep (
-      List.map (
-        fun (n, f) ->
-          (print_indent ~fmt ~indent:(indent + 1)) ^ (json_quote_string n)
-          ^ ": " ^ (output_field ~fmt ~indent f)
-      ) fields
-    )
-  ^ (print_dict_before_end ~fmt ~indent ~size) ^ (print_indent ~fmt ~indent) ^ "}"
-
-and output_list fields ~fmt ~indent =
-  let size = List.length fields in
-  let newlinesep =
-    match fmt with
-    | Compact -> ", "
-    | Indented -> ",\n" in
-  "[" ^ (print_dict_after_start ~fmt ~indent ~size) ^
-    String.concat newlinesep (
-      List.map (
-        fun f ->
-          (print_indent ~fmt ~indent:(indent + 1)) ^ (output_field ~fmt ~indent f)
-      ) fields
+  | Compact -> ()
+  | Indented -> for _i = 1 to indent do w.add_string "  " done
+
+(* JSON quoting.  Runs of characters which do not need escaping are
+ * written in one go.
+ *)
+let escape_char = function
+  | '"' -> "\\\""
+  | '\\' -> "\\\\"
+  | '\b' -> "\\b"
+  | '\n' -> "\\n"
+  | '\r' -> "\\r"
+  | '\t' -> "\\t"
+  | c -> String.make 1 c
+
+let write_quoted_string w str =
+  let len = String.length str in
+  let flush start i =
+    if i > start then w.add_substring str start (i - start)
+  in
+  let rec loop start i =
+    if i = len then flush start i
+    else (
+      match String.unsafe_get str i with
+      | '"' | '\\' | '\b' | '\n' | '\r' | '\t' as c ->
+         flush start i;
+         w.add_string (escape_char c);
+         loop (i+1) (i+1)
+      | _ -> loop start (i+1)
     )
-  ^ (print_dict_before_end ~fmt ~indent ~size) ^ (print_indent ~fmt ~indent) ^ "]"
+  in
+  w.add_char '"';
+  loop 0 0;
+  w.add_char '"'
+
+(* Write the elements of a dict or a list between [lbr] and [rbr]. *)
+let rec write_seq w ~fmt ~indent lbr rbr write_elem = function
+  | [] ->
+     w.add_char lbr;
+     (match fmt with Compact -> () | Indented -> w.add_char '\n');
+     write_indent w ~fmt ~indent;
+     w.add_char rbr
+  | elems ->
+     w.add_char lbr;
+     w.add_char (match fmt with Compact -> ' ' | Indented -> '\n');
+     List.iteri (
+       fun i elem ->
+         if i > 0 then
+           w.add_string (match fmt with Compact -> ", " | Indented -> ",\n");
+         write_indent w ~fmt ~indent:(indent + 1);
+         write_elem elem
+     ) elems;
+     w.add_char (match fmt with Compact -> ' ' | Indented -> '\n');
+     write_indent w ~fmt ~indent;
+     w.add_char rbr
+
+and write_dict w ~fmt ~indent fields =
+  write_seq w ~fmt ~indent '{' '}' (
+    fun (n, f) ->
+      write_quoted_string w n;
+      w.add_string ": ";
+      write_field w ~fmt ~indent f
+  ) fields
 
-and output_field ~indent ~fmt = function
-  | Null -> "null"
-  | String s -> json_quote_string s
-  | Int i -> Int64.to_string i
+and write_list w ~fmt ~indent fields =
+  write_seq w ~fmt ~indent '[' ']' (write_field w ~fmt ~indent) fields
+
+and write_field w ~fmt ~indent = function
+  | Null -> w.add_string "null"
+  | String s -> write_quoted_string w s
+  | Int i -> w.add_string (Int64.to_string i)
   (* The JSON standard permits either "1" or "1.0" but not "1.".
    * OCaml string_of_float will generate "1.", but the %g formatter
    * will only generate the valid JSON values.
    *)
-  | Float f -> Printf.sprintf "%g" f
-  | Bool b -> if b then "true" else "false"
-  | List l -> output_list ~indent:(indent + 1) ~fmt l
-  | Dict d -> output_dict ~indent:(indent + 1) ~fmt d
+  | Float f -> w.add_string (Printf.sprintf "%g" f)
+  | Bool b -> w.add_string (if b then "true" else "false")
+  | List l -> write_list w ~fmt ~indent:(indent + 1) l
+  | Dict d -> write_dict w ~fmt ~indent:(indent + 1) d
+
+let buffer_add_doc ?(fmt = Compact) buf fields =
+  write_dict (buffer_writer buf) ~fmt ~indent:0 fields
+
+let output_doc ?(fmt = Compact) chan fields =
+  write_dict (channel_writer chan) ~fmt ~indent:0 fields
 
 let string_of_doc ?(fmt = Compact) fields =
-  output_dict fields ~fmt ~indent:0
+  let buf = Buffer.create 4096 in
+  buffer_add_doc ~fmt buf fields;
+  Buffer.contents buf
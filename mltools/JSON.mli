@@ -35,3 +35,10 @@ type output_format =
 
 val string_of_doc : ?fmt:output_format -> doc -> string
   (** Serialize {!doc} object as a string. *)
+
+val buffer_add_doc : ?fmt:output_format -> Buffer.t -> doc -> unit
+  (** Serialize {!doc} object, appending it to a buffer. *)
+
+val output_doc : ?fmt:output_format -> out_channel -> doc -> unit
+  (** Serialize {!doc} object directly to a channel, without
+      building the serialized document in memory first. *)
@@ -26,7 +26,17 @@
 #include <json.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <caml/custom.h>
+
+#include "guestfs-utils.h"
 
 #define JSON_NULL       (Val_int (0)) /* Variants without parameters. */
 #define JSON_STRING_TAG 0             /* Variants with parameters. */
@@ -36,24 +46,44 @@
 #define JSON_LIST_TAG   4
 #define JSON_DICT_TAG   5
 
+/* Maximum number of nested objects and arrays, in both parsers. */
+#define MAX_NESTING     20
+
 value virt_builder_json_parser_tree_parse (value stringv);
 value virt_builder_json_parser_tree_parse_file (value stringv);
+value virt_builder_json_parser_stream_open (value filenamev);
+value virt_builder_json_parser_stream_close (value streamv);
+value virt_builder_json_parser_stream_next (value streamv);
+value virt_builder_json_parser_stream_skip (value streamv);
 
+/* Raise Sys_error as OCaml's own file functions do, for example
+ * "filename: No such file or directory".
+ */
+static void __attribute__((noreturn))
+raise_sys_error (int errnum, const char *filename)
+{
+  char msg[1024];
+
+  snprintf (msg, sizeof msg, "%s: %s", filename, strerror (errnum));
+  caml_raise_sys_error (caml_copy_string (msg));
+}
+
+/* 'level' is the number of objects and arrays around 'val'. */
 static value
 convert_json_t (json_object *val, int level)
 {
   CAMLparam0 ();
   CAMLlocal5 (rv, v, tv, sv, consv);
 
-  if (level > 20)
-    caml_invalid_argument ("too many levels of object/array nesting");
-
   switch (json_object_get_type (val)) {
   case json_type_object: {
     struct json_object_iterator it, itend;
     const char *key;
     json_object *jvalue;
 
+    if (level >= MAX_NESTING)
+      caml_invalid_argument ("too many levels of object/array nesting");
+
     rv = caml_alloc (1, JSON_DICT_TAG);
     v = Val_int (0);
     /* This will create the OCaml list backwards, but JSON
@@ -90,6 +120,9 @@ convert_json_t (json_object *val, int level)
     size_t i;
     json_object *jvalue;
 
+    if (level >= MAX_NESTING)
+      caml_invalid_argument ("too many levels of object/array nesting");
+
     rv = caml_alloc (1, JSON_LIST_TAG);
     v = Val_int (0);
     for (i = 0; i < len; ++i) {
@@ -161,8 +194,704 @@ virt_builder_json_parser_tree_parse (value stringv)
   }
   json_tokener_free (tok);
 
-  rv = convert_json_t (tree, 1);
+  rv = convert_json_t (tree, 0);
   json_object_put (tree);
 
   CAMLreturn (rv);
 }
+
+/* Parse a file, feeding it to the tokener in chunks so that we never
+ * need the whole file in memory at the same time as the tree.
+ */
+value
+virt_builder_json_parser_tree_parse_file (value filenamev)
+{
+  CAMLparam1 (filenamev);
+  CAMLlocal1 (rv);
+  json_object *tree = NULL;
+  json_tokener *tok = NULL;
+  enum json_tokener_error err = json_tokener_continue;
+  int fd;
+  char *buf;
+  ssize_t r;
+
+  fd = open (String_val (filenamev), O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    raise_sys_error (errno, String_val (filenamev));
+  guestfs_int_fadvise_sequential (fd);
+
+  buf = malloc (BUFSIZ * 16);
+  if (buf == NULL) {
+    close (fd);
+    caml_raise_out_of_memory ();
+  }
+
+  tok = json_tokener_new ();
+  json_tokener_set_flags (tok,
+                          JSON_TOKENER_STRICT | JSON_TOKENER_VALIDATE_UTF8);
+  while (err == json_tokener_continue) {
+    r = read (fd, buf, BUFSIZ * 16);
+    if (r == -1) {
+      const int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+      json_tokener_free (tok);
+      free (buf);
+      close (fd);
+      raise_sys_error (saved_errno, String_val (filenamev));
+    }
+    /* At the end of the file, pass the terminating '\0' so that the
+     * tokener can finish a top-level value such as a number.
+     */
+    if (r == 0)
+      tree = json_tokener_parse_ex (tok, "", 1);
+    else
+      tree = json_tokener_parse_ex (tok, buf, r);
+    err = json_tokener_get_error (tok);
+    if (r == 0 && err == json_tokener_continue)
+      err = json_tokener_error_parse_eof;
+  }
+  free (buf);
+  close (fd);
+
+  if (err != json_tokener_success) {
+    char msg[256];
+    snprintf (msg, sizeof msg, "JSON parse error: %s",
+              json_tokener_error_desc (err));
+    json_tokener_free (tok);
+    caml_invalid_argument (msg);
+  }
+  json_tokener_free (tok);
+
+  rv = convert_json_t (tree, 0);
+  json_object_put (tree);
+
+  CAMLreturn (rv);
+}
+
+/* Streaming parser.
+ *
+ * This reads the file in chunks and returns one event at a time
+ * (start/end of an object or array, a key, or a scalar value), so
+ * that large documents can be scanned in constant memory.  It does
+ * not use json-c, which can only build a complete tree.
+ */
+enum token {
+  TOK_OBJECT_START, TOK_OBJECT_END, TOK_ARRAY_START, TOK_ARRAY_END,
+  TOK_KEY, TOK_NULL, TOK_STRING, TOK_INT, TOK_FLOAT, TOK_TRUE, TOK_FALSE,
+  TOK_END,
+};
+
+enum state {
+  STATE_VALUE,                  /* Expecting a value. */
+  STATE_ARRAY_FIRST,            /* After '[', expecting a value or ']'. */
+  STATE_OBJECT_FIRST,           /* After '{', expecting a key or '}'. */
+  STATE_OBJECT_KEY,             /* After ',' in an object, expecting a key. */
+  STATE_AFTER_VALUE,            /* Expecting ',' or the end of a container. */
+  STATE_DONE,                   /* After the top-level value. */
+};
+
+struct stream {
+  int fd;
+  char *filename;               /* For error messages. */
+  char *buf;                    /* Read buffer. */
+  size_t pos, len;
+  bool eof;
+  char *tok;                    /* Text of the current string or number. */
+  size_t tok_len, tok_alloc;
+  enum state state;
+  size_t depth;
+  char stack[MAX_NESTING];      /* '{' or '[' for each open container. */
+};
+
+#define STREAM_BUFSIZ 65536
+
+#define Stream_val(v) (*((struct stream **)Data_custom_val(v)))
+
+static void
+free_stream (struct stream *s)
+{
+  if (s->fd >= 0)
+    close (s->fd);
+  free (s->filename);
+  free (s->buf);
+  free (s->tok);
+  free (s);
+}
+
+static void
+stream_finalize (value streamv)
+{
+  struct stream *s = Stream_val (streamv);
+
+  if (s)
+    free_stream (s);
+}
+
+static struct custom_operations stream_custom_operations = {
+  (char *) "JSON_parser_stream_custom_operations",
+  stream_finalize,
+  custom_compare_default,
+  custom_hash_default,
+  custom_serialize_default,
+  custom_deserialize_default,
+  custom_compare_ext_default,
+};
+
+static void __attribute__((noreturn))
+stream_error (const char *msg)
+{
+  char buf[256];
+
+  snprintf (buf, sizeof buf, "JSON parse error: %s", msg);
+  caml_invalid_argument (buf);
+}
+
+/* Return the next byte without consuming it, or -1 at the end of
+ * the file.
+ */
+static int
+peek_char (struct stream *s)
+{
+  ssize_t r;
+
+  while (s->pos == s->len) {
+    if (s->eof)
+      return -1;
+    r = read (s->fd, s->buf, STREAM_BUFSIZ);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      raise_sys_error (errno, s->filename);
+    }
+    s->pos = 0;
+    s->len = r;
+    if (r == 0)
+      s->eof = true;
+  }
+
+  return (unsigned char) s->buf[s->pos];
+}
+
+static int
+next_char (struct stream *s)
+{
+  const int c = peek_char (s);
+
+  if (c >= 0)
+    s->pos++;
+  return c;
+}
+
+static void
+skip_whitespace (struct stream *s)
+{
+  int c;
+
+  while ((c = peek_char (s)) == ' ' || c == '\t' || c == '\n' || c == '\r')
+    s->pos++;
+}
+
+static void
+tok_append (struct stream *s, const char *p, size_t n)
+{
+  if (s->tok_len + n > s->tok_alloc) {
+    size_t alloc = s->tok_alloc ? s->tok_alloc : 64;
+    char *tok;
+
+    while (alloc < s->tok_len + n)
+      alloc *= 2;
+    tok = realloc (s->tok, alloc);
+    if (tok == NULL)
+      caml_raise_out_of_memory ();
+    s->tok = tok;
+    s->tok_alloc = alloc;
+  }
+  memcpy (&s->tok[s->tok_len], p, n);
+  s->tok_len += n;
+}
+
+static unsigned
+parse_hex4 (struct stream *s)
+{
+  unsigned r = 0;
+  int i, c;
+
+  for (i = 0; i < 4; ++i) {
+    c = next_char (s);
+    if (c >= '0' && c <= '9')
+      r = r*16 + c - '0';
+    else if (c >= 'a' && c <= 'f')
+      r = r*16 + c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      r = r*16 + c - 'A' + 10;
+    else
+      stream_error ("invalid \\u escape");
+  }
+  return r;
+}
+
+/* Check one UTF-8 encoded character in a string, and append it to
+ * the token if 'store' is true.  Like json-c with
+ * JSON_TOKENER_VALIDATE_UTF8 (used by the tree parser), this checks
+ * only the structure of the byte sequence.
+ */
+static void
+parse_utf8 (struct stream *s, bool store)
+{
+  char utf8[4];
+  size_t i, n;
+  int c;
+
+  c = next_char (s);
+  if ((c & 0xe0) == 0xc0)
+    n = 2;
+  else if ((c & 0xf0) == 0xe0)
+    n = 3;
+  else if ((c & 0xf8) == 0xf0)
+    n = 4;
+  else
+    stream_error ("invalid UTF-8 in string");
+  utf8[0] = c;
+  for (i = 1; i < n; ++i) {
+    c = next_char (s);
+    if (c == -1 || (c & 0xc0) != 0x80)
+      stream_error ("invalid UTF-8 in string");
+    utf8[i] = c;
+  }
+  if (store)
+    tok_append (s, utf8, n);
+}
+
+/* Parse a string after the opening quote.  If 'store' is false the
+ * string is only checked, which is used when skipping values.
+ */
+static void
+parse_string (struct stream *s, bool store)
+{
+  int c;
+
+  s->tok_len = 0;
+  for (;;) {
+    /* Copy runs of ordinary ASCII characters straight from the
+     * buffer.
+     */
+    size_t start = s->pos, end = s->pos;
+
+    while (end < s->len) {
+      c = (unsigned char) s->buf[end];
+      if (c == '"' || c == '\\' || c < 0x20 || c >= 0x80)
+        break;
+      end++;
+    }
+    if (store && end > start)
+      tok_append (s, &s->buf[start], end - start);
+    s->pos = end;
+
+    /* The end of the run, or the end of the buffer. */
+    c = peek_char (s);
+    if (c == -1)
+      stream_error ("unexpected end of file in string");
+    else if (c >= 0x80) {
+      parse_utf8 (s, store);
+      continue;
+    }
+    else if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    s->pos++;
+    if (c == '"')
+      return;
+    else if (c < 0x20)
+      stream_error ("invalid character in string");
+    else {
+      char utf8[4];
+      size_t n = 1;
+      unsigned u;
+
+      switch (next_char (s)) {
+      case '"': utf8[0] = '"'; break;
+      case '\\': utf8[0] = '\\'; break;
+      case '/': utf8[0] = '/'; break;
+      case 'b': utf8[0] = '\b'; break;
+      case 'f': utf8[0] = '\f'; break;
+      case 'n': utf8[0] = '\n'; break;
+      case 'r': utf8[0] = '\r'; break;
+      case 't': utf8[0] = '\t'; break;
+      case 'u':
+        u = parse_hex4 (s);
+        if (u >= 0xdc00 && u <= 0xdfff)
+          stream_error ("invalid \\u escape");
+        if (u >= 0xd800 && u <= 0xdbff) {
+          unsigned lo;
+
+          /* A surrogate pair. */
+          if (next_char (s) != '\\' || next_char (s) != 'u')
+            stream_error ("invalid \\u escape");
+          lo = parse_hex4 (s);
+          if (lo < 0xdc00 || lo > 0xdfff)
+            stream_error ("invalid \\u escape");
+          u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+        }
+        if (u < 0x80)
+          utf8[0] = u;
+        else if (u < 0x800) {
+          utf8[0] = 0xc0 | (u >> 6);
+          utf8[1] = 0x80 | (u & 0x3f);
+          n = 2;
+        }
+        else if (u < 0x10000) {
+          utf8[0] = 0xe0 | (u >> 12);
+          utf8[1] = 0x80 | ((u >> 6) & 0x3f);
+          utf8[2] = 0x80 | (u & 0x3f);
+          n = 3;
+        }
+        else {
+          utf8[0] = 0xf0 | (u >> 18);
+          utf8[1] = 0x80 | ((u >> 12) & 0x3f);
+          utf8[2] = 0x80 | ((u >> 6) & 0x3f);
+          utf8[3] = 0x80 | (u & 0x3f);
+          n = 4;
+        }
+        break;
+      default:
+        stream_error ("invalid escape in string");
+      }
+      if (store)
+        tok_append (s, utf8, n);
+    }
+  }
+}
+
+static void
+append_digits (struct stream *s)
+{
+  int c;
+  char ch;
+
+  if ((c = peek_char (s)) < '0' || c > '9')
+    stream_error ("invalid number");
+  while ((c = peek_char (s)) >= '0' && c <= '9') {
+    ch = c;
+    tok_append (s, &ch, 1);
+    s->pos++;
+  }
+}
+
+/* Parse a number.  The text is left in s->tok, NUL-terminated. */
+static enum token
+parse_number (struct stream *s)
+{
+  bool is_float = false;
+  char ch;
+  int c;
+
+  s->tok_len = 0;
+  if (peek_char (s) == '-') {
+    tok_append (s, "-", 1);
+    s->pos++;
+  }
+  if (peek_char (s) == '0') {
+    tok_append (s, "0", 1);
+    s->pos++;
+  }
+  else
+    append_digits (s);
+  if (peek_char (s) == '.') {
+    tok_append (s, ".", 1);
+    s->pos++;
+    append_digits (s);
+    is_float = true;
+  }
+  if ((c = peek_char (s)) == 'e' || c == 'E') {
+    tok_append (s, "e", 1);
+    s->pos++;
+    if ((c = peek_char (s)) == '+' || c == '-') {
+      ch = c;
+      tok_append (s, &ch, 1);
+      s->pos++;
+    }
+    append_digits (s);
+    is_float = true;
+  }
+  tok_append (s, "", 1);
+  s->tok_len--;
+
+  return is_float ? TOK_FLOAT : TOK_INT;
+}
+
+static void
+parse_literal (struct stream *s, const char *rest)
+{
+  for (; *rest; ++rest)
+    if (next_char (s) != *rest)
+      stream_error ("invalid literal");
+}
+
+/* Return the next token, updating the state. */
+static enum token
+next_token (struct stream *s, bool store)
+{
+  int c;
+
+ again:
+  skip_whitespace (s);
+  c = peek_char (s);
+
+  switch (s->state) {
+  case STATE_DONE:
+    if (c != -1)
+      stream_error ("trailing characters after the document");
+    return TOK_END;
+
+  case STATE_AFTER_VALUE:
+    if (s->depth == 0) {
+      s->state = STATE_DONE;
+      goto again;
+    }
+    if (c == ',') {
+      s->pos++;
+      s->state =
+        s->stack[s->depth-1] == '{' ? STATE_OBJECT_KEY : STATE_VALUE;
+      goto again;
+    }
+    if (c == ']' && s->stack[s->depth-1] == '[') {
+      s->pos++;
+      s->depth--;
+      return TOK_ARRAY_END;
+    }
+    if (c == '}' && s->stack[s->depth-1] == '{') {
+      s->pos++;
+      s->depth--;
+      return TOK_OBJECT_END;
+    }
+    stream_error (c == -1 ? "unexpected end of file" : "expected ','");
+
+  case STATE_ARRAY_FIRST:
+    if (c == ']') {
+      s->pos++;
+      s->depth--;
+      s->state = STATE_AFTER_VALUE;
+      return TOK_ARRAY_END;
+    }
+    break;
+
+  case STATE_OBJECT_FIRST:
+    if (c == '}') {
+      s->pos++;
+      s->depth--;
+      s->state = STATE_AFTER_VALUE;
+      return TOK_OBJECT_END;
+    }
+    /*FALLTHROUGH*/
+  case STATE_OBJECT_KEY:
+    if (c != '"')
+      stream_error ("expected a string key");
+    s->pos++;
+    parse_string (s, store);
+    skip_whitespace (s);
+    if (next_char (s) != ':')
+      stream_error ("expected ':'");
+    s->state = STATE_VALUE;
+    return TOK_KEY;
+
+  case STATE_VALUE:
+    break;
+  }
+
+  /* Parse a value. */
+  s->state = STATE_AFTER_VALUE;
+  switch (c) {
+  case '{': case '[':
+    if (s->depth >= MAX_NESTING)
+      caml_invalid_argument ("too many levels of object/array nesting");
+    s->pos++;
+    s->stack[s->depth++] = c;
+    if (c == '{') {
+      s->state = STATE_OBJECT_FIRST;
+      return TOK_OBJECT_START;
+    }
+    else {
+      s->state = STATE_ARRAY_FIRST;
+      return TOK_ARRAY_START;
+    }
+  case '"':
+    s->pos++;
+    parse_string (s, store);
+    return TOK_STRING;
+  case 't':
+    parse_literal (s, "true");
+    return TOK_TRUE;
+  case 'f':
+    parse_literal (s, "false");
+    return TOK_FALSE;
+  case 'n':
+    parse_literal (s, "null");
+    return TOK_NULL;
+  case '-': case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    return parse_number (s);
+  case -1:
+    stream_error ("unexpected end of file");
+  default:
+    stream_error ("unexpected character");
+  }
+}
+
+static struct stream *
+get_stream (value streamv)
+{
+  struct stream *s = Stream_val (streamv);
+
+  if (s == NULL)
+    caml_invalid_argument ("JSON_parser: stream is closed");
+  return s;
+}
+
+value
+virt_builder_json_parser_stream_open (value filenamev)
+{
+  CAMLparam1 (filenamev);
+  CAMLlocal1 (rv);
+  struct stream *s;
+  int fd;
+
+  fd = open (String_val (filenamev), O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    raise_sys_error (errno, String_val (filenamev));
+  guestfs_int_fadvise_sequential (fd);
+
+  s = calloc (1, sizeof *s);
+  if (s == NULL) {
+    close (fd);
+    caml_raise_out_of_memory ();
+  }
+  s->fd = fd;
+  s->state = STATE_VALUE;
+  s->filename = strdup (String_val (filenamev));
+  s->buf = malloc (STREAM_BUFSIZ);
+  if (s->filename == NULL || s->buf == NULL) {
+    free_stream (s);
+    caml_raise_out_of_memory ();
+  }
+
+  rv = caml_alloc_custom (&stream_custom_operations,
+                          sizeof (struct stream *), 0, 1);
+  Stream_val (rv) = s;
+
+  CAMLreturn (rv);
+}
+
+value
+virt_builder_json_parser_stream_close (value streamv)
+{
+  CAMLparam1 (streamv);
+  struct stream *s = Stream_val (streamv);
+
+  if (s) {
+    free_stream (s);
+    Stream_val (streamv) = NULL;
+  }
+
+  CAMLreturn (Val_unit);
+}
+
+/* Events returned to OCaml, see JSON_parser.ml. */
+#define EVENT_OBJECT_START (Val_int (0)) /* Constant constructors. */
+#define EVENT_OBJECT_END   (Val_int (1))
+#define EVENT_ARRAY_START  (Val_int (2))
+#define EVENT_ARRAY_END    (Val_int (3))
+#define EVENT_END          (Val_int (4))
+#define EVENT_KEY_TAG      0             /* Constructors with parameters. */
+#define EVENT_VALUE_TAG    1
+
+value
+virt_builder_json_parser_stream_next (value streamv)
+{
+  CAMLparam1 (streamv);
+  CAMLlocal3 (rv, v, sv);
+  struct stream *s = get_stream (streamv);
+  enum token t;
+  char *end;
+  int64_t i;
+
+  t = next_token (s, true);
+  switch (t) {
+  case TOK_OBJECT_START: CAMLreturn (EVENT_OBJECT_START);
+  case TOK_OBJECT_END: CAMLreturn (EVENT_OBJECT_END);
+  case TOK_ARRAY_START: CAMLreturn (EVENT_ARRAY_START);
+  case TOK_ARRAY_END: CAMLreturn (EVENT_ARRAY_END);
+  case TOK_END: CAMLreturn (EVENT_END);
+
+  case TOK_KEY:
+    sv = caml_alloc_initialized_string (s->tok_len, s->tok);
+    rv = caml_alloc (1, EVENT_KEY_TAG);
+    Store_field (rv, 0, sv);
+    CAMLreturn (rv);
+
+  case TOK_NULL:
+    v = JSON_NULL;
+    break;
+
+  case TOK_STRING:
+    sv = caml_alloc_initialized_string (s->tok_len, s->tok);
+    v = caml_alloc (1, JSON_STRING_TAG);
+    Store_field (v, 0, sv);
+    break;
+
+  case TOK_INT:
+    errno = 0;
+    i = strtoll (s->tok, &end, 10);
+    if (errno == 0) {
+      sv = caml_copy_int64 (i);
+      v = caml_alloc (1, JSON_INT_TAG);
+      Store_field (v, 0, sv);
+      break;
+    }
+    /* Integers which are too large for int64 are returned as floats. */
+    /*FALLTHROUGH*/
+  case TOK_FLOAT:
+    sv = caml_copy_double (strtod (s->tok, NULL));
+    v = caml_alloc (1, JSON_FLOAT_TAG);
+    Store_field (v, 0, sv);
+    break;
+
+  case TOK_TRUE: case TOK_FALSE:
+    v = caml_alloc (1, JSON_BOOL_TAG);
+    Store_field (v, 0, t == TOK_TRUE ? Val_true : Val_false);
+    break;
+  }
+
+  rv = caml_alloc (1, EVENT_VALUE_TAG);
+  Store_field (rv, 0, v);
+  CAMLreturn (rv);
+}
+
+/* Skip the next value (including all of its contents if it is an
+ * object or array) without allocating anything on the OCaml heap.
+ * Returns false if the enclosing array or object ended instead.
+ */
+value
+virt_builder_json_parser_stream_skip (value streamv)
+{
+  CAMLparam1 (streamv);
+  struct stream *s = get_stream (streamv);
+  enum token t;
+  size_t depth;
+
+  t = next_token (s, false);
+  if (t == TOK_KEY)
+    t = next_token (s, false);
+  switch (t) {
+  case TOK_OBJECT_END: case TOK_ARRAY_END: case TOK_END:
+    CAMLreturn (Val_false);
+  case TOK_OBJECT_START: case TOK_ARRAY_START:
+    depth = s->depth - 1;
+    while (s->depth > depth)
+      next_token (s, false);
+    break;
+  default: ;
+  }
+
+  CAMLreturn (Val_true);
+}
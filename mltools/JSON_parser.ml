@@ -21,10 +21,96 @@ open Tools_utils
 open Common_gettext.Gettext
 
 external json_parser_tree_parse : string -> JSON.json_t = "virt_builder_json_parser_tree_parse"
+external json_parser_tree_parse_file : string -> JSON.json_t = "virt_builder_json_parser_tree_parse_file"
 
-let json_parser_tree_parse_file filename =
-  let content = read_whole_file filename in
-  json_parser_tree_parse content
+(* Streaming parser. *)
+type stream
+
+(* This must match the EVENT_* constants in JSON_parser-c.c *)
+type event =
+  | Object_start
+  | Object_end
+  | Array_start
+  | Array_end
+  | End
+  | Key of string
+  | Value of JSON.json_t          (* Scalar values only. *)
+
+external stream_open : string -> stream = "virt_builder_json_parser_stream_open"
+external stream_close : stream -> unit = "virt_builder_json_parser_stream_close"
+external stream_next : stream -> event = "virt_builder_json_parser_stream_next"
+external stream_skip : stream -> bool = "virt_builder_json_parser_stream_skip"
+
+type path_elem =
+  | Field of string
+  | Any
+
+(* Build the value which starts with event [ev]. *)
+let rec value_of_event s = function
+  | Value v -> v
+  | Object_start ->
+     let rec loop acc =
+       match stream_next s with
+       | Key k ->
+          let v = value_of_event s (stream_next s) in
+          loop ((k, v) :: acc)
+       | Object_end -> JSON.Dict (List.rev acc)
+       | _ -> assert false
+     in
+     loop []
+  | Array_start ->
+     let rec loop acc =
+       match stream_next s with
+       | Array_end -> JSON.List (List.rev acc)
+       | ev -> loop (value_of_event s ev :: acc)
+     in
+     loop []
+  | Object_end | Array_end | End | Key _ -> assert false
+
+(* Read the next value, calling [fn] on the parts of it which match
+ * [path].  Everything else is skipped without being built.  Returns
+ * false if the enclosing array ended instead.
+ *)
+let rec iter_value s fn path rpath =
+  match stream_next s with
+  | Array_end -> false
+  | ev ->
+     (match path, ev with
+      | [], ev -> fn (List.rev rpath) (value_of_event s ev)
+      | p :: path, Object_start ->
+         let rec loop () =
+           match stream_next s with
+           | Key k ->
+              (match p with
+               | Any -> ignore (iter_value s fn path (k :: rpath))
+               | Field f when f = k -> ignore (iter_value s fn path (k :: rpath))
+               | Field _ -> ignore (stream_skip s)
+              );
+              loop ()
+           | Object_end -> ()
+           | _ -> assert false
+         in
+         loop ()
+      | Any :: path, Array_start ->
+         let rec loop i =
+           if iter_value s fn path (string_of_int i :: rpath) then loop (i+1)
+         in
+         loop 0
+      | Field _ :: _, Array_start ->
+         while stream_skip s do () done
+      | _ :: _, _ -> ()
+     );
+     true
+
+let json_parser_iter_file path fn filename =
+  let s = stream_open filename in
+  Fun.protect ~finally:(fun () -> stream_close s) (
+    fun () ->
+      if not (iter_value s fn path []) then assert false;
+      match stream_next s with
+      | End -> ()
+      | _ -> assert false
+  )
 
 let object_find_optional key = function
   | JSON.Dict fields ->
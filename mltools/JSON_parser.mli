@@ -20,7 +20,38 @@ val json_parser_tree_parse : string -> JSON.json_t
 (** Parse the JSON string. *)
 
 val json_parser_tree_parse_file : string -> JSON.json_t
-(** Parse the JSON in the specified file. *)
+(** Parse the JSON in the specified file.
+
+    The file is read in chunks, so only the parsed tree is held in
+    memory, not the contents of the file.
+
+    Raises [Sys_error] if the file cannot be read, or
+    [Invalid_argument] if it does not contain valid JSON. *)
+
+type path_elem =
+  | Field of string             (** The named field of an object. *)
+  | Any                         (** Every field of an object, or every
+                                    element of an array. *)
+
+val json_parser_iter_file : path_elem list ->
+                            (string list -> JSON.json_t -> unit) ->
+                            string -> unit
+(** [json_parser_iter_file path fn filename] parses the JSON in the
+    specified file incrementally, calling [fn keys value] for each
+    value found at [path].  [keys] are the actual field names (or
+    array indexes, as strings) leading to the value.
+
+    For example [[Field "products"; Any]] calls [fn] on each
+    field of the top level ["products"] object in turn.
+
+    Only the values found at [path] are built, and objects keep the
+    order of their fields from the file.  Everything else is skipped
+    as it is parsed, so this can be used to extract parts of very
+    large documents without holding the whole document in memory.
+
+    Raises [Sys_error] if the file cannot be read, or
+    [Invalid_argument] if it does not contain valid JSON.  Note that
+    the file may have been partly processed by then. *)
 
 val object_get_string : string -> JSON.json_t -> string
 (** [object_get_string key yv] gets the value of the [key] field as a string
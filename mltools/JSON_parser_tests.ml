@@ -103,12 +103,18 @@ let () =
   assert_raises_invalid_argument "";
   assert_raises_invalid_argument "invalid";
   assert_raises_invalid_argument ":5";
+  assert_raises_invalid_argument "\"\xc3\"";
+  assert_raises_invalid_argument "\"\xe2\x82x\"";
 
   (* Nested objects/arrays. *)
   let str = "[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]]" in
   assert_raises_nested str;
   let str = "{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":{\"a\":5}}}}}}}}}}}}}}}}}}}}}" in
-  assert_raises_nested str
+  assert_raises_nested str;
+
+  (* 20 levels are allowed, whatever is inside the innermost one. *)
+  let str = String.make 20 '[' ^ "1" ^ String.make 20 ']' in
+  ignore (json_parser_tree_parse str)
 
 (* tree parse basic *)
 let () =
@@ -168,4 +174,110 @@ let () =
     assert_equal_string "foo" (fst (List.hd l));
     assert_is_number 5_L (snd (List.hd l));
   end;
+  assert_raises (Sys_error "/nonexistent/file: No such file or directory")
+    (fun () -> ignore (json_parser_tree_parse_file "/nonexistent/file"));
   ()
+
+(* iter file *)
+let () =
+  let write_tmpfile str =
+    let tmpfile, chan = Filename.open_temp_file "tmp" ".tmp" in
+    On_exit.unlink tmpfile;
+    output_string chan str;
+    close_out chan;
+    tmpfile
+  in
+  let collect path tmpfile =
+    let r = ref [] in
+    json_parser_iter_file path (fun keys v -> List.push_front (keys, v) r)
+      tmpfile;
+    List.rev !r
+  in
+
+  let tmpfile =
+    write_tmpfile "{ \"format\": \"products:1.0\",
+  \"products\": {
+    \"b\": { \"arch\": \"x86_64\", \"versions\": [1, 2.5, null] },
+    \"a\": { \"arch\": \"aarch64\", \"skip\": [[{}], \"\\u00e9\\n\"] }
+  },
+  \"other\": [ { \"products\": 1 } ]
+}\n" in
+
+  (* The whole document, with fields in order. *)
+  let l = collect [] tmpfile in
+  assert_equal_int 1 (List.length l);
+  let d = get_dict (snd (List.hd l)) in
+  assert_equal_string "format,products,other"
+    (String.concat "," (List.map fst d));
+
+  (* Each product. *)
+  let l = collect [Field "products"; Any] tmpfile in
+  assert_equal_string "products.b,products.a"
+    (String.concat "," (List.map (fun (k, _) -> String.concat "." k) l));
+  assert_equal_string "x86_64" (object_get_string "arch" (snd (List.hd l)));
+
+  (* Array elements and scalars. *)
+  let l = collect [Field "products"; Any; Field "versions"; Any] tmpfile in
+  assert_equal_int 3 (List.length l);
+  assert_equal_string "products.b.versions.1"
+    (String.concat "." (fst (List.nth l 1)));
+  assert_is_number 1_L (snd (List.nth l 0));
+  assert_bool "float" (snd (List.nth l 1) = JSON.Float 2.5);
+  assert_bool "null" (snd (List.nth l 2) = JSON.Null);
+  let l = collect [Any; Any; Field "skip"; Any] tmpfile in
+  assert_is_string "\xc3\xa9\n" (snd (List.nth l 1));
+
+  (* Paths which do not match anything. *)
+  assert_equal_int 0 (List.length (collect [Field "missing"] tmpfile));
+  assert_equal_int 0
+    (List.length (collect [Field "format"; Field "x"] tmpfile));
+  assert_equal_int 0
+    (List.length (collect [Field "other"; Field "products"] tmpfile));
+
+  (* Invalid documents. *)
+  List.iter (
+    fun str ->
+      let tmpfile = write_tmpfile str in
+      assert_raises (Invalid_argument "parse_error") (
+        fun () ->
+          try collect [Field "a"] tmpfile
+          with Invalid_argument _ -> invalid_arg "parse_error"
+      )
+  ) [ ""; "{"; "{\"a\":}"; "[1,]"; "{\"a\":1} x"; "\"\\x\""; "01";
+      "\"\xc3\""; "{\"\xe2\x82x\":1}" ];
+  let tmpfile = write_tmpfile (String.make 21 '[' ^ String.make 21 ']') in
+  assert_raises (Invalid_argument "too many levels of object/array nesting")
+    (fun () -> collect [] tmpfile);
+  let tmpfile = write_tmpfile (String.make 20 '[' ^ "1" ^ String.make 20 ']') in
+  assert_equal_int 1 (List.length (collect [] tmpfile));
+  assert_raises (Sys_error "/nonexistent/file: No such file or directory")
+    (fun () -> collect [] "/nonexistent/file");
+  (* A directory can be opened, but not read. *)
+  let dir = Filename.get_temp_dir_name () in
+  assert_raises (Sys_error (dir ^ ": Is a directory"))
+    (fun () -> collect [] dir)
+
+(* iter file on a large document *)
+let () =
+  let tmpfile, chan = Filename.open_temp_file "tmp" ".tmp" in
+  On_exit.unlink tmpfile;
+  let n = 100_000 in
+  output_string chan "{ \"index\": {";
+  for i = 0 to n-1 do
+    if i > 0 then output_string chan ",";
+    fprintf chan "\n  \"item%d\": { \"path\": \"/path/to/%d\", \
+                  \"data\": [ %s ] }" i i (String.concat ", " (List.make 20 "\"x\""))
+  done;
+  output_string chan "\n} }\n";
+  close_out chan;
+
+  let t = Sys.time () in
+  let count = ref 0 in
+  json_parser_iter_file [Field "index"; Any; Field "path"] (
+    fun _ v ->
+      assert_is_string (sprintf "/path/to/%d" !count) v;
+      incr count
+  ) tmpfile;
+  assert_equal_int n !count;
+  eprintf "JSON_parser: streamed %d KB in %.3fs\n"
+    ((Unix.stat tmpfile).Unix.st_size / 1024) (Sys.time () -. t)
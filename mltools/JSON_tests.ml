@@ -248,3 +248,45 @@ let () =
   ]
 }"
     (JSON.string_of_doc ~fmt:JSON.Indented doc)
+
+(* buffer_add_doc and output_doc *)
+let () =
+  let doc = [
+    "item", JSON.List [ JSON.String "foo\n"; JSON.Null; JSON.Dict [] ];
+    "last", JSON.Float 1.5;
+  ] in
+  List.iter (
+    fun fmt ->
+      let buf = Buffer.create 13 in
+      Buffer.add_string buf "prefix";
+      JSON.buffer_add_doc ~fmt buf doc;
+      assert_equal_string ("prefix" ^ JSON.string_of_doc ~fmt doc)
+        (Buffer.contents buf);
+
+      let tmpfile = Filename.temp_file "JSON_tests" ".json" in
+      with_open_out tmpfile (fun chan -> JSON.output_doc ~fmt chan doc);
+      assert_equal_string (JSON.string_of_doc ~fmt doc)
+        (read_whole_file tmpfile);
+      Unix.unlink tmpfile
+  ) [ JSON.Compact; JSON.Indented ]
+
+(* large documents *)
+let () =
+  let line = String.make 1000 'x' ^ "\t\"quoted\"\n" in
+  let n = 10_000 in
+  let doc = [
+    "files", JSON.List (
+      List.init n (
+        fun i -> JSON.Dict [ "name", JSON.String line;
+                             "size", JSON.Int (Int64.of_int i) ]
+      )
+    );
+  ] in
+  let t = Sys.time () in
+  let str = JSON.string_of_doc ~fmt:JSON.Indented doc in
+  Printf.eprintf "JSON: serialized %d KB in %.3fs\n"
+    (String.length str / 1024) (Sys.time () -. t);
+  let escaped = String.make 1000 'x' ^ "\\t\\\"quoted\\\"\\n" in
+  let expected =
+    Printf.sprintf "{\n  \"files\": [\n    {\n      \"name\": \"%s\",\n      \"size\": 0\n    },\n" escaped in
+  assert_equal_string expected (String.sub str 0 (String.length expected))
@@ -0,0 +1,154 @@
+/* libguestfs OCaml tools common code
+ * Copyright (C) 2025 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Compute several checksums of a file in a single pass, using the
+ * checksum functions from GLib.
+ *
+ * This is only used when more than one checksum is wanted.  For a
+ * single checksum F<checksums.ml> runs the coreutils tool instead,
+ * which is slightly faster.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include <caml/alloc.h>
+#include <caml/fail.h>
+#include <caml/memory.h>
+#include <caml/mlvalues.h>
+#include <caml/signals.h>
+#include <caml/unixsupport.h>
+
+#include "guestfs-utils.h"
+
+/* Large reads keep the number of system calls down, while still
+ * fitting in the cache so the data is only read from memory once
+ * however many checksums are computed.
+ */
+#define BUFFER_SIZE (4 * 1024 * 1024)
+
+value guestfs_int_mllib_compute_checksums (value fdv, value typesv);
+
+static int
+checksum_type_of_string (const char *type, GChecksumType *r)
+{
+  if (STREQ (type, "sha1"))
+    *r = G_CHECKSUM_SHA1;
+  else if (STREQ (type, "sha256"))
+    *r = G_CHECKSUM_SHA256;
+  else if (STREQ (type, "sha512"))
+    *r = G_CHECKSUM_SHA512;
+  else
+    return -1;
+  return 0;
+}
+
+struct checksums {
+  GChecksum **csums;
+  size_t n;
+};
+
+static void
+free_checksums (struct checksums *c)
+{
+  size_t i;
+
+  for (i = 0; i < c->n; ++i)
+    if (c->csums[i])
+      g_checksum_free (c->csums[i]);
+  free (c->csums);
+}
+
+/* Callback from read_file_chunks. */
+static int
+update_checksums (const char *buf, size_t len, void *opaque)
+{
+  struct checksums *c = opaque;
+  size_t i;
+
+  for (i = 0; i < c->n; ++i)
+    g_checksum_update (c->csums[i], (const guchar *) buf, len);
+  return 0;
+}
+
+/* Read the file descriptor until the end, and return the checksums
+ * of the requested types (as lowercase hex strings) in the same
+ * order as the types.
+ */
+value
+guestfs_int_mllib_compute_checksums (value fdv, value typesv)
+{
+  CAMLparam2 (fdv, typesv);
+  CAMLlocal3 (rv, v, consv);
+  struct checksums c = { .n = 0 };
+  GChecksumType type;
+  char filename[64];
+  size_t i;
+  value l;
+  int r, err;
+
+  for (l = typesv; l != Val_emptylist; l = Field (l, 1))
+    c.n++;
+
+  c.csums = calloc (c.n, sizeof *c.csums);
+  if (c.csums == NULL)
+    caml_raise_out_of_memory ();
+  for (l = typesv, i = 0; l != Val_emptylist; l = Field (l, 1), ++i) {
+    if (checksum_type_of_string (String_val (Field (l, 0)), &type) == -1) {
+      free_checksums (&c);
+      caml_invalid_argument (String_val (Field (l, 0)));
+    }
+    c.csums[i] = g_checksum_new (type);
+  }
+
+  /* The descriptor may be a file or a pipe from tar.  The file is
+   * often used right after it is checked (eg. a template), so leave
+   * it in the page cache.
+   */
+  snprintf (filename, sizeof filename, "/dev/fd/%d", Int_val (fdv));
+
+  caml_enter_blocking_section ();
+  r = read_file_chunks (filename, BUFFER_SIZE, 0, update_checksums, &c);
+  err = errno;
+  caml_leave_blocking_section ();
+
+  if (r == -1) {
+    free_checksums (&c);
+    caml_unix_error (err, (char *) "read", Nothing);
+  }
+
+  /* Build the result list backwards. */
+  rv = Val_emptylist;
+  for (i = c.n; i-- > 0; ) {
+    v = caml_copy_string (g_checksum_get_string (c.csums[i]));
+    consv = caml_alloc (2, 0);
+    Store_field (consv, 0, v);
+    Store_field (consv, 1, rv);
+    rv = consv;
+  }
+  free_checksums (&c);
+
+  CAMLreturn (rv);
+}
@@ -49,7 +49,11 @@ let of_string csum_type csum_value =
   | "sha512" -> SHA512 csum_value
   | _ -> invalid_arg csum_type
 
-let compute_checksum csum_type ?tar filename =
+external c_compute_checksums : Unix.file_descr -> string list -> string list =
+  "guestfs_int_mllib_compute_checksums"
+
+(* Run the coreutils tool, for a single checksum. *)
+let compute_checksum_external csum_type ?tar filename =
   let prog =
     match csum_type with
     | "sha1" -> "sha1sum"
@@ -70,8 +74,46 @@ let compute_checksum csum_type ?tar filename =
   | [] ->
     error (f_"%s did not return any output") prog
   | line :: _ ->
-    let csum_str = fst (String.split " " line) in
-    of_string csum_type csum_str
+    fst (String.split " " line)
+
+let compute_checksums csum_types ?tar filename =
+  List.iter (
+    function
+    | "sha1" | "sha256" | "sha512" -> ()
+    | csum_type -> error (f_"unhandled checksum type ‘%s’") csum_type
+  ) csum_types;
+  let csums =
+    match csum_types, tar with
+    | [], _ -> []
+    | [csum_type], _ ->
+       (* The coreutils tools are slightly faster than GLib for a
+        * single checksum, so only read the file in-process when
+        * that saves reading it more than once.
+        *)
+       [compute_checksum_external csum_type ?tar filename]
+    | _, None ->
+       with_openfile filename [Unix.O_RDONLY] 0 (
+         fun fd -> c_compute_checksums fd csum_types
+       )
+    | _, Some tar ->
+       let cmd = sprintf "tar xOf %s %s" (quote tar) (quote filename) in
+       debug "compute_checksums: %s" cmd;
+       let chan = Unix.open_process_in cmd in
+       let csums =
+         try c_compute_checksums (Unix.descr_of_in_channel chan) csum_types
+         with exn -> ignore (Unix.close_process_in chan); raise exn in
+       (match Unix.close_process_in chan with
+        | Unix.WEXITED 0 -> ()
+        | Unix.WEXITED i ->
+           error (f_"external command ‘%s’ exited with error %d") cmd i
+        | Unix.WSIGNALED i | Unix.WSTOPPED i ->
+           error (f_"external command ‘%s’ killed by signal %d") cmd i
+       );
+       csums in
+  List.map2 of_string csum_types csums
+
+let compute_checksum csum_type ?tar filename =
+  List.hd (compute_checksums [csum_type] ?tar filename)
 
 (* Check if the direct file exists or if it exists in the tarball. *)
 let file_exists ?tar filename =
@@ -82,22 +124,22 @@ let file_exists ?tar filename =
        sprintf "tar tf %s %s >/dev/null 2>&1" (quote tar) (quote filename) in
      Sys.command cmd = 0
 
-let verify_checksum csum ?tar filename =
-  if not (file_exists ?tar filename) then
-    Missing_file
-  else (
-    let csum_type = string_of_csum_t csum in
-    let csum_actual = compute_checksum csum_type ?tar filename in
-    if csum = csum_actual then
-      Good_checksum
-    else
-      Mismatched_checksum (csum, string_of_csum csum_actual)
-  )
+let verify_checksums checksums ?tar filename =
+  match checksums with
+  | [] -> Good_checksum
+  | _ when not (file_exists ?tar filename) -> Missing_file
+  | _ ->
+     (* Compute all the checksums in a single pass over the file. *)
+     let csum_types = List.map string_of_csum_t checksums in
+     let actuals = compute_checksums csum_types ?tar filename in
+     let rec loop = function
+       | [], [] -> Good_checksum
+       | csum :: csums, actual :: actuals ->
+          if csum = actual then loop (csums, actuals)
+          else Mismatched_checksum (csum, string_of_csum actual)
+       | _ -> assert false
+     in
+     loop (checksums, actuals)
 
-let verify_checksums checksums filename =
-  List.fold_left (
-    fun acc c ->
-      match acc with
-      | Good_checksum -> verify_checksum c filename
-      | (Mismatched_checksum _|Missing_file) as acc -> acc
-  ) Good_checksum checksums
+let verify_checksum csum ?tar filename =
+  verify_checksums [csum] ?tar filename
@@ -40,11 +40,16 @@ val verify_checksum : csum_t -> ?tar:string -> string -> csum_result
     When optional [tar] is used it is path to uncompressed tar archive
     and the [filename] is a path in the tar archive. *)
 
-val verify_checksums : csum_t list -> string -> csum_result
+val verify_checksums : csum_t list -> ?tar:string -> string -> csum_result
 (** Verify all the checksums of the file.
 
+    The file is only read once, however many checksums are listed.
+
     If any checksum fails, the first failure (only) is returned in
-    {!csum_result}. *)
+    {!csum_result}.
+
+    When optional [tar] is used it is path to uncompressed tar archive
+    and the [filename] is a path in the tar archive. *)
 
 val string_of_csum_t : csum_t -> string
 (** Return a string representation of the checksum type. *)
@@ -60,3 +65,11 @@ val compute_checksum : string -> ?tar:string -> string -> csum_t
 
     When optional [tar] is used it is path to uncompressed tar archive
     and the [filename] is a path in the tar archive. *)
+
+val compute_checksums : string list -> ?tar:string -> string -> csum_t list
+(** [compute_checksums types filename] computes checksums of the
+    file for each of the [types], reading the file only once.  The
+    checksums are returned in the same order as the [types].
+
+    When optional [tar] is used it is path to uncompressed tar archive
+    and the [filename] is a path in the tar archive. *)
@@ -0,0 +1,105 @@
+(* Test checksum functions.
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *)
+
+(* This file tests the Checksums module. *)
+
+open Printf
+
+open Std_utils
+open Checksums
+
+(* Known test vectors from FIPS 180-2. *)
+let vectors = [
+  "", [
+    "sha1", "da39a3ee5e6b4b0d3255bfef95601890afd80709";
+    "sha256",
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+    "sha512",
+    "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce\
+     47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e";
+  ];
+  "abc", [
+    "sha1", "a9993e364706816aba3e25717850c26c9cd0d89d";
+    "sha256",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    "sha512",
+    "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a\
+     2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f";
+  ];
+  String.make 1_000_000 'a', [
+    "sha1", "34aa973cd4c4daa4f61eeb2bdbad27316534016f";
+    "sha256",
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+    "sha512",
+    "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb\
+     de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b";
+  ];
+]
+
+let () =
+  List.iter (
+    fun (data, csums) ->
+      let file, chan = Filename.open_temp_file "checksums" ".data" in
+      On_exit.unlink file;
+      output_string chan data;
+      close_out chan;
+
+      (* The same file in a tarball. *)
+      let tar = Filename.temp_file "checksums" ".tar" in
+      On_exit.unlink tar;
+      let name = Filename.basename file in
+      let cmd = sprintf "tar cf %s -C %s %s"
+                        (quote tar) (quote (Filename.dirname file))
+                        (quote name) in
+      if Sys.command cmd <> 0 then failwithf "%s: command failed" cmd;
+
+      let types = List.map fst csums in
+      let expected = List.map (fun (t, v) -> of_string t v) csums in
+
+      (* Each checksum on its own, which runs the external tools. *)
+      List.iter2 (
+        fun t csum ->
+          assert (compute_checksum t file = csum);
+          assert (compute_checksum t ~tar name = csum)
+      ) types expected;
+
+      (* All of them at once, in both orders, which reads the data
+       * in-process.
+       *)
+      assert (compute_checksums types file = expected);
+      assert (compute_checksums types ~tar name = expected);
+      assert (compute_checksums (List.rev types) file = List.rev expected);
+      assert (compute_checksums (List.rev types) ~tar name
+              = List.rev expected);
+
+      assert (verify_checksums expected file = Good_checksum);
+      assert (verify_checksums expected ~tar name = Good_checksum);
+      assert (verify_checksum (List.hd expected) ~tar name = Good_checksum);
+
+      (* Only the first mismatch is returned. *)
+      let bad = SHA256 (String.make 64 '0') in
+      let actual = string_of_csum (List.nth expected 1) in
+      assert (verify_checksums [List.hd expected; bad] file
+              = Mismatched_checksum (bad, actual));
+      assert (verify_checksums [bad; bad] ~tar name
+              = Mismatched_checksum (bad, actual));
+
+      assert (verify_checksums expected (file ^ ".missing") = Missing_file);
+      assert (verify_checksums expected ~tar (name ^ ".missing")
+              = Missing_file)
+  ) vectors
@@ -28,9 +28,85 @@ type ('name, 'value, 'task) plan = ('name, 'value, 'task) transition list
 type ('name, 'value, 'task) transitions_function =
   ('name, 'value) tags -> ('task * int * ('name, 'value) tags) list
 
-let plan ?(max_depth = 10) transitions itags ~must ~must_not =
+type stats = {
+  expanded : int;
+  generated : int;
+  duplicates : int;
+  max_frontier : int;
+}
+
+(* A binary min-heap of search nodes, ordered by priority. *)
+module Heap = struct
+  type 'a t = {
+    mutable arr : (int * int * int * 'a) array; (* prio, depth, seq, node *)
+    mutable size : int;
+  }
+
+  let create () = { arr = [||]; size = 0 }
+
+  let is_empty h = h.size = 0
+
+  let before ((p1 : int), (d1 : int), (s1 : int), _) (p2, d2, s2, _) =
+    p1 < p2 || (p1 = p2 && (d1 < d2 || (d1 = d2 && s1 < s2)))
+
+  let push h x =
+    if h.size = Array.length h.arr then (
+      let arr = Array.make (max 16 (2 * h.size)) x in
+      Array.blit h.arr 0 arr 0 h.size;
+      h.arr <- arr
+    );
+    let rec up i =
+      let parent = (i - 1) / 2 in
+      if i > 0 && before x h.arr.(parent) then (
+        h.arr.(i) <- h.arr.(parent);
+        up parent
+      )
+      else h.arr.(i) <- x
+    in
+    up h.size;
+    h.size <- h.size + 1
+
+  let pop h =
+    let top = h.arr.(0) in
+    h.size <- h.size - 1;
+    if h.size > 0 then (
+      let x = h.arr.(h.size) in
+      let rec down i =
+        let l = 2 * i + 1 in
+        if l >= h.size then h.arr.(i) <- x
+        else (
+          let r = l + 1 in
+          let c =
+            if r < h.size && before h.arr.(r) h.arr.(l) then r else l in
+          if before h.arr.(c) x then (
+            h.arr.(i) <- h.arr.(c);
+            down c
+          )
+          else h.arr.(i) <- x
+        )
+      in
+      down 0
+    );
+    top
+end
+
+(* Tags are assoc lists, so the same state can be written in
+ * different orders, or with shadowed bindings.  Reduce it to a
+ * canonical form which can be used as a hash key.
+ *)
+let canonical_tags tags =
+  let rec loop seen acc = function
+    | [] -> acc
+    | (name, _ as tag) :: tags ->
+       if List.mem name seen then loop seen acc tags
+       else loop (name :: seen) (tag :: acc) tags
+  in
+  List.sort compare (loop [] [] tags)
+
+let plan_with_stats ?(max_depth = 10) ?(heuristic = fun _ -> 0)
+                    transitions itags ~must ~must_not =
   (* Do the given output tags match the finish condition? *)
-  let finished (otags, _, _) =
+  let finished otags =
     let must =
       (* All tags from the MUST list must be present with the given values. *)
       List.for_all (
@@ -48,36 +124,79 @@ let plan ?(max_depth = 10) transitions itags ~must ~must_not =
     must && must_not
   in
 
-  (* Breadth-first search. *)
-  let rec search depth paths =
-    if depth >= max_depth then None
+  (* Best-first search (A*, or Dijkstra's algorithm if there is no
+   * heuristic), ordered by weight so far plus the heuristic.  Ties
+   * are broken by the number of transitions, then by the order in
+   * which the paths were found.
+   *
+   * Each node in the frontier is (tags, weight, depth, reversed path).
+   * The start node is never the goal, since a plan must contain at
+   * least one transition.
+   *
+   * [labels] maps each canonical state that has been expanded to the
+   * (weight, depth) pairs it was expanded with.  A node is skipped
+   * if the same state has already been expanded with no more weight
+   * and no more transitions, since it cannot lead to a better plan.
+   *)
+  let frontier = Heap.create () in
+  let labels = Hashtbl.create 63 in
+  let seq = ref 0 in
+  let expanded = ref 0 and generated = ref 0 and duplicates = ref 0 in
+  let max_frontier = ref 0 in
+
+  let push ((tags, weight, depth, _) as node) =
+    Heap.push frontier (weight + heuristic tags, depth, !seq, node);
+    incr seq;
+    max_frontier := max !max_frontier frontier.Heap.size
+  in
+
+  let dominated key weight depth =
+    let ls = try Hashtbl.find labels key with Not_found -> [] in
+    if List.exists (fun (w, d) -> w <= weight && d <= depth) ls then true
     else (
-      let paths =
-        List.map (
-          fun (itags, weight, preds) ->
-            let ts = transitions itags in
-            List.map (fun (task, w, otags) ->
-              otags, weight + w, (itags, task, otags) :: preds
-            ) ts
-        ) paths in
-      let paths = List.flatten paths in
-
-      (* Did any path reach the finish?  If so, pick the path with the
-       * smallest weight and we're done.
-       *)
-      let finished_paths = List.filter finished paths in
-      let finished_paths =
-        List.sort (fun (_,w1,_) (_,w2,_) -> compare w1 w2) finished_paths in
-      match finished_paths with
-      | [] ->
-        (* No path reached the finish, so go deeper. *)
-        search (depth+1) paths
-      | (_, _, ret) :: _ ->
-        (* Return the shortest path, but we have to reverse it because
-         * we built it backwards.
-         *)
-        Some (List.rev ret)
+      let ls = List.filter (fun (w, d) -> w < weight || d < depth) ls in
+      Hashtbl.replace labels key ((weight, depth) :: ls);
+      false
     )
   in
 
-  search 0 [itags, 0, []]
+  let rec search () =
+    if Heap.is_empty frontier then None
+    else (
+      let _, _, _, (tags, weight, depth, path) = Heap.pop frontier in
+      if depth > 0 && finished tags then
+        (* We have to reverse the path because we built it backwards. *)
+        Some (List.rev path)
+      else if depth > 0 && dominated (canonical_tags tags) weight depth then (
+        incr duplicates;
+        search ()
+      )
+      else (
+        if depth < max_depth then (
+          incr expanded;
+          List.iter (
+            fun (task, w, otags) ->
+              if w < 0 then
+                invalid_arg "Planner.plan: negative transition weight";
+              incr generated;
+              push (otags, weight + w, depth + 1,
+                    (tags, task, otags) :: path)
+          ) (transitions tags)
+        );
+        search ()
+      )
+    )
+  in
+
+  push (itags, 0, 0, []);
+  let ret = search () in
+  let stats = {
+    expanded = !expanded;
+    generated = !generated;
+    duplicates = !duplicates;
+    max_frontier = !max_frontier;
+  } in
+  ret, stats
+
+let plan ?max_depth ?heuristic transitions itags ~must ~must_not =
+  fst (plan_with_stats ?max_depth ?heuristic transitions itags ~must ~must_not)
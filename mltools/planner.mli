@@ -35,10 +35,14 @@
 
     The returned plan is a list of transitions.
 
-    The implementation is a simple breadth-first search of the tree of
-    states (each edge in the tree is a transition).  It doesn't work
-    very hard to optimize the weights, so the returned plan is
-    possible, but might not be optimal. *)
+    The implementation is a best-first search (Dijkstra's algorithm,
+    or A* if a heuristic is given) over the states, so the returned
+    plan has the smallest total weight of all plans within the maximum
+    depth.  Among plans with the same weight, the one with the fewest
+    transitions is returned.  States reached by more than one path are
+    only expanded again if the new path is better, so the time taken
+    grows with the number of distinct states rather than the number of
+    paths. *)
 
 type ('name, 'value) tag = 'name * 'value
 (** A single tag. *)
@@ -64,7 +68,9 @@ type ('name, 'value, 'task) transitions_function =
     with a weight (higher number = more expensive) for each and the
     resulting set of tags after that transition. *)
 
-val plan : ?max_depth:int -> ('name, 'value, 'task) transitions_function ->
+val plan : ?max_depth:int ->
+           ?heuristic:(('name, 'value) tags -> int) ->
+           ('name, 'value, 'task) transitions_function ->
            ('name, 'value) tags ->
            must: ('name, 'value) tags -> must_not: ('name, 'value) tags ->
            ('name, 'value, 'task) plan option
@@ -77,6 +83,31 @@ val plan : ?max_depth:int -> ('name, 'value, 'task) transitions_function ->
     The goal is passed in as a pair of lists: tags that MUST appear
     and tags that MUST NOT appear.
 
+    Weights must not be negative.  The optional [heuristic] function
+    returns an estimate of the weight still needed to reach the goal
+    from a set of tags.  It can be used to speed up the search, but it
+    must never overestimate the weight, otherwise the plan returned
+    might not be optimal.  The default is [0] for every state.
+
     The returned value is a {!plan}.
 
     Returns [None] if no plan was found within [max_depth] transitions. *)
+
+type stats = {
+  expanded : int;          (** States whose transitions were examined. *)
+  generated : int;         (** Transitions examined. *)
+  duplicates : int;        (** States skipped because they had already
+                               been reached by a better path. *)
+  max_frontier : int;      (** Peak number of paths waiting to be
+                               examined. *)
+}
+(** Statistics about the search done by {!plan_with_stats}. *)
+
+val plan_with_stats : ?max_depth:int ->
+                      ?heuristic:(('name, 'value) tags -> int) ->
+                      ('name, 'value, 'task) transitions_function ->
+                      ('name, 'value) tags ->
+                      must: ('name, 'value) tags ->
+                      must_not: ('name, 'value) tags ->
+                      ('name, 'value, 'task) plan option * stats
+(** Same as {!plan}, but also returns statistics about the search. *)
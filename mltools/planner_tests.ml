@@ -0,0 +1,108 @@
+(* Utilities for OCaml tools in libguestfs.
+ * Copyright (C) 2025 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *)
+
+(* This file tests the Planner module. *)
+
+open Printf
+
+open Std_utils
+
+let assert_equal ~printer a b =
+  if a <> b then
+    failwithf "FAIL: %s <> %s" (printer a) (printer b)
+let assert_equal_int = assert_equal ~printer:string_of_int
+let assert_equal_stringlist =
+  assert_equal ~printer:(fun x -> "(" ^ String.concat "," x ^ ")")
+
+let assert_bool name b =
+  if not b then failwithf "FAIL: %s" name
+
+let tasks = function
+  | None -> failwith "FAIL: no plan found"
+  | Some plan -> List.map (fun (_, task, _) -> task) plan
+
+(* A small conversion problem, similar to virt-builder: the image
+ * can be uncompressed (cheaply but slowly copied) or converted
+ * directly, and may need resizing.
+ *)
+let transitions tags =
+  let get name = try List.assoc name tags with Not_found -> "" in
+  let ret = ref [] in
+  if get "compressed" = "yes" then (
+    List.push_front ("uncompress", 5, ("compressed", "no") :: tags) ret;
+    List.push_front ("uncompress+convert", 20,
+                     ("format", "qcow2") :: ("compressed", "no") :: tags) ret
+  )
+  else (
+    if get "format" = "raw" then
+      List.push_front ("convert", 10, ("format", "qcow2") :: tags) ret;
+    if get "size" = "small" then
+      List.push_front ("resize", 3, ("size", "big") :: tags) ret;
+    List.push_front ("copy", 1, tags) ret
+  );
+  !ret
+
+let itags = [ "compressed", "yes"; "format", "raw"; "size", "small" ]
+
+(* The cheapest plan is not the one with the fewest steps. *)
+let () =
+  let must = [ "format", "qcow2"; "size", "big" ] in
+  assert_equal_stringlist ["uncompress"; "resize"; "convert"]
+    (tasks (Planner.plan transitions itags ~must ~must_not:[]));
+
+  (* With an admissible heuristic, the plan has the same weight. *)
+  let heuristic tags =
+    (if List.assoc "format" tags = "raw" then 10 else 0) +
+    (if List.assoc "size" tags = "small" then 3 else 0) in
+  assert_equal_stringlist ["uncompress"; "resize"; "convert"]
+    (tasks (Planner.plan ~heuristic transitions itags ~must ~must_not:[]));
+
+  (* max_depth limits the number of transitions. *)
+  assert_equal_stringlist ["uncompress+convert"; "resize"]
+    (tasks (Planner.plan ~max_depth:2 transitions itags ~must ~must_not:[]));
+  assert_bool "no plan"
+    (Planner.plan ~max_depth:1 transitions itags ~must ~must_not:[] = None)
+
+(* A plan always contains at least one transition, even if the
+ * input tags already match the goal.
+ *)
+let () =
+  let itags = [ "compressed", "no"; "format", "qcow2"; "size", "big" ] in
+  assert_equal_stringlist ["copy"]
+    (tasks (Planner.plan transitions itags
+              ~must:["format", "qcow2"] ~must_not:["compressed", "yes"]))
+
+(* States which are reached along many paths are expanded once.
+ * Here there are 2^depth paths but only depth+1 distinct states.
+ *)
+let () =
+  let transitions tags =
+    let n = int_of_string (List.assoc "n" tags) in
+    let next = ("n", string_of_int (n+1)) :: tags in
+    [ "a", 1, next; "b", 1, next ]
+  in
+  let depth = 40 in
+  let plan, stats =
+    Planner.plan_with_stats ~max_depth:depth transitions ["n", "0"]
+      ~must:["n", string_of_int depth] ~must_not:[] in
+  assert_equal_int depth (List.length (tasks plan));
+  assert_bool "expanded" (stats.Planner.expanded <= depth);
+  eprintf "planner: expanded %d, generated %d, duplicates %d, \
+           max frontier %d\n"
+    stats.Planner.expanded stats.Planner.generated
+    stats.Planner.duplicates stats.Planner.max_frontier
@@ -0,0 +1,79 @@
+/* libguestfs OCaml tools common code
+ * Copyright (C) 2013-2025 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <caml/alloc.h>
+#include <caml/memory.h>
+#include <caml/mlvalues.h>
+#include <caml/unixsupport.h>
+
+#include "guestfs-utils.h"
+
+extern value guestfs_int_mllib_urandom_bytes (value nv);
+extern value guestfs_int_mllib_urandom_uniform (value nv, value charsv);
+
+/* Both functions write straight into a freshly allocated OCaml
+ * string, so no OCaml allocation can happen while it is being
+ * filled.
+ */
+value
+guestfs_int_mllib_urandom_bytes (value nv)
+{
+  CAMLparam1 (nv);
+  CAMLlocal1 (rv);
+  const size_t n = Int_val (nv);
+
+  rv = caml_alloc_string (n);
+  if (guestfs_int_random_bytes (Bytes_val (rv), n) == -1)
+    caml_unix_error (errno, (char *) "getrandom", Nothing);
+
+  CAMLreturn (rv);
+}
+
+value
+guestfs_int_mllib_urandom_uniform (value nv, value charsv)
+{
+  CAMLparam2 (nv, charsv);
+  CAMLlocal1 (rv);
+  const size_t n = Int_val (nv);
+  char *buf;
+
+  /* guestfs_int_random_uniform adds a trailing \0, so generate the
+   * string into a temporary buffer.
+   */
+  buf = malloc (n+1);
+  if (buf == NULL)
+    caml_raise_out_of_memory ();
+  if (guestfs_int_random_uniform (buf, n, String_val (charsv),
+                                  caml_string_length (charsv)) == -1) {
+    const int err = errno;
+    free (buf);
+    caml_unix_error (err, (char *) "getrandom", Nothing);
+  }
+  rv = caml_alloc_initialized_string (n, buf);
+  memset (buf, 0, n);
+  free (buf);
+
+  CAMLreturn (rv);
+}
@@ -16,57 +16,33 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  *)
 
-(* Read and return N bytes (only) from /dev/urandom.
+(* Return random bytes from the kernel.
  *
- * As pointed out by Edwin Török, previous versions of this had a big
+ * As pointed out by Edwin Török, early versions of this had a big
  * problem.  They used the OCaml buffered I/O library which would read
- * a lot more data than requested.  This version uses unbuffered I/O
- * from the Unix module.
+ * a lot more data than requested from /dev/urandom.  Later versions
+ * used unbuffered I/O from the Unix module, but read a single byte
+ * per system call.
+ *
+ * This is now implemented by the entropy pool in common/utils, which
+ * uses getrandom(2) and hands out bytes from a small per-thread pool
+ * which is wiped as it is consumed.
  *)
 
-open Unix
-
-open Std_utils
-open Tools_utils
-open Common_gettext.Gettext
-
-let read_byte fd =
-  let b = Bytes.make 1 ' ' in
-  fun () ->
-    if read fd b 0 1 = 0 then
-      error (f_"unexpected end of file while reading /dev/urandom");
-    Char.code (Bytes.unsafe_get b 0)
+external c_urandom_bytes : int -> string = "guestfs_int_mllib_urandom_bytes"
+external c_urandom_uniform : int -> string -> string = "guestfs_int_mllib_urandom_uniform"
 
 let urandom_bytes n =
   assert (n > 0);
-  let ret = Bytes.make n ' ' in
-  with_openfile "/dev/urandom" [O_RDONLY; O_CLOEXEC] 0 (
-    fun fd ->
-      for i = 0 to n-1 do
-        Bytes.unsafe_set ret i (Char.chr (read_byte fd ()))
-      done
-  );
-  Bytes.to_string ret
+  c_urandom_bytes n
 
-(* Return a random number uniformly distributed in [0, upper_bound)
- * avoiding modulo bias.
+(* The C code returns characters uniformly distributed in [chars]
+ * avoiding modulo bias (random bytes in the range [0, 256 mod
+ * nr_chars) are rejected).
  *)
-let rec uniform_random read upper_bound =
-  let c = read () in
-  if c >= 256 mod upper_bound then c mod upper_bound
-  else uniform_random read upper_bound
-
 let urandom_uniform n chars =
   assert (n > 0);
   let nr_chars = String.length chars in
   assert (nr_chars > 0);
-
-  let ret = Bytes.make n ' ' in
-  with_openfile "/dev/urandom" [O_RDONLY; O_CLOEXEC] 0 (
-    fun fd ->
-      for i = 0 to n-1 do
-        Bytes.unsafe_set ret i
-                         (chars.[uniform_random (read_byte fd) nr_chars])
-      done
-  );
-  Bytes.to_string ret
+  assert (nr_chars <= 256);
+  c_urandom_uniform n chars
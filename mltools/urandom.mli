@@ -16,11 +16,13 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  *)
 
-(** Read and return N bytes (only) from /dev/urandom. *)
+(** Return random bytes from the kernel (getrandom(2), falling back
+    to /dev/urandom). *)
 
 val urandom_bytes : int -> string
-(** Read N bytes from /dev/urandom and return it as a binary string. *)
+(** Return N random bytes as a binary string. *)
 
 val urandom_uniform : int -> string -> string
 (** [urandom_uniform n chars] returns [n] bytes, uniformly
-    distributed from the sets of characters [chars]. *)
+    distributed from the sets of characters [chars].  [chars]
+    must contain between 1 and 256 characters. *)
@@ -31,8 +31,13 @@
 #include <error.h>
 #include <assert.h>
 #include <errno.h>
+#include <unistd.h>
+
+#include <pthread.h>
 
 #include "c-ctype.h"
+#include "getprogname.h"
+#include "ignore-value.h"
 
 #include "guestfs.h"
 
@@ -117,21 +122,414 @@ make_mapname (const char *device)
   return mapname;
 }
 
+/**
+ * The key hint cache (I<--key-hint-cache>) remembers which key in the
+ * key store unlocked each LUKS UUID, so that on later runs that key
+ * can be tried first.  Every failed key costs a full key derivation
+ * in the appliance, which can take seconds.
+ *
+ * The file contains one line per UUID:
+ *
+ *  UUID <tab> INDEX <tab> TYPE <tab> ID
+ *
+ * where C<INDEX> is the index of the key in the key store, and
+ * C<TYPE> and C<ID> are used to check that the key at that index is
+ * still the same selector.  No key material is stored.  A stale or
+ * wrong hint only changes the order in which keys are tried.
+ */
+struct key_hint {
+  char *uuid;
+  size_t key_index;
+};
+
+struct key_hints {
+  struct key_hint *hints;
+  size_t nr_hints;
+  bool dirty;                   /* needs to be written back */
+};
+
+static const char *
+key_type_name (const struct key_store_key *key)
+{
+  switch (key->type) {
+  case key_string: return "key";
+  case key_file: return "file";
+  case key_clevis: return "clevis";
+  }
+  abort ();
+}
+
+static struct key_hint *
+find_hint (struct key_hints *hints, const char *uuid)
+{
+  size_t i;
+
+  for (i = 0; i < hints->nr_hints; ++i)
+    if (STREQ (hints->hints[i].uuid, uuid))
+      return &hints->hints[i];
+  return NULL;
+}
+
+static void
+set_hint (struct key_hints *hints, const char *uuid, size_t key_index)
+{
+  struct key_hint *hint, *new_hints;
+
+  hint = find_hint (hints, uuid);
+  if (hint != NULL) {
+    if (hint->key_index != key_index) {
+      hint->key_index = key_index;
+      hints->dirty = true;
+    }
+    return;
+  }
+
+  new_hints = realloc (hints->hints,
+                       (hints->nr_hints + 1) * sizeof (struct key_hint));
+  if (new_hints == NULL)
+    error (EXIT_FAILURE, errno, "realloc");
+  hints->hints = new_hints;
+  hint = &hints->hints[hints->nr_hints];
+  hint->uuid = strdup (uuid);
+  if (hint->uuid == NULL)
+    error (EXIT_FAILURE, errno, "strdup");
+  hint->key_index = key_index;
+  hints->nr_hints++;
+  hints->dirty = true;
+}
+
+/* Read the hint cache, ignoring entries which don't match the current
+ * key store.  A missing file is not an error.
+ */
+static void
+read_key_hints (const struct key_store *ks, struct key_hints *hints)
+{
+  FILE *fp;
+  CLEANUP_FREE char *line = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+
+  fp = fopen (ks->hint_cache, "re");
+  if (fp == NULL) {
+    if (errno != ENOENT)
+      fprintf (stderr, _("%s: warning: %s: %m (ignored)\n"),
+               getprogname (), ks->hint_cache);
+    return;
+  }
+
+  while ((len = getline (&line, &allocsize, fp)) != -1) {
+    CLEANUP_FREE_STRING_LIST char **fields = NULL;
+    const struct key_store_key *key;
+    unsigned long idx;
+    char *end;
+
+    if (len > 0 && line[len-1] == '\n')
+      line[len-1] = '\0';
+
+    fields = guestfs_int_split_string ('\t', line);
+    if (fields == NULL)
+      error (EXIT_FAILURE, errno, "guestfs_int_split_string");
+    if (guestfs_int_count_strings (fields) != 4)
+      continue;
+
+    errno = 0;
+    idx = strtoul (fields[1], &end, 10);
+    if (errno != 0 || end == fields[1] || *end != '\0' || idx >= ks->nr_keys)
+      continue;
+    key = &ks->keys[idx];
+    if (STRNEQ (fields[2], key_type_name (key)) || STRNEQ (fields[3], key->id))
+      continue;
+
+    set_hint (hints, fields[0], idx);
+  }
+
+  fclose (fp);
+  hints->dirty = false;
+}
+
+/* Write the hint cache back, if it changed.  The file is replaced
+ * atomically so concurrent runs never see a partial file.  Failures
+ * are only warnings: the cache is an optimization.
+ */
+static void
+write_key_hints (const struct key_store *ks, const struct key_hints *hints)
+{
+  CLEANUP_FREE char *tmpfile = NULL;
+  FILE *fp;
+  size_t i;
+  int fd;
+
+  if (!hints->dirty)
+    return;
+
+  if (asprintf (&tmpfile, "%s.XXXXXX", ks->hint_cache) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+  fd = mkstemp (tmpfile);
+  if (fd == -1)
+    goto warn;
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    close (fd);
+    unlink (tmpfile);
+    goto warn;
+  }
+
+  for (i = 0; i < hints->nr_hints; ++i) {
+    const struct key_hint *hint = &hints->hints[i];
+    const struct key_store_key *key = &ks->keys[hint->key_index];
+
+    fprintf (fp, "%s\t%zu\t%s\t%s\n",
+             hint->uuid, hint->key_index, key_type_name (key), key->id);
+  }
+
+  if (fclose (fp) == EOF || rename (tmpfile, ks->hint_cache) == -1) {
+    unlink (tmpfile);
+    goto warn;
+  }
+  return;
+
+ warn:
+  fprintf (stderr, _("%s: warning: could not write key hint cache %s: %m\n"),
+           getprogname (), ks->hint_cache);
+}
+
+static void
+free_key_hints (struct key_hints *hints)
+{
+  size_t i;
+
+  for (i = 0; i < hints->nr_hints; ++i)
+    free (hints->hints[i].uuid);
+  free (hints->hints);
+}
+
+/* Move keys[i] to the front of the list, keeping the order of the
+ * others.
+ */
+static void
+move_key_to_front (struct matching_key *keys, size_t i)
+{
+  struct matching_key tmp;
+
+  tmp = keys[i];
+  memmove (&keys[1], &keys[0], i * sizeof keys[0]);
+  keys[0] = tmp;
+}
+
+/* If there is a hint for this UUID, move the hinted key to the front
+ * of the list.  Returns true if a hinted key was found.
+ */
 static bool
-decrypt_mountables (guestfs_h *g, const char * const *mountables,
-                    struct key_store *ks)
+apply_hint (struct key_hints *hints, const char *uuid,
+            struct matching_key *keys, size_t nr_matches)
 {
-  bool decrypted_some = false;
-  const char * const *mnt_scan = mountables;
+  const struct key_hint *hint;
+  size_t i;
+
+  hint = find_hint (hints, uuid);
+  if (hint == NULL)
+    return false;
+
+  for (i = 0; i < nr_matches; ++i) {
+    if (keys[i].key_index == hint->key_index) {
+      move_key_to_front (keys, i);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* An encrypted device, and the keys to try on it. */
+struct crypt_device {
   const char *mountable;
+  char *uuid;
+  char *mapname;
+  struct matching_key *keys;
+  size_t nr_matches;
+  bool search;                  /* should be searched by the unlock threads */
+  size_t found;                 /* key found by the unlock threads, or -1 */
+};
 
-  while ((mountable = *mnt_scan++) != NULL) {
+/**
+ * When the key store has I<unlock workers> (see
+ * I<--key-unlock-workers>), devices that have several
+ * candidate keys are searched concurrently, each worker thread
+ * running its own appliance with the same disks added read-only.
+ * The daemon handles one request at a time, so this is the only way
+ * to run several key derivations at once.  Each worker opens and
+ * immediately closes the device read-only with each key until one
+ * works.  The main handle then only has to do one key derivation per
+ * device.
+ *
+ * This is only done when the disks are opened read-only, since qemu
+ * would not allow a second appliance to open disks which the main
+ * appliance has open for writing.  It is also only done for the
+ * devices visible before anything is decrypted: the worker
+ * appliances cannot see LVs on PVs which the main handle has just
+ * unlocked.
+ */
+struct unlock_queue {
+  pthread_mutex_t lock;         /* protects next_device */
+  size_t next_device;
+  struct crypt_device *devs;
+  size_t nr_devs;
+  const struct drv *drvs;
+  int trace, verbose;           /* flags from the main handle */
+};
+
+struct unlock_thread_data {
+  size_t thread_num;
+  struct unlock_queue *queue;
+};
+
+static struct crypt_device *
+take_next_device (struct unlock_queue *queue)
+{
+  struct crypt_device *dev = NULL;
+
+  ignore_value (pthread_mutex_lock (&queue->lock));
+  while (queue->next_device < queue->nr_devs) {
+    struct crypt_device *d = &queue->devs[queue->next_device++];
+    if (d->search) {
+      dev = d;
+      break;
+    }
+  }
+  ignore_value (pthread_mutex_unlock (&queue->lock));
+
+  return dev;
+}
+
+static void *
+unlock_thread (void *thread_data_vp)
+{
+  struct unlock_thread_data *thread_data = thread_data_vp;
+  struct unlock_queue *queue = thread_data->queue;
+  struct crypt_device *dev;
+  guestfs_h *g;
+  char id[64];
+
+  g = guestfs_create ();
+  if (g == NULL) {
+    perror ("guestfs_create");
+    return NULL;
+  }
+
+  snprintf (id, sizeof id, "unlock_thread_%zu", thread_data->thread_num);
+  guestfs_set_identifier (g, id);
+  guestfs_set_trace (g, queue->trace);
+  guestfs_set_verbose (g, queue->verbose);
+
+  /* If the appliance cannot be launched, the main handle will still
+   * try all the keys in turn.
+   */
+  if (add_drives_handle_noexit (g, queue->drvs) == -1 ||
+      guestfs_launch (g) == -1)
+    goto out;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  while ((dev = take_next_device (queue)) != NULL) {
+    size_t i;
+
+    for (i = 0; i < dev->nr_matches; ++i) {
+      if (guestfs_cryptsetup_open (g, dev->mountable, dev->keys[i].passphrase,
+                                   dev->mapname,
+                                   GUESTFS_CRYPTSETUP_OPEN_READONLY, 1,
+                                   -1) == 0) {
+        ignore_value (guestfs_cryptsetup_close (g, dev->mapname));
+        dev->found = i;
+        break;
+      }
+    }
+  }
+  guestfs_pop_error_handler (g);
+
+  ignore_value (guestfs_shutdown (g));
+ out:
+  guestfs_close (g);
+  return NULL;
+}
+
+static void
+search_keys_in_parallel (guestfs_h *g, struct key_store *ks,
+                         struct crypt_device *devs, size_t nr_devs)
+{
+  struct unlock_queue queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .devs = devs, .nr_devs = nr_devs,
+    .drvs = *ks->unlock_drvsp,
+    .trace = guestfs_get_trace (g),
+    .verbose = guestfs_get_verbose (g),
+  };
+  CLEANUP_FREE struct unlock_thread_data *thread_data = NULL;
+  CLEANUP_FREE pthread_t *threads = NULL;
+  size_t i, nr_jobs = 0, nr_threads;
+  int err;
+
+  for (i = 0; i < nr_devs; ++i)
+    if (devs[i].search)
+      nr_jobs++;
+  nr_threads = MIN (nr_jobs, ks->unlock_workers);
+  if (nr_threads == 0)
+    return;
+
+  if (queue.verbose)
+    fprintf (stderr, "%s: searching keys for %zu devices using %zu threads\n",
+             getprogname (), nr_jobs, nr_threads);
+
+  thread_data = malloc (sizeof (struct unlock_thread_data) * nr_threads);
+  threads = malloc (sizeof (pthread_t) * nr_threads);
+  if (thread_data == NULL || threads == NULL)
+    error (EXIT_FAILURE, errno, "malloc");
+
+  for (i = 0; i < nr_threads; ++i) {
+    thread_data[i].thread_num = i;
+    thread_data[i].queue = &queue;
+    err = pthread_create (&threads[i], NULL, unlock_thread, &thread_data[i]);
+    if (err != 0)
+      error (EXIT_FAILURE, err, "pthread_create [%zu]", i);
+  }
+
+  for (i = 0; i < nr_threads; ++i) {
+    err = pthread_join (threads[i], NULL);
+    if (err != 0)
+      error (EXIT_FAILURE, err, "pthread_join [%zu]", i);
+  }
+}
+
+/**
+ * Decrypt the encrypted devices in the list C<mountables>.  The type
+ * of each device is read with C<guestfs_vfs_type>, because
+ * C<guestfs_list_filesystems> does not report C<crypto_LUKS> or
+ * C<BitLocker> devices.
+ *
+ * If C<search> is true, the unlock workers (if any) are used to
+ * search for the keys.
+ */
+static bool
+decrypt_mountables (guestfs_h *g, const char * const *mountables,
+                    struct key_store *ks, struct key_hints *hints,
+                    bool search)
+{
+  CLEANUP_FREE struct crypt_device *devs = NULL;
+  size_t i, nr_devs = 0;
+  bool parallel;
+
+  parallel = search && ks && ks->unlock_workers > 0 && ks->unlock_drvsp &&
+    read_only;
+
+  devs = calloc (guestfs_int_count_strings ((char **) mountables),
+                 sizeof (struct crypt_device));
+  if (devs == NULL)
+    error (EXIT_FAILURE, errno, "calloc");
+
+  /* Find the encrypted devices and the keys to try on each one. */
+  for (i = 0; mountables[i] != NULL; ++i) {
+    const char *mountable = mountables[i];
     CLEANUP_FREE char *type = NULL;
-    CLEANUP_FREE char *uuid = NULL;
-    struct matching_key *keys;
-    size_t nr_matches;
-    CLEANUP_FREE char *mapname = NULL;
-    size_t scan;
+    struct crypt_device *dev;
+    bool hinted = false;
+    size_t j;
 
     type = guestfs_vfs_type (g, mountable);
     if (type == NULL)
@@ -140,86 +538,187 @@ decrypt_mountables (guestfs_h *g, const char * const *mountables,
     /* "cryptsetup luksUUID" cannot read a UUID on Windows BitLocker disks
      * (unclear if this is a limitation of the format or cryptsetup).
      */
-    if (STREQ (type, "crypto_LUKS")) {
-      uuid = guestfs_luks_uuid (g, mountable);
-    } else if (STRNEQ (type, "BitLocker"))
+    if (STRNEQ (type, "crypto_LUKS") && STRNEQ (type, "BitLocker"))
       continue;
 
+    dev = &devs[nr_devs++];
+    dev->mountable = mountable;
+    dev->found = (size_t)-1;
+    if (STREQ (type, "crypto_LUKS"))
+      dev->uuid = guestfs_luks_uuid (g, mountable);
+
     /* Grab the keys that we should try with this device, based on device name,
      * or UUID (if any).
      */
-    keys = get_keys (ks, mountable, uuid, &nr_matches);
-    assert (nr_matches > 0);
+    dev->keys = get_keys (ks, mountable, dev->uuid, &dev->nr_matches);
+    assert (dev->nr_matches > 0);
+    if (hints && dev->uuid)
+      hinted = apply_hint (hints, dev->uuid, dev->keys, dev->nr_matches);
 
     /* Generate a node name for the plaintext (decrypted) device node. */
-    if (uuid == NULL || asprintf (&mapname, "luks-%s", uuid) == -1)
-      mapname = make_mapname (mountable);
+    if (dev->uuid == NULL ||
+        asprintf (&dev->mapname, "luks-%s", dev->uuid) == -1)
+      dev->mapname = make_mapname (mountable);
+
+    /* Only search when there is a choice of keys to make, and no
+     * key has to be fetched over the network.
+     */
+    dev->search = parallel && !hinted && dev->nr_matches > 1;
+    for (j = 0; j < dev->nr_matches; ++j)
+      if (dev->keys[j].clevis)
+        dev->search = false;
+  }
+
+  if (parallel)
+    search_keys_in_parallel (g, ks, devs, nr_devs);
+
+  for (i = 0; i < nr_devs; ++i) {
+    struct crypt_device *dev = &devs[i];
+    size_t scan;
+
+    if (dev->found != (size_t)-1)
+      move_key_to_front (dev->keys, dev->found);
 
     /* Try each key in turn. */
-    for (scan = 0; scan < nr_matches; ++scan) {
-      struct matching_key *key = keys + scan;
+    for (scan = 0; scan < dev->nr_matches; ++scan) {
+      struct matching_key *key = dev->keys + scan;
       int r;
 
       guestfs_push_error_handler (g, NULL, NULL);
       assert (key->clevis == (key->passphrase == NULL));
       if (key->clevis)
 #ifdef GUESTFS_HAVE_CLEVIS_LUKS_UNLOCK
-        r = guestfs_clevis_luks_unlock (g, mountable, mapname);
+        r = guestfs_clevis_luks_unlock (g, dev->mountable, dev->mapname);
 #else
         error (EXIT_FAILURE, 0,
                _("'clevis_luks_unlock', needed for decrypting %s, is "
-                 "unavailable in this libguestfs version"), mountable);
+                 "unavailable in this libguestfs version"), dev->mountable);
 #endif
       else
-        r = guestfs_cryptsetup_open (g, mountable, key->passphrase, mapname,
-                                     -1);
+        r = guestfs_cryptsetup_open (g, dev->mountable, key->passphrase,
+                                     dev->mapname, -1);
       guestfs_pop_error_handler (g);
 
       if (r == 0)
         break;
     }
 
-    if (scan == nr_matches)
+    if (scan == dev->nr_matches)
       error (EXIT_FAILURE, 0,
              _("could not find key to open LUKS encrypted %s.\n\n"
                "Try using --key on the command line.\n\n"
                "Original error: %s (%d)"),
-             mountable, guestfs_last_error (g), guestfs_last_errno (g));
+             dev->mountable, guestfs_last_error (g), guestfs_last_errno (g));
+
+    if (hints && dev->uuid && dev->keys[scan].key_index != (size_t)-1)
+      set_hint (hints, dev->uuid, dev->keys[scan].key_index);
 
-    free_keys (keys, nr_matches);
-    decrypted_some = true;
+    free_keys (dev->keys, dev->nr_matches);
+    free (dev->uuid);
+    free (dev->mapname);
   }
 
-  return decrypted_some;
+  return nr_devs > 0;
+}
+
+/**
+ * Append the devices in C<devices> which are not already in the list
+ * C<*listp> to the end of that list.
+ */
+static void
+append_new_devices (char ***listp, char *const *devices)
+{
+  char **list;
+  size_t i, j, n;
+
+  n = guestfs_int_count_strings (*listp);
+  list = realloc (*listp,
+                  (n + guestfs_int_count_strings (devices) + 1) *
+                  sizeof (char *));
+  if (list == NULL)
+    error (EXIT_FAILURE, errno, "realloc");
+  *listp = list;
+
+  for (i = 0; devices[i] != NULL; ++i) {
+    for (j = 0; j < n; ++j)
+      if (STREQ (list[j], devices[i]))
+        break;
+    if (j < n)
+      continue;
+
+    list[n] = strdup (devices[i]);
+    if (list[n] == NULL)
+      error (EXIT_FAILURE, errno, "strdup");
+    n++;
+  }
+  list[n] = NULL;
 }
 
 /**
  * Simple implementation of decryption: look for any encrypted
- * partitions and decrypt them, then rescan for VGs.
+ * partitions, md devices and logical volumes and decrypt them, then
+ * rescan for VGs and decrypt any encrypted LVs which appeared.
  */
 void
 inspect_do_decrypt (guestfs_h *g, struct key_store *ks)
 {
   const char *lvm2_feature[] = { "lvm2", NULL };
-  CLEANUP_FREE_STRING_LIST char **partitions = guestfs_list_partitions (g);
-  bool need_rescan;
+  CLEANUP_FREE_STRING_LIST char **devices = NULL;
+  CLEANUP_FREE_STRING_LIST char **partitions = NULL;
+  CLEANUP_FREE_STRING_LIST char **mds = NULL;
+  struct key_hints hints_s = { .hints = NULL }, *hints = NULL;
+  bool have_lvm2, need_rescan;
 
+  partitions = guestfs_list_partitions (g);
   if (partitions == NULL)
     exit (EXIT_FAILURE);
+  mds = guestfs_list_md_devices (g);
+  if (mds == NULL)
+    exit (EXIT_FAILURE);
+
+  devices = calloc (1, sizeof (char *));
+  if (devices == NULL)
+    error (EXIT_FAILURE, errno, "calloc");
+  append_new_devices (&devices, partitions);
+  append_new_devices (&devices, mds);
 
-  need_rescan = decrypt_mountables (g, (const char * const *)partitions, ks);
+  have_lvm2 = guestfs_feature_available (g, (char **) lvm2_feature) > 0;
+  if (have_lvm2) {
+    CLEANUP_FREE_STRING_LIST char **lvs = guestfs_lvs (g);
+
+    if (lvs == NULL)
+      exit (EXIT_FAILURE);
+    append_new_devices (&devices, lvs);
+  }
 
-  if (guestfs_feature_available (g, (char **) lvm2_feature) > 0) {
+  if (ks && ks->hint_cache) {
+    hints = &hints_s;
+    read_key_hints (ks, hints);
+  }
+
+  need_rescan = decrypt_mountables (g, (const char * const *)devices, ks,
+                                    hints, true);
+
+  /* Encrypted LVs which were already visible have been handled above,
+   * so only LVs from newly decrypted PVs need to be looked at.
+   */
+  if (need_rescan && have_lvm2) {
     CLEANUP_FREE_STRING_LIST char **lvs = NULL;
+    const size_t nr_devices = guestfs_int_count_strings (devices);
 
-    if (need_rescan) {
-      if (guestfs_lvm_scan (g, 1) == -1)
-        exit (EXIT_FAILURE);
-    }
+    if (guestfs_lvm_scan (g, 1) == -1)
+      exit (EXIT_FAILURE);
 
     lvs = guestfs_lvs (g);
     if (lvs == NULL)
       exit (EXIT_FAILURE);
-    decrypt_mountables (g, (const char * const *)lvs, ks);
+    append_new_devices (&devices, lvs);
+    decrypt_mountables (g, (const char * const *)&devices[nr_devices], ks,
+                        hints, false);
+  }
+
+  if (hints) {
+    write_key_hints (ks, hints);
+    free_key_hints (hints);
   }
 }
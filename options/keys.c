@@ -25,9 +25,13 @@
 #include <termios.h>
 #include <string.h>
 #include <libintl.h>
+#include <stdint.h>
 #include <errno.h>
 #include <error.h>
 #include <assert.h>
+#include <sys/mman.h>
+
+#include "c-ctype.h"
 
 #include "guestfs.h"
 
@@ -110,60 +114,164 @@ read_key (const char *param)
   return ret;
 }
 
-/* Read a key from a file and base64 encode it, returning "base64:..." */
+/* Key material cached in the key store is kept in memory which is
+ * locked into RAM (so it is never written to swap), excluded from
+ * core dumps, and wiped before it is freed.
+ */
 static char *
-read_key_and_base64_encode (const char *filename)
+alloc_locked (size_t size, size_t *alloc_r)
+{
+  const size_t pagesize = sysconf (_SC_PAGESIZE);
+  const size_t alloc = (size + pagesize - 1) & ~(pagesize - 1);
+  void *p;
+
+  p = mmap (NULL, alloc, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+            -1, 0);
+  if (p == MAP_FAILED)
+    error (EXIT_FAILURE, errno, "mmap");
+
+  /* This can fail if RLIMIT_MEMLOCK is too small.  The key is still
+   * usable, so ignore it.
+   */
+  (void) mlock (p, alloc);
+#ifdef MADV_DONTDUMP
+  (void) madvise (p, alloc, MADV_DONTDUMP);
+#endif
+
+  *alloc_r = alloc;
+  return p;
+}
+
+static void
+free_locked (char *p, size_t alloc)
 {
-  CLEANUP_FREE char *inp = NULL;
+  if (p == NULL)
+    return;
+
+  explicit_bzero (p, alloc);
+  munlock (p, alloc);
+  munmap (p, alloc);
+}
+
+static const char base64_table[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Base64 encode 'inplen' bytes of 'inp' into 'out', which must have
+ * space for 4 * ((inplen + 2) / 3) characters.  No \0 is added.
+ */
+static void
+base64_encode (const unsigned char *inp, size_t inplen, char *out)
+{
+  const unsigned char *end = inp + inplen - inplen % 3;
+  uint32_t triple;
+
+  /* For large inputs (big keyfiles), encode 12 bits at a time using
+   * a table of all 4096 pairs of output characters, which halves the
+   * number of table lookups and stores.  Building the table costs
+   * about the same as encoding 12K of input.
+   */
+  if (inplen >= 3 * 4096) {
+    char pairs[4096][2];
+    size_t i;
+
+    for (i = 0; i < 4096; ++i) {
+      pairs[i][0] = base64_table[i >> 6];
+      pairs[i][1] = base64_table[i & 0x3f];
+    }
+
+    for (; inp < end; inp += 3, out += 4) {
+      triple = (inp[0] << 16) | (inp[1] << 8) | inp[2];
+      memcpy (out, pairs[triple >> 12], 2);
+      memcpy (out+2, pairs[triple & 0xfff], 2);
+    }
+  }
+
+  for (; inp < end; inp += 3, out += 4) {
+    triple = (inp[0] << 16) | (inp[1] << 8) | inp[2];
+    out[0] = base64_table[(triple >> 18) & 0x3f];
+    out[1] = base64_table[(triple >> 12) & 0x3f];
+    out[2] = base64_table[(triple >> 6) & 0x3f];
+    out[3] = base64_table[triple & 0x3f];
+  }
+
+  /* Final 1 or 2 bytes, with padding. */
+  switch (inplen % 3) {
+  case 1:
+    out[0] = base64_table[inp[0] >> 2];
+    out[1] = base64_table[(inp[0] & 0x03) << 4];
+    out[2] = out[3] = '=';
+    break;
+  case 2:
+    out[0] = base64_table[inp[0] >> 2];
+    out[1] = base64_table[((inp[0] & 0x03) << 4) | (inp[1] >> 4)];
+    out[2] = base64_table[(inp[1] & 0x0f) << 2];
+    out[3] = '=';
+    break;
+  }
+}
+
+/* Read a key from a file and base64 encode it into locked memory,
+ * returning "base64:..."
+ *
+ * The file is mapped rather than read, so the raw key is never
+ * copied into the heap.  Files which cannot be mapped (eg. pipes)
+ * are read into a private copy, which unmap_whole_file clears.
+ */
+static char *
+read_key_and_base64_encode (const char *filename, size_t *alloc_r)
+{
+  const char *inp;
   char *out;
-  size_t inplen, outlen, i, j;
+  size_t inplen, outlen;
+  int copied;
 
-  if (read_whole_file (filename, &inp, &inplen) == -1)
-    error (EXIT_FAILURE, 0, "read_key_and_base64_encode: read_whole_file: %s",
+  copied = map_whole_file (filename, &inp, &inplen);
+  if (copied == -1)
+    error (EXIT_FAILURE, 0, "read_key_and_base64_encode: map_whole_file: %s",
            filename);
 
-  /* From https://stackoverflow.com/a/6782480 */
-  static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
-                                  'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
-                                  'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
-                                  'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
-                                  'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
-                                  'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
-                                  'w', 'x', 'y', 'z', '0', '1', '2', '3',
-                                  '4', '5', '6', '7', '8', '9', '+', '/'};
-  static int mod_table[] = {0, 2, 1};
-
   outlen = 4 * ((inplen + 2) / 3);
-  out = malloc (outlen + 7 + 1);
-  if (!out)
-    error (EXIT_FAILURE, errno, "read_key_and_base64_encode: %s: malloc",
-           filename);
+  out = alloc_locked (7 + outlen + 1, alloc_r);
 
-  /* Add prefix and NUL-termination, then adjust 'out' to make the
-   * rest of the code simpler.
-   */
   memcpy (out, "base64:", 7);
+  base64_encode ((const unsigned char *) inp, inplen, &out[7]);
   out[7 + outlen] = '\0';
-  out += 7;
 
-  for (i = 0, j = 0; i < inplen;) {
-    uint32_t octet_a = i < inplen ? (unsigned char) inp[i++] : 0;
-    uint32_t octet_b = i < inplen ? (unsigned char) inp[i++] : 0;
-    uint32_t octet_c = i < inplen ? (unsigned char) inp[i++] : 0;
+  unmap_whole_file (inp, inplen, copied);
 
-    uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+  return out;
+}
 
-    assert (j <= outlen-4);
-    out[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-    out[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-    out[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-    out[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+/* Return the passphrase for a string or file key, as passed to
+ * cryptsetup_open.  It is computed (reading and encoding the
+ * keyfile if necessary) the first time the key is used and then
+ * cached in the key store, so matching the same key against many
+ * devices costs nothing.
+ */
+static char *
+get_cached_passphrase (struct key_store_key *key)
+{
+  size_t len;
+
+  if (key->passphrase != NULL)
+    return key->passphrase;
+
+  switch (key->type) {
+  case key_string:
+    len = strlen (key->string.s);
+    key->passphrase = alloc_locked (5 + len + 1, &key->passphrase_alloc);
+    memcpy (key->passphrase, "text:", 5);
+    memcpy (&key->passphrase[5], key->string.s, len + 1);
+    break;
+  case key_file:
+    key->passphrase = read_key_and_base64_encode (key->file.name,
+                                                  &key->passphrase_alloc);
+    break;
+  case key_clevis:
+    abort ();
   }
 
-  for (i = 0; i < mod_table[inplen % 3]; i++)
-    out[outlen - 1 - i] = '=';
-
-  return out - 7 /* see above */;
+  return key->passphrase;
 }
 
 /* Return the key(s) matching this particular device from the
@@ -207,21 +315,18 @@ get_keys (struct key_store *ks, const char *device, const char *uuid,
 
       switch (key->type) {
       case key_string:
-        if (asprintf (&s, "text:%s", key->string.s) == -1)
-          error (EXIT_FAILURE, errno, "asprintf");
-        match->clevis = false;
-        match->passphrase = s;
-        ++match;
-        break;
       case key_file:
-        s = read_key_and_base64_encode (key->file.name);
         match->clevis = false;
-        match->passphrase = s;
+        match->passphrase = get_cached_passphrase (key);
+        match->cached = true;
+        match->key_index = i;
         ++match;
         break;
       case key_clevis:
         match->clevis = true;
         match->passphrase = NULL;
+        match->cached = false;
+        match->key_index = i;
         ++match;
         break;
       }
@@ -235,6 +340,8 @@ get_keys (struct key_store *ks, const char *device, const char *uuid,
       error (EXIT_FAILURE, 0, _("could not read key from user"));
     match->clevis = false;
     match->passphrase = s;
+    match->cached = false;
+    match->key_index = (size_t)-1;
     ++match;
   }
 
@@ -251,8 +358,11 @@ free_keys (struct matching_key *keys, size_t nr_matches)
     struct matching_key *key = keys + i;
 
     assert (key->clevis == (key->passphrase == NULL));
-    if (!key->clevis)
+    /* Cached passphrases belong to the key store. */
+    if (!key->clevis && !key->cached) {
+      explicit_bzero (key->passphrase, strlen (key->passphrase));
       free (key->passphrase);
+    }
   }
   free (keys);
 }
@@ -407,16 +517,24 @@ unescape_device_mapper_lvm (char *id)
   }
 }
 
+static struct key_store *
+key_store_new (void)
+{
+  struct key_store *ks;
+
+  ks = calloc (1, sizeof (*ks));
+  if (!ks)
+    error (EXIT_FAILURE, errno, "calloc");
+  return ks;
+}
+
 struct key_store *
 key_store_import_key (struct key_store *ks, struct key_store_key *key)
 {
   struct key_store_key *new_keys;
 
-  if (!ks) {
-    ks = calloc (1, sizeof (*ks));
-    if (!ks)
-      error (EXIT_FAILURE, errno, "strdup");
-  }
+  if (!ks)
+    ks = key_store_new ();
   assert (ks != NULL);
 
   new_keys = realloc (ks->keys,
@@ -426,6 +544,8 @@ key_store_import_key (struct key_store *ks, struct key_store_key *key)
 
   ks->keys = new_keys;
   unescape_device_mapper_lvm (key->id);
+  key->passphrase = NULL;
+  key->passphrase_alloc = 0;
   ks->keys[ks->nr_keys] = *key;
   ++ks->nr_keys;
 
@@ -447,6 +567,55 @@ key_store_requires_network (const struct key_store *ks)
   return false;
 }
 
+/* Set the file used to remember which key opened each LUKS device,
+ * see F<key-hint-cache-option.pod>.  The file is read and written by
+ * inspect_do_decrypt.
+ */
+struct key_store *
+key_store_set_hint_cache (struct key_store *ks, const char *filename)
+{
+  if (!ks)
+    ks = key_store_new ();
+
+  free (ks->hint_cache);
+  ks->hint_cache = strdup (filename);
+  if (!ks->hint_cache)
+    error (EXIT_FAILURE, errno, "strdup");
+
+  return ks;
+}
+
+/* Allow inspect_do_decrypt to search for keys using up to
+ * 'nr_workers' extra appliances running in parallel, each with the
+ * drives in '*drvsp' added, see F<key-unlock-workers-option.pod>.
+ * This is only used with read-only drives (--ro).  'drvsp' points to
+ * the tool's list of drives, which may still grow after this option
+ * is parsed, so it must stay valid until inspection is done.
+ */
+struct key_store *
+key_store_set_unlock_workers (struct key_store *ks, const char *nr_workers,
+                              struct drv **drvsp)
+{
+  unsigned long n;
+  char *end;
+
+  errno = 0;
+  n = strtoul (nr_workers, &end, 10);
+  if (errno != 0 || end == nr_workers || *end != '\0' ||
+      !c_isdigit (nr_workers[0]) || n > 64)
+    error (EXIT_FAILURE, 0,
+           _("--key-unlock-workers: invalid number of workers: %s"),
+           nr_workers);
+
+  if (!ks)
+    ks = key_store_new ();
+
+  ks->unlock_workers = n;
+  ks->unlock_drvsp = drvsp;
+
+  return ks;
+}
+
 void
 free_key_store (struct key_store *ks)
 {
@@ -469,9 +638,11 @@ free_key_store (struct key_store *ks)
       /* nothing */
       break;
     }
+    free_locked (key->passphrase, key->passphrase_alloc);
     free (key->id);
   }
 
   free (ks->keys);
+  free (ks->hint_cache);
   free (ks);
 }
@@ -110,130 +110,150 @@ option_d (const char *arg, struct drv **drvsp)
   *drvsp = drv;
 }
 
+/* Add one drive (or for -d, one guest's drives) to the handle.
+ * Returns the number of drives added, or -1 on error.
+ */
+static int
+add_one_drive (guestfs_h *g, const struct drv *drv)
+{
+  int r;
+  struct guestfs_add_drive_opts_argv ad_optargs;
+
+  switch (drv->type) {
+  case drv_a:
+    ad_optargs.bitmask = 0;
+    if (read_only) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_READONLY_BITMASK;
+      ad_optargs.readonly = 1;
+    }
+    if (drv->a.format) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_FORMAT_BITMASK;
+      ad_optargs.format = drv->a.format;
+    }
+    if (drv->a.cachemode) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_CACHEMODE_BITMASK;
+      ad_optargs.cachemode = drv->a.cachemode;
+    }
+    if (drv->a.discard) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_DISCARD_BITMASK;
+      ad_optargs.discard = drv->a.discard;
+    }
+#ifdef GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK
+    if (drv->a.blocksize) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK;
+      ad_optargs.blocksize = drv->a.blocksize;
+    }
+#endif
+
+    r = guestfs_add_drive_opts_argv (g, drv->a.filename, &ad_optargs);
+    if (r == -1)
+      return -1;
+    return 1;
+
+  case drv_uri:
+    ad_optargs.bitmask = 0;
+    if (read_only) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_READONLY_BITMASK;
+      ad_optargs.readonly = 1;
+    }
+    if (drv->uri.format) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_FORMAT_BITMASK;
+      ad_optargs.format = drv->uri.format;
+    }
+    ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_PROTOCOL_BITMASK;
+    ad_optargs.protocol = drv->uri.protocol;
+    if (drv->uri.server) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_SERVER_BITMASK;
+      ad_optargs.server = drv->uri.server;
+    }
+    if (drv->uri.username) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_USERNAME_BITMASK;
+      ad_optargs.username = drv->uri.username;
+    }
+    if (drv->uri.password) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_SECRET_BITMASK;
+      ad_optargs.secret = drv->uri.password;
+    }
+#ifdef GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK
+    if (drv->uri.blocksize) {
+      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK;
+      ad_optargs.blocksize = drv->uri.blocksize;
+    }
+#endif
+
+    r = guestfs_add_drive_opts_argv (g, drv->uri.path, &ad_optargs);
+    if (r == -1)
+      return -1;
+    return 1;
+
+  case drv_d:
+    return add_libvirt_drives (g, drv->d.guest);
+
+  case drv_N:
+    if (!in_guestfish) abort ();
+    /* -N option is not affected by --ro */
+    r = guestfs_add_drive_opts (g, drv->N.filename,
+                                GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                                -1);
+    if (r == -1)
+      return -1;
+    return 1;
+
+  case drv_scratch:
+    if (!in_virt_rescue) abort ();
+    r = guestfs_add_drive_scratch (g, drv->scratch.size, -1);
+    if (r == -1)
+      return -1;
+    return 1;
+
+  default: /* keep GCC happy */
+    abort ();
+  }
+}
+
 char
 add_drives_handle (guestfs_h *g, struct drv *drv, size_t drive_index)
 {
   int r;
-  struct guestfs_add_drive_opts_argv ad_optargs;
 
   if (drv) {
     drive_index = add_drives_handle (g, drv->next, drive_index);
 
     drv->drive_index = drive_index;
 
-    switch (drv->type) {
-    case drv_a:
-      ad_optargs.bitmask = 0;
-      if (read_only) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_READONLY_BITMASK;
-        ad_optargs.readonly = 1;
-      }
-      if (drv->a.format) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_FORMAT_BITMASK;
-        ad_optargs.format = drv->a.format;
-      }
-      if (drv->a.cachemode) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_CACHEMODE_BITMASK;
-        ad_optargs.cachemode = drv->a.cachemode;
-      }
-      if (drv->a.discard) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_DISCARD_BITMASK;
-        ad_optargs.discard = drv->a.discard;
-      }
-#ifdef GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK
-      if (drv->a.blocksize) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK;
-        ad_optargs.blocksize = drv->a.blocksize;
-      }
-#endif
-
-      r = guestfs_add_drive_opts_argv (g, drv->a.filename, &ad_optargs);
-      if (r == -1)
-        exit (EXIT_FAILURE);
-
-      drv->nr_drives = 1;
-      drive_index++;
-      break;
-
-    case drv_uri:
-      ad_optargs.bitmask = 0;
-      if (read_only) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_READONLY_BITMASK;
-        ad_optargs.readonly = 1;
-      }
-      if (drv->uri.format) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_FORMAT_BITMASK;
-        ad_optargs.format = drv->uri.format;
-      }
-      ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_PROTOCOL_BITMASK;
-      ad_optargs.protocol = drv->uri.protocol;
-      if (drv->uri.server) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_SERVER_BITMASK;
-        ad_optargs.server = drv->uri.server;
-      }
-      if (drv->uri.username) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_USERNAME_BITMASK;
-        ad_optargs.username = drv->uri.username;
-      }
-      if (drv->uri.password) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_SECRET_BITMASK;
-        ad_optargs.secret = drv->uri.password;
-      }
-#ifdef GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK
-      if (drv->uri.blocksize) {
-        ad_optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_BLOCKSIZE_BITMASK;
-        ad_optargs.blocksize = drv->uri.blocksize;
-      }
-#endif
+    r = add_one_drive (g, drv);
+    if (r == -1)
+      exit (EXIT_FAILURE);
 
-      r = guestfs_add_drive_opts_argv (g, drv->uri.path, &ad_optargs);
-      if (r == -1)
-        exit (EXIT_FAILURE);
-
-      drv->nr_drives = 1;
-      drive_index++;
-      break;
-
-    case drv_d:
-      r = add_libvirt_drives (g, drv->d.guest);
-      if (r == -1)
-        exit (EXIT_FAILURE);
-
-      drv->nr_drives = r;
-      drive_index += r;
-      break;
-
-    case drv_N:
-      if (!in_guestfish) abort ();
-      /* -N option is not affected by --ro */
-      r = guestfs_add_drive_opts (g, drv->N.filename,
-                                  GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
-                                  -1);
-      if (r == -1)
-        exit (EXIT_FAILURE);
-
-      drv->nr_drives = 1;
-      drive_index++;
-      break;
-
-    case drv_scratch:
-      if (!in_virt_rescue) abort ();
-      r = guestfs_add_drive_scratch (g, drv->scratch.size, -1);
-      if (r == -1)
-        exit (EXIT_FAILURE);
-
-      drv->nr_drives = 1;
-      drive_index++;
-      break;
-
-    default: /* keep GCC happy */
-      abort ();
-    }
+    drv->nr_drives = r;
+    drive_index += r;
   }
 
   return drive_index;
 }
 
+/**
+ * Add the drives in C<drv> to a second handle C<g>, in the same order
+ * as C<add_drives_handle>.  Unlike that function this does not modify
+ * the list, and it returns C<-1> on error instead of exiting, so it
+ * can be called from a worker thread.  Drives from I<-N> cannot be
+ * shared with another appliance, so they are an error.
+ */
+int
+add_drives_handle_noexit (guestfs_h *g, const struct drv *drv)
+{
+  if (drv) {
+    if (add_drives_handle_noexit (g, drv->next) == -1)
+      return -1;
+    if (drv->type == drv_N)
+      return -1;
+    if (add_one_drive (g, drv) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
 static void display_mountpoints_on_failure (const char *mp_device, const char *user_supplied_options);
 
 void
@@ -127,6 +127,14 @@ struct key_store_key {
       char *name;           /* filename with the key */
     } file;
   };
+
+  /* For key_string and key_file, the passphrase ("text:..." or
+   * "base64:...") is computed the first time the key is used and
+   * cached here, in locked memory which is wiped when the key store
+   * is freed.  key_store_import_key initializes these fields.
+   */
+  char *passphrase;
+  size_t passphrase_alloc;
 };
 
 /* Container for keys, usually collected via the '--key' command line option
@@ -135,6 +143,18 @@ struct key_store_key {
 struct key_store {
   struct key_store_key *keys;
   size_t nr_keys;
+
+  /* If not NULL, the name of a file remembering which key unlocked
+   * each LUKS UUID last time (see '--key-hint-cache').
+   */
+  char *hint_cache;
+
+  /* If unlock_workers > 0, search for the right key for encrypted
+   * devices using up to this many extra appliances in parallel, each
+   * with the drives in *unlock_drvsp.  See '--key-unlock-workers'.
+   */
+  size_t unlock_workers;
+  struct drv **unlock_drvsp;
 };
 
 /* A key matching a particular ID (pathname of the libguestfs device node that
@@ -148,6 +168,16 @@ struct matching_key {
 
   /* Explicit passphrase, otherwise. */
   char *passphrase;
+
+  /* True iff passphrase points into the key store's cache, rather
+   * than being owned by this struct.
+   */
+  bool cached;
+
+  /* Index of the key in ks->keys, or (size_t)-1 if the key was read
+   * from the user.
+   */
+  size_t key_index;
 };
 
 /* in config.c */
@@ -174,12 +204,15 @@ extern struct key_store *key_store_add_from_selector (struct key_store *ks, cons
 extern struct key_store *key_store_import_key (struct key_store *ks,
                                                struct key_store_key *key);
 extern bool key_store_requires_network (const struct key_store *ks);
+extern struct key_store *key_store_set_hint_cache (struct key_store *ks, const char *filename);
+extern struct key_store *key_store_set_unlock_workers (struct key_store *ks, const char *nr_workers, struct drv **drvsp);
 extern void free_key_store (struct key_store *ks);
 
 /* in options.c */
 extern void option_a (const char *arg, const char *format, int blocksize, struct drv **drvsp);
 extern void option_d (const char *arg, struct drv **drvsp);
 extern char add_drives_handle (guestfs_h *g, struct drv *drv, size_t drive_index);
+extern int add_drives_handle_noexit (guestfs_h *g, const struct drv *drv);
 #define add_drives(drv) add_drives_handle (g, drv, 0)
 extern void mount_mps (struct mp *mp);
 extern void free_drives (struct drv *drv);
@@ -289,6 +322,12 @@ extern void free_mps (struct mp *mp);
 #define OPTION_key                                                      \
   ks = key_store_add_from_selector (ks, optarg)
 
+#define OPTION_key_hint_cache                                           \
+  ks = key_store_set_hint_cache (ks, optarg)
+
+#define OPTION_key_unlock_workers                                       \
+  ks = key_store_set_unlock_workers (ks, optarg, &drvs)
+
 #define CHECK_OPTION_format_consumed                                    \
   do {                                                                  \
     if (!format_consumed) {                                             \
@@ -0,0 +1,70 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2026 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that --key-hint-cache records which key opened a LUKS device,
+# and that the next run tries that key first.
+
+source ../../tests/functions.sh
+set -e
+set -x
+
+skip_if_skipped
+skip_unless_feature_available luks
+skip_unless_phony_guest fedora-lvm-on-luks.img
+
+if ! guestfish --long-options | grep -sq -- '^--key-hint-cache$'; then
+    echo "$0: test skipped because guestfish has no --key-hint-cache"
+    exit 77
+fi
+
+disk=../../test-data/phony-guests/fedora-lvm-on-luks.img
+hints=test-key-hint-cache.hints
+errors=test-key-hint-cache.errors
+rm -f $hints $errors
+
+# Run guestfish with tracing, and count the failed attempts to open
+# the LUKS device.
+run_guestfish ()
+{
+    out="$(guestfish -x --ro -a $disk -i --key-hint-cache $hints \
+             --key all:key:WRONG --key all:key:FEDORA \
+             exists /etc/fstab 2>$errors)"
+    test "$out" = "true"
+    failed=$(grep -c '^libguestfs: trace: cryptsetup_open = -1' $errors ||:)
+}
+
+# First run: the wrong key is tried first, and the second key (index
+# 1, selector "all") is recorded against the LUKS UUID.
+run_guestfish
+test "$failed" -eq 1
+cat $hints
+test "$(wc -l < $hints)" -eq 1
+grep -Esq $'^[0-9a-f-]{36}\t1\tkey\tall$' $hints
+cp $hints $hints.orig
+
+# Second run: the right key is tried first, and the file is unchanged.
+run_guestfish
+test "$failed" -eq 0
+cmp $hints $hints.orig
+
+# A hint for a key which is no longer on the command line is ignored.
+guestfish --ro -a $disk -i --key-hint-cache $hints \
+          --key all:key:FEDORA exists /etc/fstab
+grep -Esq $'^[0-9a-f-]{36}\t0\tkey\tall$' $hints
+
+rm -f $hints $hints.orig $errors
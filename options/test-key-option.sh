@@ -0,0 +1,59 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2026 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that inspection with --key opens LUKS devices on partitions
+# (with LVM inside) and LUKS devices on logical volumes.
+
+source ../../tests/functions.sh
+set -e
+set -x
+
+skip_if_skipped
+skip_unless_feature_available luks
+skip_unless_phony_guest fedora-lvm-on-luks.img
+skip_unless_phony_guest fedora-luks-on-lvm.img
+
+phony=../../test-data/phony-guests
+
+# LVM on a LUKS partition: the LVs only appear after the rescan.
+out="$(guestfish --ro -a $phony/fedora-lvm-on-luks.img -i \
+         --key /dev/sda2:key:FEDORA \
+         exists /etc/fstab)"
+test "$out" = "true"
+
+# The same, with a wrong key tried first.
+out="$(guestfish --ro -a $phony/fedora-lvm-on-luks.img -i \
+         --key all:key:WRONG --key /dev/sda2:key:FEDORA \
+         exists /etc/fstab)"
+test "$out" = "true"
+
+# Only a wrong key: inspection must fail.
+if guestfish --ro -a $phony/fedora-lvm-on-luks.img -i \
+       --key /dev/sda2:key:WRONG exists /etc/fstab; then
+    echo "$0: unexpected success with a wrong key"
+    exit 1
+fi
+
+# LUKS on LVM: the encrypted LVs are visible before anything is
+# decrypted.
+out="$(guestfish --ro -a $phony/fedora-luks-on-lvm.img -i \
+         --key /dev/Volume-Group/Root:key:FEDORA-Root \
+         --key /dev/Volume-Group/Logical-Volume-1:key:FEDORA-LV1 \
+         --key /dev/Volume-Group/Logical-Volume-2:key:FEDORA-LV2 \
+         exists /etc/fstab)"
+test "$out" = "true"
@@ -0,0 +1,59 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2026 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that --key-unlock-workers finds the right key among several
+# wrong ones, both for a LUKS partition (whose LVs only appear after
+# the rescan) and for LUKS on LVs.
+
+source ../../tests/functions.sh
+set -e
+set -x
+
+skip_if_skipped
+skip_unless_feature_available luks
+skip_unless_phony_guest fedora-lvm-on-luks.img
+skip_unless_phony_guest fedora-luks-on-lvm.img
+
+if ! guestfish --long-options | grep -sq -- '^--key-unlock-workers$'; then
+    echo "$0: test skipped because guestfish has no --key-unlock-workers"
+    exit 77
+fi
+
+phony=../../test-data/phony-guests
+
+out="$(guestfish --ro -a $phony/fedora-lvm-on-luks.img -i \
+         --key-unlock-workers 2 \
+         --key all:key:WRONG1 --key all:key:WRONG2 --key all:key:FEDORA \
+         exists /etc/fstab)"
+test "$out" = "true"
+
+out="$(guestfish --ro -a $phony/fedora-luks-on-lvm.img -i \
+         --key-unlock-workers 3 \
+         --key all:key:WRONG \
+         --key all:key:FEDORA-Root \
+         --key all:key:FEDORA-LV1 \
+         --key all:key:FEDORA-LV2 \
+         exists /etc/fstab)"
+test "$out" = "true"
+
+# Invalid numbers of workers are rejected.
+if guestfish --ro -a $phony/fedora-luks-on-lvm.img \
+       --key-unlock-workers -1 run; then
+    echo "$0: unexpected success with --key-unlock-workers -1"
+    exit 1
+fi
@@ -0,0 +1,153 @@
+/* libguestfs
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Unit tests of the progress board.
+ *
+ * Several threads update the board while the renderer runs, with
+ * its output (machine readable, or a dumb terminal) sent to a file.
+ * Each update sets C<total> to twice C<position>, so any torn read
+ * of a task shows up as a line where that does not hold.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "progress.h"
+
+#define CHECK(expr)                                                     \
+  do {                                                                  \
+    if (!(expr)) {                                                      \
+      fprintf (stderr, "%s:%d: test failed: %s\n",                      \
+               __FILE__, __LINE__, #expr);                              \
+      exit (EXIT_FAILURE);                                              \
+    }                                                                   \
+  } while (0)
+
+#define NR_TASKS 4
+#define NR_UPDATES 200000
+
+static const char *names[NR_TASKS] = { "a", "bb", "ccc", "idle" };
+
+struct worker {
+  struct progress_board *board;
+  size_t task;
+};
+
+static void *
+worker_thread (void *arg)
+{
+  struct worker *w = arg;
+  uint64_t i;
+
+  for (i = 1; i <= NR_UPDATES; ++i)
+    progress_board_set (w->board, w->task, i, 2 * i);
+  return NULL;
+}
+
+static void
+test_board (unsigned flags)
+{
+  char outfile[] = "/tmp/progress-tests.XXXXXX";
+  struct progress_board *board;
+  /* Two workers share task 2, to test concurrent writers. */
+  struct worker workers[] = { { NULL, 0 }, { NULL, 1 },
+                              { NULL, 2 }, { NULL, 2 } };
+  const size_t nr_workers = sizeof workers / sizeof workers[0];
+  pthread_t threads[sizeof workers / sizeof workers[0]];
+  uint64_t last[NR_TASKS] = { 0 };
+  size_t i, nr_lines = 0;
+  int fd, saved_stdout;
+  char line[256];
+  FILE *fp;
+
+  /* The board writes to stdout in these modes. */
+  fd = mkstemp (outfile);
+  CHECK (fd >= 0);
+  fflush (stdout);
+  saved_stdout = dup (1);
+  CHECK (saved_stdout >= 0);
+  CHECK (dup2 (fd, 1) == 1);
+  close (fd);
+
+  board = progress_board_init (flags, NR_TASKS, names, 1);
+  CHECK (board != NULL);
+
+  for (i = 0; i < nr_workers; ++i) {
+    workers[i].board = board;
+    CHECK (pthread_create (&threads[i], NULL,
+                           worker_thread, &workers[i]) == 0);
+  }
+  /* Out of range tasks are ignored. */
+  progress_board_set (board, NR_TASKS, 1, 1);
+  for (i = 0; i < nr_workers; ++i)
+    CHECK (pthread_join (threads[i], NULL) == 0);
+
+  progress_board_free (board);
+
+  fflush (stdout);
+  CHECK (dup2 (saved_stdout, 1) == 1);
+  close (saved_stdout);
+
+  fp = fopen (outfile, "r");
+  CHECK (fp != NULL);
+  while (fgets (line, sizeof line, fp) != NULL) {
+    char name[64];
+    uint64_t position, total;
+
+    nr_lines++;
+    CHECK (sscanf (line, "%63[^:]: %" SCNu64 "/%" SCNu64 "\n",
+                   name, &position, &total) == 3);
+    CHECK (total == 2 * position);
+    for (i = 0; i < NR_TASKS; ++i)
+      if (strcmp (name, names[i]) == 0)
+        break;
+    CHECK (i < 3);              /* "idle" never changes */
+    /* Only changed tasks are printed. */
+    CHECK (position != last[i]);
+    last[i] = position;
+  }
+  fclose (fp);
+  unlink (outfile);
+
+  /* The final frame shows the final state of each task. */
+  for (i = 0; i < 3; ++i)
+    CHECK (last[i] == NR_UPDATES);
+  CHECK (nr_lines >= 3);
+}
+
+int
+main (void)
+{
+  test_board (PROGRESS_BAR_MACHINE_READABLE);
+
+  /* Without terminfo the board falls back to the same output as the
+   * machine readable mode.
+   */
+  unsetenv ("TERM");
+  test_board (0);
+
+  exit (EXIT_SUCCESS);
+}
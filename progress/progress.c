@@ -19,6 +19,9 @@
 /**
  * This file implements the progress bar in L<guestfish(1)>,
  * L<virt-resize(1)> and L<virt-sparsify(1)>.
+ *
+ * It also implements the "progress board", a multi-line display
+ * used when a tool runs several operations in parallel.
  */
 
 #include <config.h>
@@ -27,9 +30,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <math.h>
+#include <time.h>
 #include <sys/time.h>
 #include <langinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "guestfs.h"
 #include "guestfs-utils.h"
@@ -178,7 +185,7 @@ progress_bar_reset (struct progress_bar *bar)
 }
 
 static const char *
-spinner (struct progress_bar *bar, size_t count)
+spinner (int utf8_mode, size_t count)
 {
   /* Choice of unicode spinners.
    *
@@ -213,7 +220,7 @@ spinner (struct progress_bar *bar, size_t count)
   const char **s;
   size_t n;
 
-  if (bar->utf8_mode) {
+  if (utf8_mode) {
     s = us;
     n = sizeof us / sizeof us[0];
   }
@@ -235,7 +242,7 @@ spinner (struct progress_bar *bar, size_t count)
  * E<lt>0.0 when nothing should be printed).
  */
 static double
-estimate_remaining_time (struct progress_bar *bar, double ratio)
+estimate_remaining_time (struct rmsd *rmsd, double start, double ratio)
 {
   if (ratio <= 0.)
     return -1.0;
@@ -245,17 +252,17 @@ estimate_remaining_time (struct progress_bar *bar, double ratio)
 
   double now = now_t.tv_sec + now_t.tv_usec / 1000000.;
   /* We've done 'ratio' of the work in 'now - start' seconds. */
-  double time_passed = now - bar->start;
+  double time_passed = now - start;
 
   double total_time = time_passed / ratio;
 
   /* Add total_time to running mean and s.d. and then see if our
    * estimate of total time is meaningful.
    */
-  rmsd_add_sample (&bar->rmsd, total_time);
+  rmsd_add_sample (rmsd, total_time);
 
-  double mean = rmsd_get_mean (&bar->rmsd);
-  double sd = rmsd_get_standard_deviation (&bar->rmsd);
+  double mean = rmsd_get_mean (rmsd);
+  double sd = rmsd_get_standard_deviation (rmsd);
   if (fabs (total_time - mean) >= 2.0*sd)
     return -1.0;
 
@@ -283,6 +290,92 @@ estimate_remaining_time (struct progress_bar *bar, double ratio)
  */
 #define COLS_OVERHEAD 15
 
+/**
+ * Print the percentage, the bar itself (C<width> columns between the
+ * brackets) and a trailing space.  This is everything on a progress
+ * line except the time estimate.
+ */
+static void
+print_bar (FILE *fp, int utf8_mode, size_t count,
+           int pulse_mode, double ratio, size_t width)
+{
+  size_t i;
+  const char *s_open, *s_dot, *s_dash, *s_close;
+
+  if (pulse_mode) {
+    fprintf (fp, "%s --- ", spinner (utf8_mode, count));
+  }
+  else if (ratio < 1) {
+    const int percent = 100.0 * ratio;
+    fprintf (fp, "%s%3d%% ", spinner (utf8_mode, count), percent);
+  }
+  else {
+    fputs (" 100% ", fp);
+  }
+
+  if (utf8_mode) {
+    s_open = "\u27e6";
+    s_dot = "\u2592";
+    s_dash = "\u2550";
+    s_close = "\u27e7";
+  } else {
+    s_open = "["; s_dot = "#"; s_dash = "-"; s_close = "]";
+  }
+
+  fputs (s_open, fp);
+
+  if (!pulse_mode) {
+    const size_t dots = ratio * (double) width;
+
+    for (i = 0; i < dots; ++i)
+      fputs (s_dot, fp);
+    for (i = dots; i < width; ++i)
+      fputs (s_dash, fp);
+  }
+  else {             /* "Pulse mode": the progress bar just pulses. */
+    for (i = 0; i < width; ++i) {
+      const int cc = (count * 3 - i) % width;
+      if (cc >= 0 && cc <= 3)
+        fputs (s_dot, fp);
+      else
+        fputs (s_dash, fp);
+    }
+  }
+
+  fputs (s_close, fp);
+  fputc (' ', fp);
+}
+
+/**
+ * Print the time estimate (always 5 columns).
+ */
+static void
+print_estimate (FILE *fp, double estimate)
+{
+  if (estimate >= 100.0 * 60.0 * 60.0 /* >= 100 hours */) {
+    /* Display hours<h> */
+    estimate /= 60. * 60.;
+    const int hh = floor (estimate);
+    fprintf (fp, ">%dh", hh);
+  } else if (estimate >= 100.0 * 60.0 /* >= 100 minutes */) {
+    /* Display hours<h>minutes */
+    estimate /= 60. * 60.;
+    const int hh = floor (estimate);
+    double ignore;
+    const int mm = floor (modf (estimate, &ignore) * 60.);
+    fprintf (fp, "%02dh%02d", hh, mm);
+  } else if (estimate >= 0.0) {
+    /* Display minutes:seconds */
+    estimate /= 60.;
+    const int mm = floor (estimate);
+    double ignore;
+    const int ss = floor (modf (estimate, &ignore) * 60.);
+    fprintf (fp, "%02d:%02d", mm, ss);
+  }
+  else /* < 0 means estimate was not meaningful */
+    fputs ("--:--", fp);
+}
+
 /**
  * Set the position of the progress bar.
  *
@@ -293,10 +386,9 @@ void
 progress_bar_set (struct progress_bar *bar,
                   uint64_t position, uint64_t total)
 {
-  size_t i, cols;
+  size_t cols;
   int pulse_mode;
   double ratio;
-  const char *s_open, *s_dot, *s_dash, *s_close;
   FILE *fp;
 
   if (bar->machine_readable || bar->have_terminfo == 0) {
@@ -330,75 +422,416 @@ progress_bar_set (struct progress_bar *bar,
     ratio = (double) position / total;
     if (ratio < 0) ratio = 0; else if (ratio > 1) ratio = 1;
 
-    if (pulse_mode) {
-      fprintf (fp, "%s --- ", spinner (bar, bar->count));
-    }
-    else if (ratio < 1) {
-      const int percent = 100.0 * ratio;
-      fprintf (fp, "%s%3d%% ", spinner (bar, bar->count), percent);
-    }
-    else {
-      fputs (" 100% ", fp);
+    print_bar (fp, bar->utf8_mode, bar->count, pulse_mode, ratio,
+               cols - COLS_OVERHEAD);
+
+    /* Time estimate. */
+    print_estimate (fp,
+                    estimate_remaining_time (&bar->rmsd, bar->start, ratio));
+
+    fputc ('\n', fp);
+    fflush (fp);
+  }
+}
+
+/* Progress board.
+ *
+ * Each task has a pair of counters which are written by the worker
+ * threads under a per-task sequence lock (seqlock).  Writers never
+ * sleep, but concurrent writers of the same task spin, so this is
+ * not lock-free.  A single renderer thread wakes up
+ * every C<refresh_ms> milliseconds, reads all the counters and
+ * redraws one line per task plus a summary line.  Only the renderer
+ * thread writes to the terminal, so lines can never overwrite each
+ * other.
+ */
+struct progress_board_task {
+  char *name;
+  /* C<position> and C<total> are published together under a
+   * sequence lock: C<seq> is odd while an update is in progress, so
+   * the renderer can detect and retry a torn read.
+   */
+  _Atomic unsigned seq;
+  _Atomic uint64_t position;
+  _Atomic uint64_t total;
+
+  /* The fields below are only touched by the renderer thread. */
+  double start;         /* time the task was first seen to be running */
+  struct rmsd rmsd;     /* running mean and standard deviation */
+  uint64_t last_position, last_total; /* for machine readable output */
+};
+
+struct progress_board {
+  size_t nr_tasks;
+  struct progress_board_task *tasks;
+  size_t name_width;    /* length of the longest task name */
+  unsigned refresh_ms;
+  int have_terminfo;
+  int utf8_mode;
+  int machine_readable;
+  FILE *fp;             /* output device, only used when !dumb mode */
+
+  size_t count;         /* number of frames drawn */
+  size_t nr_lines;      /* lines drawn by the previous terminal frame */
+  double last_time;     /* time of the previous frame */
+  uint64_t last_sum;    /* sum of positions at the previous frame */
+  double rate;          /* smoothed aggregate throughput (units/sec) */
+
+  pthread_t thread;
+  pthread_mutex_t lock; /* protects 'stop' */
+  pthread_cond_t cond;
+  int stop;
+};
+
+static void *board_thread (void *);
+static void board_draw (struct progress_board *);
+
+static double
+now_seconds (void)
+{
+  struct timeval t;
+
+  gettimeofday (&t, NULL);
+  return t.tv_sec + t.tv_usec / 1000000.;
+}
+
+/**
+ * Create a progress board with C<nr_tasks> lines, named C<names[0]>
+ * to C<names[nr_tasks-1]>, and start the renderer thread which
+ * redraws the board every C<refresh_ms> milliseconds (if C<0> then a
+ * default is used).
+ *
+ * C<flags> are the same as for C<progress_bar_init>.
+ *
+ * Returns C<NULL> (with C<errno> set) if there was an error.
+ */
+struct progress_board *
+progress_board_init (unsigned flags, size_t nr_tasks,
+                     const char *const *names, unsigned refresh_ms)
+{
+  struct progress_board *board;
+  char *term;
+  size_t i, len;
+  int err;
+
+  board = calloc (1, sizeof *board);
+  if (board == NULL)
+    return NULL;
+
+  board->nr_tasks = nr_tasks;
+  board->tasks = calloc (nr_tasks, sizeof (struct progress_board_task));
+  if (board->tasks == NULL)
+    goto error;
+
+  board->name_width = strlen ("total");
+  for (i = 0; i < nr_tasks; ++i) {
+    board->tasks[i].name = strdup (names[i]);
+    if (board->tasks[i].name == NULL)
+      goto error;
+    atomic_init (&board->tasks[i].seq, 0);
+    atomic_init (&board->tasks[i].position, 0);
+    atomic_init (&board->tasks[i].total, 0);
+    rmsd_init (&board->tasks[i].rmsd);
+    len = strlen (names[i]);
+    if (len > board->name_width)
+      board->name_width = len;
+  }
+
+  board->refresh_ms = refresh_ms > 0 ? refresh_ms : 250;
+
+  if (flags & PROGRESS_BAR_MACHINE_READABLE) {
+    board->machine_readable = 1;
+    board->utf8_mode = 0;
+    board->have_terminfo = 0;
+    board->fp = NULL;
+  } else {
+    board->machine_readable = 0;
+
+    board->utf8_mode = STREQ (nl_langinfo (CODESET), "UTF-8");
+
+    board->have_terminfo = 0;
+
+    term = getenv ("TERM");
+    if (term) {
+      if (tgetent (NULL, term) == 1)
+        board->have_terminfo = 1;
     }
 
-    if (bar->utf8_mode) {
-      s_open = "\u27e6";
-      s_dot = "\u2592";
-      s_dash = "\u2550";
-      s_close = "\u27e7";
-    } else {
-      s_open = "["; s_dot = "#"; s_dash = "-"; s_close = "]";
+    board->fp = fopen ("/dev/tty", "w"); /* deliberately ignore errors */
+  }
+
+  board->last_time = now_seconds ();
+
+  pthread_mutex_init (&board->lock, NULL);
+  pthread_cond_init (&board->cond, NULL);
+
+  err = pthread_create (&board->thread, NULL, board_thread, board);
+  if (err != 0) {
+    pthread_cond_destroy (&board->cond);
+    pthread_mutex_destroy (&board->lock);
+    if (board->fp)
+      fclose (board->fp);
+    errno = err;
+    goto error;
+  }
+
+  return board;
+
+ error:
+  err = errno;
+  if (board->tasks) {
+    for (i = 0; i < nr_tasks; ++i)
+      free (board->tasks[i].name);
+    free (board->tasks);
+  }
+  free (board);
+  errno = err;
+  return NULL;
+}
+
+/**
+ * Update the position of task number C<task>.
+ *
+ * This may be called from any thread (typically from a
+ * C<GUESTFS_EVENT_PROGRESS> callback on the handle doing the work).
+ * It never sleeps and never writes any output.  If two threads
+ * update the same task at once, one briefly spins until the other
+ * has finished.
+ */
+void
+progress_board_set (struct progress_board *board, size_t task,
+                    uint64_t position, uint64_t total)
+{
+  struct progress_board_task *t;
+  unsigned seq;
+
+  if (task >= board->nr_tasks)
+    return;
+
+  t = &board->tasks[task];
+
+  /* Take the write side of the sequence lock by making it odd. */
+  seq = atomic_load_explicit (&t->seq, memory_order_relaxed);
+  for (;;) {
+    if ((seq & 1) == 0 &&
+        atomic_compare_exchange_weak_explicit (&t->seq, &seq, seq + 1,
+                                               memory_order_acquire,
+                                               memory_order_relaxed))
+      break;
+    seq = atomic_load_explicit (&t->seq, memory_order_relaxed);
+  }
+  atomic_thread_fence (memory_order_release);
+
+  atomic_store_explicit (&t->total, total, memory_order_relaxed);
+  atomic_store_explicit (&t->position, position, memory_order_relaxed);
+
+  atomic_store_explicit (&t->seq, seq + 2, memory_order_release);
+}
+
+/* Read a consistent (position, total) pair for a task. */
+static void
+board_task_load (struct progress_board_task *t,
+                 uint64_t *position, uint64_t *total)
+{
+  unsigned seq1, seq2;
+
+  do {
+    seq1 = atomic_load_explicit (&t->seq, memory_order_acquire);
+    *total = atomic_load_explicit (&t->total, memory_order_relaxed);
+    *position = atomic_load_explicit (&t->position, memory_order_relaxed);
+    atomic_thread_fence (memory_order_acquire);
+    seq2 = atomic_load_explicit (&t->seq, memory_order_relaxed);
+  } while ((seq1 & 1) != 0 || seq1 != seq2);
+}
+
+/**
+ * Stop the renderer thread, draw the final state of the board and
+ * free up the board.
+ */
+void
+progress_board_free (struct progress_board *board)
+{
+  size_t i;
+
+  pthread_mutex_lock (&board->lock);
+  board->stop = 1;
+  pthread_cond_signal (&board->cond);
+  pthread_mutex_unlock (&board->lock);
+  pthread_join (board->thread, NULL);
+
+  board_draw (board);
+
+  pthread_cond_destroy (&board->cond);
+  pthread_mutex_destroy (&board->lock);
+  if (board->fp)
+    fclose (board->fp);
+  for (i = 0; i < board->nr_tasks; ++i)
+    free (board->tasks[i].name);
+  free (board->tasks);
+  free (board);
+}
+
+static void *
+board_thread (void *arg)
+{
+  struct progress_board *board = arg;
+  struct timespec ts;
+
+  pthread_mutex_lock (&board->lock);
+  while (!board->stop) {
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += board->refresh_ms / 1000;
+    ts.tv_nsec += (board->refresh_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
     }
+    pthread_cond_timedwait (&board->cond, &board->lock, &ts);
+    if (board->stop)
+      break;
 
-    fputs (s_open, fp);
+    pthread_mutex_unlock (&board->lock);
+    board_draw (board);
+    pthread_mutex_lock (&board->lock);
+  }
+  pthread_mutex_unlock (&board->lock);
 
-    if (!pulse_mode) {
-      const size_t dots = ratio * (double) (cols - COLS_OVERHEAD);
+  return NULL;
+}
 
-      for (i = 0; i < dots; ++i)
-        fputs (s_dot, fp);
-      for (i = dots; i < cols - COLS_OVERHEAD; ++i)
-        fputs (s_dash, fp);
+/* Print a throughput as a human-readable rate in exactly 9 columns. */
+static void
+print_throughput (FILE *fp, double rate)
+{
+  static const char units[] = "BKMGTPE";
+  size_t u = 0;
+
+  while (rate >= 1024.0 && u < sizeof units - 2) {
+    rate /= 1024.0;
+    u++;
+  }
+  fprintf (fp, "%6.1f%c/s", rate, units[u]);
+}
+
+/* Draw one line of the board in terminal mode. */
+static void
+board_draw_line (struct progress_board *board, FILE *fp, size_t width,
+                 const char *name, struct rmsd *rmsd, double start,
+                 uint64_t position, uint64_t total)
+{
+  int pulse_mode;
+  double ratio;
+
+  fprintf (fp, "%-*s ", (int) board->name_width, name);
+
+  if (total == 0) {
+    /* Task not started yet.  Pad to the same width as print_bar
+     * followed by print_estimate.
+     */
+    fprintf (fp, "%*s", (int) (width + COLS_OVERHEAD - 1 - (rmsd ? 0 : 5)), "");
+    return;
+  }
+
+  pulse_mode = position == 0 && total == 1;
+
+  ratio = (double) position / total;
+  if (ratio < 0) ratio = 0; else if (ratio > 1) ratio = 1;
+
+  print_bar (fp, board->utf8_mode, board->count, pulse_mode, ratio, width);
+  if (rmsd)
+    print_estimate (fp, estimate_remaining_time (rmsd, start, ratio));
+}
+
+static void
+board_draw (struct progress_board *board)
+{
+  size_t i, cols, width;
+  uint64_t position, total, sum_position = 0, sum_total = 0;
+  double now, elapsed;
+  FILE *fp;
+
+  now = now_seconds ();
+
+  if (board->machine_readable || board->have_terminfo == 0) {
+  dumb:
+    /* Anything drawn before is now scrolled away by the lines below,
+     * so if the terminal becomes wide enough again we must not move
+     * the cursor back up over it.
+     */
+    board->nr_lines = 0;
+
+    /* Only print the tasks which changed since the last frame. */
+    for (i = 0; i < board->nr_tasks; ++i) {
+      struct progress_board_task *t = &board->tasks[i];
+
+      board_task_load (t, &position, &total);
+      if (position == t->last_position && total == t->last_total)
+        continue;
+      t->last_position = position;
+      t->last_total = total;
+      printf ("%s: %" PRIu64 "/%" PRIu64 "\n", t->name, position, total);
     }
-    else {           /* "Pulse mode": the progress bar just pulses. */
-      for (i = 0; i < cols - COLS_OVERHEAD; ++i) {
-        const int cc = (bar->count * 3 - i) % (cols - COLS_OVERHEAD);
-        if (cc >= 0 && cc <= 3)
-          fputs (s_dot, fp);
-        else
-          fputs (s_dash, fp);
-      }
+    fflush (stdout);
+    return;
+  }
+
+  cols = tgetnum ((char *) "co");
+  /* Room for the name column, the bar overhead and the throughput
+   * on the summary line, and at least a few columns of bar.
+   */
+  if (cols < board->name_width + 1 + COLS_OVERHEAD + 10 + 10)
+    goto dumb;
+  width = cols - board->name_width - 1 - COLS_OVERHEAD - 10;
+
+  fp = board->fp;
+  if (!fp)
+    fp = stdout;
+
+  /* Move back up over the board just printed. */
+  if (UP) {
+    for (i = 0; i < board->nr_lines; ++i)
+      fprintf (fp, "%s", UP);
+  }
+  board->count++;
+  board->nr_lines = board->nr_tasks + 1;
+
+  for (i = 0; i < board->nr_tasks; ++i) {
+    struct progress_board_task *t = &board->tasks[i];
+
+    board_task_load (t, &position, &total);
+    if (total > 0 && t->start == 0)
+      t->start = now;
+    /* Pulse mode (0/1) does not contribute to the summary line. */
+    if (!(position == 0 && total == 1)) {
+      sum_position += position;
+      sum_total += total;
     }
 
-    fputs (s_close, fp);
-    fputc (' ', fp);
+    board_draw_line (board, fp, width, t->name, &t->rmsd, t->start,
+                     position, total);
+    fprintf (fp, "%10s\n", "");
+  }
 
-    /* Time estimate. */
-    double estimate = estimate_remaining_time (bar, ratio);
-    if (estimate >= 100.0 * 60.0 * 60.0 /* >= 100 hours */) {
-      /* Display hours<h> */
-      estimate /= 60. * 60.;
-      const int hh = floor (estimate);
-      fprintf (fp, ">%dh", hh);
-    } else if (estimate >= 100.0 * 60.0 /* >= 100 minutes */) {
-      /* Display hours<h>minutes */
-      estimate /= 60. * 60.;
-      const int hh = floor (estimate);
-      double ignore;
-      const int mm = floor (modf (estimate, &ignore) * 60.);
-      fprintf (fp, "%02dh%02d", hh, mm);
-    } else if (estimate >= 0.0) {
-      /* Display minutes:seconds */
-      estimate /= 60.;
-      const int mm = floor (estimate);
-      double ignore;
-      const int ss = floor (modf (estimate, &ignore) * 60.);
-      fprintf (fp, "%02d:%02d", mm, ss);
-    }
-    else /* < 0 means estimate was not meaningful */
-      fputs ("--:--", fp);
+  /* Summary line: aggregate progress and exponentially smoothed
+   * total throughput.
+   */
+  elapsed = now - board->last_time;
+  if (elapsed > 0 && sum_position >= board->last_sum) {
+    const double rate = (sum_position - board->last_sum) / elapsed;
+    board->rate = board->count <= 2 ? rate : 0.7 * board->rate + 0.3 * rate;
+  }
+  board->last_time = now;
+  board->last_sum = sum_position;
 
-    fputc ('\n', fp);
-    fflush (fp);
+  board_draw_line (board, fp, width, "total", NULL, 0,
+                   sum_position, sum_total);
+  if (sum_total == 0)
+    fprintf (fp, "%14s", "");
+  else {
+    fputc (' ', fp);
+    print_throughput (fp, board->rate);
+    fprintf (fp, "%4s", "");
   }
+  fputc ('\n', fp);
+  fflush (fp);
 }
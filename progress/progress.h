@@ -41,4 +41,21 @@ extern void progress_bar_set (struct progress_bar *, uint64_t position, uint64_t
 /* Free up progress bar handle and resources. */
 extern void progress_bar_free (struct progress_bar *);
 
+/* The progress board displays one progress bar per task, plus a
+ * summary line, for tools which run several commands in parallel.
+ * Tasks are updated from any thread with progress_board_set; a
+ * separate renderer thread redraws the board every 'refresh_ms'
+ * milliseconds (0 = default).  The flags are the same as for
+ * progress_bar_init.
+ */
+struct progress_board;
+
+extern struct progress_board *progress_board_init (unsigned flags, size_t nr_tasks, const char *const *names, unsigned refresh_ms);
+
+/* This may be called from any thread.  It never sleeps or prints. */
+extern void progress_board_set (struct progress_board *, size_t task, uint64_t position, uint64_t total);
+
+/* Stop the renderer, draw the final board and free up resources. */
+extern void progress_board_free (struct progress_board *);
+
 #endif /* PROGRESS_H */
@@ -0,0 +1,704 @@
+/* libguestfs
+ * Copyright (C) 2009-2025 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Cache of qemu binary capabilities.
+ *
+ * Finding out what a qemu binary supports means running it several
+ * times (C<qemu -help>, C<qemu -device help>, C<qemu -machine help>),
+ * which costs hundreds of milliseconds.  This runs those probes once,
+ * parses the output and saves the results in a small file in a cache
+ * directory.  Later calls (including from other processes) load the
+ * file instead, as long as the binary has not changed.
+ *
+ * The binary is identified by its absolute path, size, mtime and
+ * inode number, and by its ELF build ID if it has one.  If any of
+ * these change the cache file is ignored and rewritten.
+ *
+ * Typical usage (with error handling omitted):
+ *
+ *  qemuopts_set_binary_by_arch (qopts, NULL);
+ *  caps = qemuopts_caps_get (qopts, "/var/tmp/.guestfs-1000");
+ *  if (qemuopts_caps_has_device (caps, "virtio-scsi-pci"))
+ *    ...
+ *  qemuopts_caps_free (caps);
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <elf.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "qemuopts.h"
+
+/* Change this if the format of the cache file changes. */
+#define CACHE_VERSION "qemuopts-caps 1"
+
+enum caps_list {
+  CAPS_OPTIONS,                 /* eg. "-blockdev" */
+  CAPS_DEVICES,                 /* eg. "virtio-scsi-pci" */
+  CAPS_MACHINES,                /* eg. "q35" */
+  NR_CAPS_LISTS
+};
+
+static const char *const caps_list_name[NR_CAPS_LISTS] = {
+  "options", "devices", "machines"
+};
+
+struct strings {
+  char **strs;
+  size_t len, alloc;
+};
+
+struct qemuopts_caps {
+  char *identity;               /* first line of the cache file */
+  struct strings lists[NR_CAPS_LISTS];
+};
+
+static void
+free_strings (struct strings *list)
+{
+  size_t i;
+
+  for (i = 0; i < list->len; ++i)
+    free (list->strs[i]);
+  free (list->strs);
+  list->strs = NULL;
+  list->len = list->alloc = 0;
+}
+
+static int
+add_string (struct strings *list, const char *str, size_t len)
+{
+  char **new_strs;
+  char *copy;
+
+  if (list->len >= list->alloc) {
+    const size_t alloc = list->alloc == 0 ? 64 : list->alloc * 2;
+
+    new_strs = realloc (list->strs, alloc * sizeof (char *));
+    if (new_strs == NULL)
+      return -1;
+    list->strs = new_strs;
+    list->alloc = alloc;
+  }
+
+  copy = strndup (str, len);
+  if (copy == NULL)
+    return -1;
+  list->strs[list->len++] = copy;
+  return 0;
+}
+
+static int
+compare_strings (const void *a, const void *b)
+{
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/* Sort the list and remove duplicates so it can be searched. */
+static void
+sort_strings (struct strings *list)
+{
+  size_t i, j;
+
+  if (list->len == 0)
+    return;
+
+  qsort (list->strs, list->len, sizeof (char *), compare_strings);
+  for (i = 1, j = 1; i < list->len; ++i) {
+    if (strcmp (list->strs[i], list->strs[j-1]) == 0)
+      free (list->strs[i]);
+    else
+      list->strs[j++] = list->strs[i];
+  }
+  list->len = j;
+}
+
+static int
+has_string (const struct strings *list, const char *str)
+{
+  return bsearch (&str, list->strs, list->len, sizeof (char *),
+                  compare_strings) != NULL;
+}
+
+/**
+ * Free the capabilities returned by C<qemuopts_caps_get>.
+ */
+void
+qemuopts_caps_free (struct qemuopts_caps *caps)
+{
+  size_t i;
+
+  if (caps == NULL)
+    return;
+
+  for (i = 0; i < NR_CAPS_LISTS; ++i)
+    free_strings (&caps->lists[i]);
+  free (caps->identity);
+  free (caps);
+}
+
+/**
+ * Find the binary on C<$PATH> (if it does not contain a C</>) and
+ * return its absolute path.
+ */
+static char *
+find_binary (const char *binary)
+{
+  const char *path, *p, *end;
+  char *ret;
+
+  if (strchr (binary, '/') != NULL)
+    return realpath (binary, NULL);
+
+  path = getenv ("PATH");
+  if (path == NULL)
+    path = "/usr/bin:/bin";
+
+  for (p = path; ; p = end + 1) {
+    end = strchrnul (p, ':');
+    if (asprintf (&ret, "%.*s/%s",
+                  end > p ? (int) (end - p) : 1, end > p ? p : ".",
+                  binary) == -1)
+      return NULL;
+    if (access (ret, X_OK) == 0) {
+      char *abs = realpath (ret, NULL);
+      free (ret);
+      return abs;
+    }
+    free (ret);
+    if (*end == '\0')
+      break;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+/**
+ * Read the GNU build ID note from an ELF binary and append it to
+ * C<fp> in hex.  Nothing is written if the file is not an ELF file
+ * for this host or has no build ID, and that is not an error.
+ */
+static void
+print_build_id (int fd, FILE *fp)
+{
+#if __SIZEOF_POINTER__ == 8
+  typedef Elf64_Ehdr Ehdr;
+  typedef Elf64_Phdr Phdr;
+  typedef Elf64_Nhdr Nhdr;
+  const unsigned char elfclass = ELFCLASS64;
+#else
+  typedef Elf32_Ehdr Ehdr;
+  typedef Elf32_Phdr Phdr;
+  typedef Elf32_Nhdr Nhdr;
+  const unsigned char elfclass = ELFCLASS32;
+#endif
+  Ehdr ehdr;
+  Phdr phdr;
+  unsigned char notes[4096];
+  size_t i, off, len, namesz, descsz;
+  Nhdr nhdr;
+
+  if (pread (fd, &ehdr, sizeof ehdr, 0) != sizeof ehdr ||
+      memcmp (ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != elfclass ||
+      ehdr.e_phentsize != sizeof phdr)
+    return;
+
+  for (i = 0; i < ehdr.e_phnum; ++i) {
+    if (pread (fd, &phdr, sizeof phdr,
+               ehdr.e_phoff + i * sizeof phdr) != sizeof phdr)
+      return;
+    if (phdr.p_type != PT_NOTE)
+      continue;
+
+    len = phdr.p_filesz < sizeof notes ? phdr.p_filesz : sizeof notes;
+    if (pread (fd, notes, len, phdr.p_offset) != (ssize_t) len)
+      return;
+
+    for (off = 0; off + sizeof nhdr <= len; ) {
+      memcpy (&nhdr, &notes[off], sizeof nhdr);
+      off += sizeof nhdr;
+      namesz = (nhdr.n_namesz + 3) & ~3;
+      descsz = (nhdr.n_descsz + 3) & ~3;
+      if (off + namesz + descsz > len)
+        break;
+      if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 &&
+          memcmp (&notes[off], "GNU", 4) == 0) {
+        const unsigned char *desc = &notes[off + namesz];
+        size_t j;
+
+        fputc (' ', fp);
+        for (j = 0; j < nhdr.n_descsz; ++j)
+          fprintf (fp, "%02x", desc[j]);
+        return;
+      }
+      off += namesz + descsz;
+    }
+  }
+}
+
+/**
+ * Construct the identity string for the binary.  This is stored as
+ * the first line of the cache file.
+ */
+static char *
+get_identity (const char *path)
+{
+  int fd;
+  struct stat statbuf;
+  char *ret = NULL;
+  size_t len;
+  FILE *fp;
+
+  fd = open (path, O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (fstat (fd, &statbuf) == -1)
+    goto out;
+
+  fp = open_memstream (&ret, &len);
+  if (fp == NULL)
+    goto out;
+  fprintf (fp, "%s %s %" PRIu64 " %" PRIu64 " %" PRIi64 ".%09ld",
+           CACHE_VERSION, path,
+           (uint64_t) statbuf.st_size, (uint64_t) statbuf.st_ino,
+           (int64_t) statbuf.st_mtim.tv_sec, statbuf.st_mtim.tv_nsec);
+  print_build_id (fd, fp);
+  if (fclose (fp) == EOF) {
+    free (ret);
+    ret = NULL;
+  }
+
+ out:
+  close (fd);
+  return ret;
+}
+
+/**
+ * Return the name of the cache file for C<path> in C<cachedir>.
+ * The name is derived from a hash of the path, so that different
+ * binaries (eg. for different architectures) have different files.
+ */
+static char *
+cache_filename (const char *cachedir, const char *path)
+{
+  uint64_t hash = UINT64_C (14695981039346656037);
+  const unsigned char *p;
+  char *ret;
+
+  /* FNV-1a */
+  for (p = (const unsigned char *) path; *p; ++p) {
+    hash ^= *p;
+    hash *= UINT64_C (1099511628211);
+  }
+
+  if (asprintf (&ret, "%s/qemucaps-%016" PRIx64, cachedir, hash) == -1)
+    return NULL;
+  return ret;
+}
+
+/**
+ * Load the cache file, returning C<0> if it was loaded successfully
+ * or C<-1> if it does not exist, cannot be read or is stale.
+ */
+static int
+load_cache (struct qemuopts_caps *caps, const char *filename)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+  struct strings *list = NULL;
+  size_t i;
+  int r = -1;
+
+  fp = fopen (filename, "re");
+  if (fp == NULL)
+    return -1;
+
+  len = getline (&line, &allocsize, fp);
+  if (len <= 0 || line[len-1] != '\n')
+    goto out;
+  line[len-1] = '\0';
+  if (strcmp (line, caps->identity) != 0)
+    goto out;
+
+  while ((len = getline (&line, &allocsize, fp)) > 0) {
+    if (line[len-1] != '\n')
+      goto out;                 /* truncated file */
+    line[--len] = '\0';
+    if (line[0] == '[') {
+      list = NULL;
+      for (i = 0; i < NR_CAPS_LISTS; ++i) {
+        if (len == (ssize_t) strlen (caps_list_name[i]) + 2 &&
+            strncmp (&line[1], caps_list_name[i], len-2) == 0)
+          list = &caps->lists[i];
+      }
+    }
+    else if (list != NULL && len > 0) {
+      if (add_string (list, line, len) == -1)
+        goto out;
+    }
+  }
+  if (ferror (fp))
+    goto out;
+
+  for (i = 0; i < NR_CAPS_LISTS; ++i)
+    sort_strings (&caps->lists[i]);
+  r = 0;
+
+ out:
+  if (r == -1) {
+    for (i = 0; i < NR_CAPS_LISTS; ++i)
+      free_strings (&caps->lists[i]);
+  }
+  free (line);
+  fclose (fp);
+  return r;
+}
+
+/**
+ * Write the cache file atomically.  Errors are ignored since the
+ * cache is only an optimization.
+ */
+static void
+save_cache (const struct qemuopts_caps *caps, const char *filename)
+{
+  char *tmpfile;
+  int fd;
+  FILE *fp;
+  size_t i, j;
+
+  if (asprintf (&tmpfile, "%s.XXXXXX", filename) == -1)
+    return;
+  fd = mkstemp (tmpfile);
+  if (fd == -1) {
+    free (tmpfile);
+    return;
+  }
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    close (fd);
+    goto error;
+  }
+
+  fprintf (fp, "%s\n", caps->identity);
+  for (i = 0; i < NR_CAPS_LISTS; ++i) {
+    fprintf (fp, "[%s]\n", caps_list_name[i]);
+    for (j = 0; j < caps->lists[i].len; ++j)
+      fprintf (fp, "%s\n", caps->lists[i].strs[j]);
+  }
+
+  if (fclose (fp) == EOF)
+    goto error;
+  if (rename (tmpfile, filename) == -1)
+    goto error;
+  free (tmpfile);
+  return;
+
+ error:
+  unlink (tmpfile);
+  free (tmpfile);
+}
+
+/**
+ * Run C<path> with the arguments in C<args> and return its
+ * standard output.  Standard error is discarded.
+ */
+static char *
+run_probe (const char *path, const char *const *args)
+{
+  const char *argv[8];
+  size_t i;
+  int fd[2], status;
+  pid_t pid;
+  FILE *fp;
+  char *ret = NULL;
+  size_t len;
+  char buf[BUFSIZ];
+  ssize_t n;
+
+  argv[0] = path;
+  for (i = 0; args[i] != NULL; ++i)
+    argv[i+1] = args[i];
+  argv[i+1] = NULL;
+
+  if (pipe2 (fd, O_CLOEXEC) == -1)
+    return NULL;
+
+  pid = fork ();
+  if (pid == -1) {
+    close (fd[0]);
+    close (fd[1]);
+    return NULL;
+  }
+  if (pid == 0) {               /* Child. */
+    int devnull = open ("/dev/null", O_RDWR);
+
+    if (devnull >= 0) {
+      dup2 (devnull, 0);
+      dup2 (devnull, 2);
+    }
+    dup2 (fd[1], 1);
+    execv (path, (char **) argv);
+    _exit (EXIT_FAILURE);
+  }
+
+  /* Parent. */
+  close (fd[1]);
+  fp = open_memstream (&ret, &len);
+  if (fp == NULL) {
+    close (fd[0]);
+    waitpid (pid, NULL, 0);
+    return NULL;
+  }
+  while ((n = read (fd[0], buf, sizeof buf)) != 0) {
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    fwrite (buf, 1, n, fp);
+  }
+  close (fd[0]);
+  if (fclose (fp) == EOF) {
+    free (ret);
+    ret = NULL;
+  }
+
+  if (waitpid (pid, &status, 0) == -1 ||
+      !WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+    free (ret);
+    errno = ENOEXEC;
+    return NULL;
+  }
+
+  return ret;
+}
+
+/* Parse C<qemu -help>.  Options are lines beginning with C<->. */
+static int
+parse_help (struct strings *list, const char *out)
+{
+  const char *p, *end;
+
+  for (p = out; *p; p = *end ? end + 1 : end) {
+    end = strchrnul (p, '\n');
+    if (p[0] == '-' && p[1] != '\0' && p[1] != '-' && p[1] != ' ') {
+      const size_t len = strcspn (p, " \t\n");
+      if (add_string (list, p, len) == -1)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/* Parse C<qemu -device help>.  Devices are listed like:
+ * name "virtio-blk-pci", bus PCI, alias "virtio-blk"
+ */
+static int
+parse_devices (struct strings *list, const char *out)
+{
+  const char *p, *end, *q, *close_quote;
+  static const char *const keys[] = { "name \"", "alias \"", NULL };
+  size_t i;
+
+  for (p = out; *p; p = *end ? end + 1 : end) {
+    end = strchrnul (p, '\n');
+    for (i = 0; keys[i] != NULL; ++i) {
+      q = memmem (p, end - p, keys[i], strlen (keys[i]));
+      if (q == NULL)
+        continue;
+      q += strlen (keys[i]);
+      close_quote = memchr (q, '"', end - q);
+      if (close_quote != NULL && close_quote > q &&
+          add_string (list, q, close_quote - q) == -1)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/* Parse C<qemu -machine help>.  After the header line, each line
+ * starts with a machine type name followed by spaces.
+ */
+static int
+parse_machines (struct strings *list, const char *out)
+{
+  const char *p, *end;
+
+  for (p = out; *p; p = *end ? end + 1 : end) {
+    end = strchrnul (p, '\n');
+    if (p[0] != ' ' && p[0] != '\n' && p[0] != '\0' &&
+        strncmp (p, "Supported machines", 18) != 0) {
+      const size_t len = strcspn (p, " \t\n");
+      if (add_string (list, p, len) == -1)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+static int
+probe (struct qemuopts_caps *caps, const char *path)
+{
+  static const char *const help_args[] =
+    { "-display", "none", "-help", NULL };
+  static const char *const device_args[] =
+    { "-display", "none", "-machine", "accel=kvm:tcg", "-device", "help",
+      NULL };
+  static const char *const machine_args[] =
+    { "-display", "none", "-machine", "help", NULL };
+  static const struct {
+    enum caps_list list;
+    const char *const *args;
+    int (*parse) (struct strings *, const char *);
+  } probes[] = {
+    { CAPS_OPTIONS, help_args, parse_help },
+    { CAPS_DEVICES, device_args, parse_devices },
+    { CAPS_MACHINES, machine_args, parse_machines },
+  };
+  size_t i;
+  char *out;
+  int r;
+
+  for (i = 0; i < sizeof probes / sizeof probes[0]; ++i) {
+    out = run_probe (path, probes[i].args);
+    if (out == NULL)
+      return -1;
+    r = probes[i].parse (&caps->lists[probes[i].list], out);
+    free (out);
+    if (r == -1)
+      return -1;
+    sort_strings (&caps->lists[probes[i].list]);
+  }
+
+  return 0;
+}
+
+/**
+ * Return the capabilities of the qemu binary selected by
+ * C<qemuopts_set_binary*>, which must be called first.
+ *
+ * If C<cachedir> is not C<NULL>, the results are loaded from (or
+ * saved to) a cache file in that directory.  Otherwise the binary is
+ * always probed.
+ *
+ * The returned struct must be freed by calling
+ * C<qemuopts_caps_free>.
+ *
+ * Returns C<NULL> on error, setting C<errno>.
+ */
+struct qemuopts_caps *
+qemuopts_caps_get (struct qemuopts *qopts, const char *cachedir)
+{
+  const char *binary = qemuopts_get_binary (qopts);
+  struct qemuopts_caps *caps;
+  char *path, *filename = NULL;
+  int saved_errno;
+
+  if (binary == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  path = find_binary (binary);
+  if (path == NULL)
+    return NULL;
+
+  caps = calloc (1, sizeof *caps);
+  if (caps == NULL)
+    goto error;
+
+  caps->identity = get_identity (path);
+  if (caps->identity == NULL)
+    goto error;
+
+  if (cachedir) {
+    filename = cache_filename (cachedir, path);
+    if (filename == NULL)
+      goto error;
+    if (load_cache (caps, filename) == 0)
+      goto out;
+  }
+
+  if (probe (caps, path) == -1)
+    goto error;
+
+  if (filename)
+    save_cache (caps, filename);
+
+ out:
+  free (filename);
+  free (path);
+  return caps;
+
+ error:
+  saved_errno = errno;
+  qemuopts_caps_free (caps);
+  free (filename);
+  free (path);
+  errno = saved_errno;
+  return NULL;
+}
+
+/**
+ * Return true iff qemu supports the command line option C<option>
+ * (eg. C<"-blockdev">).
+ */
+int
+qemuopts_caps_has_option (const struct qemuopts_caps *caps,
+                          const char *option)
+{
+  return has_string (&caps->lists[CAPS_OPTIONS], option);
+}
+
+/**
+ * Return true iff qemu supports the device C<device> (eg.
+ * C<"virtio-scsi-pci">).  Device aliases are also accepted.
+ */
+int
+qemuopts_caps_has_device (const struct qemuopts_caps *caps,
+                          const char *device)
+{
+  return has_string (&caps->lists[CAPS_DEVICES], device);
+}
+
+/**
+ * Return true iff qemu supports the machine type C<machine> (eg.
+ * C<"q35">).
+ */
+int
+qemuopts_caps_has_machine (const struct qemuopts_caps *caps,
+                           const char *machine)
+{
+  return has_string (&caps->lists[CAPS_MACHINES], machine);
+}
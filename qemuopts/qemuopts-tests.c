@@ -31,6 +31,9 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "qemuopts.h"
 
@@ -42,6 +45,364 @@
     }                                           \
   } while (0)
 
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.;
+}
+
+/* Benchmark building and serializing a large command line, of the
+ * size used when launching an appliance with many disks.  This also
+ * checks that very long values containing commas are handled in
+ * linear time (the old code took quadratic time here).
+ */
+#define BENCH_NR_DRIVES 1000
+#define BENCH_BIG_VALUE_LEN (1024*1024)
+
+static void
+benchmark (void)
+{
+  struct qemuopts *qopts;
+  char **actual_argv;
+  char *big;
+  size_t i, j, nr_commas = 0;
+  double t0, t1, t2, t3;
+  FILE *fp;
+
+  big = malloc (BENCH_BIG_VALUE_LEN + 1);
+  if (big == NULL) {
+    perror ("malloc");
+    exit (EXIT_FAILURE);
+  }
+  for (i = 0; i < BENCH_BIG_VALUE_LEN; ++i) {
+    if (i % 16 == 15) {
+      big[i] = ',';
+      nr_commas++;
+    }
+    else
+      big[i] = 'a' + i % 26;
+  }
+  big[BENCH_BIG_VALUE_LEN] = '\0';
+
+  t0 = now ();
+  qopts = qemuopts_create ();
+  CHECK_ERROR (NULL, "qemuopts_create", qopts);
+  CHECK_ERROR (-1, "qemuopts_set_binary",
+               qemuopts_set_binary (qopts, "qemu-system-x86_64"));
+  for (i = 0; i < BENCH_NR_DRIVES; ++i) {
+    CHECK_ERROR (-1, "qemuopts_start_arg_list",
+                 qemuopts_start_arg_list (qopts, "-drive"));
+    CHECK_ERROR (-1, "qemuopts_append_arg_list_format",
+                 qemuopts_append_arg_list_format (qopts,
+                                                  "file=/tmp/disk-%zu.img",
+                                                  i));
+    CHECK_ERROR (-1, "qemuopts_append_arg_list_format",
+                 qemuopts_append_arg_list_format (qopts, "id=hd%zu", i));
+    CHECK_ERROR (-1, "qemuopts_append_arg_list",
+                 qemuopts_append_arg_list (qopts, "cache=writeback"));
+    CHECK_ERROR (-1, "qemuopts_append_arg_list",
+                 qemuopts_append_arg_list (qopts, "format=raw"));
+    CHECK_ERROR (-1, "qemuopts_append_arg_list",
+                 qemuopts_append_arg_list (qopts, "if=none"));
+    CHECK_ERROR (-1, "qemuopts_end_arg_list",
+                 qemuopts_end_arg_list (qopts));
+    CHECK_ERROR (-1, "qemuopts_add_arg_format",
+                 qemuopts_add_arg_format (qopts, "-device",
+                                          "scsi-hd,drive=hd%zu", i));
+  }
+  CHECK_ERROR (-1, "qemuopts_add_arg",
+               qemuopts_add_arg (qopts, "-append", big));
+  t1 = now ();
+
+  CHECK_ERROR (NULL, "qemuopts_to_argv",
+               actual_argv = qemuopts_to_argv (qopts));
+  t2 = now ();
+
+  fp = fopen ("/dev/null", "w");
+  if (fp == NULL) {
+    perror ("/dev/null");
+    exit (EXIT_FAILURE);
+  }
+  CHECK_ERROR (-1, "qemuopts_to_channel",
+               qemuopts_to_channel (qopts, fp));
+  fclose (fp);
+  t3 = now ();
+
+  /* Check the long value was comma-quoted correctly. */
+  i = 1 + 4*BENCH_NR_DRIVES + 1;
+  assert (strcmp (actual_argv[i-1], "-append") == 0);
+  assert (strlen (actual_argv[i]) == BENCH_BIG_VALUE_LEN + nr_commas);
+  assert (strcmp (actual_argv[i-2], "scsi-hd,,drive=hd999") == 0);
+  assert (actual_argv[i+1] == NULL);
+
+  for (j = 0; actual_argv[j] != NULL; ++j)
+    free (actual_argv[j]);
+  free (actual_argv);
+
+  qemuopts_free (qopts);
+  free (big);
+
+  printf ("qemuopts: benchmark: %d drives + %d byte value: "
+          "build %.3fms, to_argv %.3fms, to_channel %.3fms\n",
+          BENCH_NR_DRIVES, BENCH_BIG_VALUE_LEN,
+          (t1 - t0) * 1000., (t2 - t1) * 1000., (t3 - t2) * 1000.);
+}
+
+static void
+check_output (const char *what, const char *actual, const char *expected)
+{
+  if (strcmp (actual, expected) != 0) {
+    fprintf (stderr, "qemuopts: %s does not match expected\n", what);
+    fprintf (stderr, "Actual:\n%s", actual);
+    fprintf (stderr, "Expected:\n%s", expected);
+    exit (EXIT_FAILURE);
+  }
+}
+
+/* Test structured options and the JSON and QMP output. */
+static void
+test_json (void)
+{
+  struct qemuopts *qopts;
+  FILE *fp;
+  char *actual;
+  size_t len;
+  char **actual_argv;
+
+  /* Conflicting keys are rejected. */
+  qopts = qemuopts_create ();
+  CHECK_ERROR (-1, "qemuopts_start_object",
+               qemuopts_start_object (qopts, "-object"));
+  CHECK_ERROR (-1, "qemuopts_append_object_string",
+               qemuopts_append_object_string (qopts, "a", "1"));
+  CHECK_ERROR (-1, "qemuopts_append_object_string",
+               qemuopts_append_object_string (qopts, "a.b", "2"));
+  assert (qemuopts_end_object (qopts) == -1 && errno == EINVAL);
+  qemuopts_free (qopts);
+
+  qopts = qemuopts_create ();
+  CHECK_ERROR (-1, "qemuopts_set_binary",
+               qemuopts_set_binary (qopts, "qemu-system-x86_64"));
+  CHECK_ERROR (-1, "qemuopts_start_object",
+               qemuopts_start_object (qopts, "-blockdev"));
+  CHECK_ERROR (-1, "qemuopts_append_object_string",
+               qemuopts_append_object_string (qopts, "driver", "qcow2"));
+  CHECK_ERROR (-1, "qemuopts_append_object_format",
+               qemuopts_append_object_format (qopts, "node-name", "hd%d", 0));
+  CHECK_ERROR (-1, "qemuopts_append_object_string",
+               qemuopts_append_object_string (qopts, "file.driver", "file"));
+  CHECK_ERROR (-1, "qemuopts_append_object_bool",
+               qemuopts_append_object_bool (qopts, "read-only", 1));
+  CHECK_ERROR (-1, "qemuopts_append_object_string",
+               qemuopts_append_object_string (qopts, "file.filename",
+                                              "/tmp/a,\"b\".qcow2"));
+  CHECK_ERROR (-1, "qemuopts_append_object_int",
+               qemuopts_append_object_int (qopts, "cache.size", -1));
+  CHECK_ERROR (-1, "qemuopts_end_object",
+               qemuopts_end_object (qopts));
+  CHECK_ERROR (-1, "qemuopts_add_arg_list",
+               qemuopts_add_arg_list (qopts, "-device",
+                                      "scsi-hd", "drive=hd0", "removable",
+                                      NULL));
+
+  const char *expected_blockdev =
+    "{\"driver\":\"qcow2\",\"node-name\":\"hd0\","
+    "\"file\":{\"driver\":\"file\",\"filename\":\"/tmp/a,\\\"b\\\".qcow2\"},"
+    "\"read-only\":true,\"cache\":{\"size\":-1}}";
+  const char *expected_device =
+    "{\"driver\":\"scsi-hd\",\"drive\":\"hd0\",\"removable\":\"on\"}";
+
+  /* Test qemuopts_to_argv.  The JSON object is passed unquoted. */
+  CHECK_ERROR (NULL, "qemuopts_to_argv",
+               actual_argv = qemuopts_to_argv (qopts));
+  assert (strcmp (actual_argv[1], "-blockdev") == 0);
+  check_output ("-blockdev JSON", actual_argv[2], expected_blockdev);
+  assert (strcmp (actual_argv[3], "-device") == 0);
+  assert (strcmp (actual_argv[4], "scsi-hd,drive=hd0,removable") == 0);
+  assert (actual_argv[5] == NULL);
+  for (len = 0; actual_argv[len] != NULL; ++len)
+    free (actual_argv[len]);
+  free (actual_argv);
+
+  /* Test qemuopts_to_json. */
+  fp = open_memstream (&actual, &len);
+  if (fp == NULL) {
+    perror ("open_memstream");
+    exit (EXIT_FAILURE);
+  }
+  CHECK_ERROR (-1, "qemuopts_to_json",
+               qemuopts_to_json (qopts, fp));
+  fclose (fp);
+  {
+    char *expected;
+    if (asprintf (&expected,
+                  "[\n"
+                  "  {\"flag\":\"-blockdev\",\"value\":%s},\n"
+                  "  {\"flag\":\"-device\",\"value\":%s}\n"
+                  "]\n", expected_blockdev, expected_device) == -1) {
+      perror ("asprintf");
+      exit (EXIT_FAILURE);
+    }
+    check_output ("qemuopts_to_json", actual, expected);
+    free (expected);
+  }
+  free (actual);
+
+  /* Test qemuopts_to_qmp. */
+  fp = open_memstream (&actual, &len);
+  if (fp == NULL) {
+    perror ("open_memstream");
+    exit (EXIT_FAILURE);
+  }
+  CHECK_ERROR (-1, "qemuopts_to_qmp",
+               qemuopts_to_qmp (qopts, fp));
+  fclose (fp);
+  {
+    char *expected;
+    if (asprintf (&expected,
+                  "{\"execute\":\"blockdev-add\",\"arguments\":%s}\n"
+                  "{\"execute\":\"device_add\",\"arguments\":%s}\n",
+                  expected_blockdev, expected_device) == -1) {
+      perror ("asprintf");
+      exit (EXIT_FAILURE);
+    }
+    check_output ("qemuopts_to_qmp", actual, expected);
+    free (expected);
+  }
+  free (actual);
+
+  /* Options which cannot be hot-plugged are rejected. */
+  CHECK_ERROR (-1, "qemuopts_add_arg",
+               qemuopts_add_arg (qopts, "-m", "1024"));
+  fp = open_memstream (&actual, &len);
+  assert (qemuopts_to_qmp (qopts, fp) == -1 && errno == EINVAL);
+  fclose (fp);
+  free (actual);
+
+  qemuopts_free (qopts);
+}
+
+/* Test the capability cache using a fake qemu binary (a shell
+ * script) which counts how many times it has been run.
+ */
+static const char fake_qemu[] =
+  "#!/bin/sh -\n"
+  "echo run >> \"$0.count\"\n"
+  "case \"$*\" in\n"
+  "*-help) cat <<'EOF'\n"
+  "QEMU emulator version 9.0.0\n"
+  "usage: qemu-system-x86_64 [options] [disk_image]\n"
+  "\n"
+  "-machine [type=]name[,prop[=value][,...]]\n"
+  "-blockdev [driver=]driver[,node-name=N][,discard=ignore|unmap]\n"
+  "-no-user-config\n"
+  "EOF\n"
+  ";;\n"
+  "*-device\\ help) cat <<'EOF'\n"
+  "Storage devices:\n"
+  "name \"virtio-blk-pci\", bus PCI, alias \"virtio-blk\"\n"
+  "name \"virtio-scsi-pci\", bus PCI\n"
+  "EOF\n"
+  ";;\n"
+  "*-machine\\ help) cat <<'EOF'\n"
+  "Supported machines are:\n"
+  "pc-q35-9.0           Standard PC (Q35 + ICH9, 2009) (default)\n"
+  "q35                  Standard PC (Q35 + ICH9, 2009) (alias of pc-q35-9.0)\n"
+  "none                 empty machine\n"
+  "EOF\n"
+  ";;\n"
+  "*) exit 1 ;;\n"
+  "esac\n";
+
+static size_t
+count_runs (const char *countfile)
+{
+  FILE *fp;
+  size_t n = 0;
+  int c;
+
+  fp = fopen (countfile, "r");
+  if (fp == NULL)
+    return 0;
+  while ((c = fgetc (fp)) != EOF)
+    if (c == '\n') n++;
+  fclose (fp);
+  return n;
+}
+
+static void
+test_caps (void)
+{
+  char tmpdir[] = "/tmp/qemuoptsXXXXXX";
+  char binary[64], countfile[80], cmd[128];
+  struct qemuopts *qopts;
+  struct qemuopts_caps *caps;
+  FILE *fp;
+  size_t i;
+
+  if (mkdtemp (tmpdir) == NULL) {
+    perror ("mkdtemp");
+    exit (EXIT_FAILURE);
+  }
+  snprintf (binary, sizeof binary, "%s/qemu", tmpdir);
+  snprintf (countfile, sizeof countfile, "%s.count", binary);
+  fp = fopen (binary, "w");
+  if (fp == NULL) {
+    perror (binary);
+    exit (EXIT_FAILURE);
+  }
+  fputs (fake_qemu, fp);
+  fclose (fp);
+  chmod (binary, 0755);
+
+  qopts = qemuopts_create ();
+  CHECK_ERROR (-1, "qemuopts_set_binary",
+               qemuopts_set_binary (qopts, binary));
+
+  /* The first call probes the binary, the second call loads the
+   * cache file.
+   */
+  for (i = 0; i < 2; ++i) {
+    CHECK_ERROR (NULL, "qemuopts_caps_get",
+                 caps = qemuopts_caps_get (qopts, tmpdir));
+    assert (count_runs (countfile) == 3);
+
+    assert (qemuopts_caps_has_option (caps, "-blockdev"));
+    assert (qemuopts_caps_has_option (caps, "-no-user-config"));
+    assert (!qemuopts_caps_has_option (caps, "-readconfig"));
+    assert (qemuopts_caps_has_device (caps, "virtio-scsi-pci"));
+    assert (qemuopts_caps_has_device (caps, "virtio-blk"));
+    assert (!qemuopts_caps_has_device (caps, "ide-hd"));
+    assert (qemuopts_caps_has_machine (caps, "q35"));
+    assert (qemuopts_caps_has_machine (caps, "pc-q35-9.0"));
+    assert (!qemuopts_caps_has_machine (caps, "Supported"));
+    assert (!qemuopts_caps_has_machine (caps, "pc"));
+
+    qemuopts_caps_free (caps);
+  }
+
+  /* Changing the binary must invalidate the cache. */
+  fp = fopen (binary, "a");
+  fputs ("# changed\n", fp);
+  fclose (fp);
+  CHECK_ERROR (NULL, "qemuopts_caps_get",
+               caps = qemuopts_caps_get (qopts, tmpdir));
+  assert (count_runs (countfile) == 6);
+  assert (qemuopts_caps_has_device (caps, "virtio-blk-pci"));
+  qemuopts_caps_free (caps);
+
+  qemuopts_free (qopts);
+
+  snprintf (cmd, sizeof cmd, "rm -rf %s", tmpdir);
+  if (system (cmd) != 0) {
+    perror ("rm");
+    exit (EXIT_FAILURE);
+  }
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -222,5 +583,10 @@ main (int argc, char *argv[])
 
   qemuopts_free (qopts);
 
+  test_json ();
+  test_caps ();
+
+  benchmark ();
+
   exit (EXIT_SUCCESS);
 }
@@ -57,6 +57,13 @@
  * for C<-machine kernel=foo>.
  *
  * =back
+ *
+ * Newer qemu also accepts some options (C<-blockdev>, C<-object>,
+ * C<-device>, C<-netdev>) as JSON objects, which have typed values
+ * and need no comma quoting, and the same objects can be passed to
+ * the corresponding QMP commands to hot-plug them.  Options built
+ * with C<qemuopts_start_object> are stored in this structured form.
+ * See C<qemuopts_to_json> and C<qemuopts_to_qmp>.
  */
 
 #include <config.h>
@@ -64,6 +71,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
@@ -78,19 +88,76 @@ enum qopt_type {
   QOPT_ARG_NOQUOTE,
   QOPT_RAW,
   QOPT_ARG_LIST,
+  QOPT_OBJECT,
+};
+
+/* A string stored in the arena, with the facts about it that the
+ * output functions need precomputed when it is added, so that
+ * generating argv or a script never has to rescan it.
+ */
+struct qstr {
+  const char *str;
+  size_t len;             /* strlen (str) */
+  size_t nr_commas;       /* number of ',' characters in str */
+  int safe;               /* needs neither shell nor comma quoting */
+};
+
+enum qprop_type {
+  QPROP_STRING,
+  QPROP_INT,
+  QPROP_BOOL,
+};
+
+/* A property of a structured (QOPT_OBJECT) option.  Dotted keys
+ * (eg. "file.filename") denote nested objects, as in qemu keyval
+ * syntax.
+ */
+struct qprop {
+  struct qstr key;
+  enum qprop_type type;
+  struct qstr str;        /* QPROP_STRING */
+  int64_t i;              /* QPROP_INT, QPROP_BOOL */
 };
 
 struct qopt {
   enum qopt_type type;
-  char *flag;             /* eg. "-m" */
-  char *value;            /* Value, for QOPT_ARG, QOPT_ARG_NOQUOTE, QOPT_RAW */
-  char **values;          /* List of values, for QOPT_ARG_LIST. */
+  struct qstr flag;       /* eg. "-m" */
+  struct qstr value;      /* Value, for QOPT_ARG, QOPT_ARG_NOQUOTE, QOPT_RAW */
+  struct qstr *values;    /* List of values, for QOPT_ARG_LIST. */
+  size_t nr_values, nr_values_alloc;
+  struct qprop *props;    /* Properties, for QOPT_OBJECT. */
+  size_t nr_props, nr_props_alloc;
+};
+
+/* qemuopts does not depend on the common utils library, so it has
+ * its own minimal cleanup attribute.
+ */
+static void
+free_ptr (void *ptr)
+{
+  free (* (void **) ptr);
+}
+#define CLEANUP_FREE __attribute__((cleanup(free_ptr)))
+
+/* All strings and value lists are allocated from a simple bump
+ * arena, so that qemuopts_free does not have to walk the options
+ * and adding an option costs no more than a memcpy in the common
+ * case.
+ */
+#define ARENA_CHUNK_SIZE 8192
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;            /* size of data[] */
+  size_t used;            /* bytes of data[] used */
+  _Alignas (max_align_t) char data[];
 };
 
 struct qemuopts {
-  char *binary;        /* NULL = qemuopts_set_binary not called yet */
+  const char *binary;  /* NULL = qemuopts_set_binary not called yet */
   struct qopt *options;
   size_t nr_options, nr_alloc;
+  struct arena_chunk *arena;  /* head is the chunk being filled */
 };
 
 /**
@@ -113,49 +180,136 @@ qemuopts_create (void)
   qopts->binary = NULL;
   qopts->options = NULL;
   qopts->nr_options = qopts->nr_alloc = 0;
+  qopts->arena = NULL;
 
   return qopts;
 }
 
-static void
-free_string_list (char **argv)
+/**
+ * Free the list of qemu options.
+ */
+void
+qemuopts_free (struct qemuopts *qopts)
 {
-  size_t i;
+  struct arena_chunk *chunk, *next;
 
-  if (argv == NULL)
-    return;
+  for (chunk = qopts->arena; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free (chunk);
+  }
+  free (qopts->options);
+  free (qopts);
+}
 
-  for (i = 0; argv[i] != NULL; ++i)
-    free (argv[i]);
-  free (argv);
+/**
+ * Allocate C<n> bytes (suitably aligned for any type) from the arena.
+ *
+ * Large allocations get a chunk of their own which is linked in
+ * behind the current chunk, so they don't waste the free space
+ * remaining in it.
+ */
+static void *
+arena_alloc (struct qemuopts *qopts, size_t n)
+{
+  const size_t align = _Alignof (max_align_t);
+  struct arena_chunk *chunk = qopts->arena;
+  void *ret;
+
+  n = (n + align - 1) & ~(align - 1);
+
+  if (chunk == NULL || chunk->size - chunk->used < n) {
+    const size_t size = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+    struct arena_chunk *new_chunk;
+
+    new_chunk = malloc (offsetof (struct arena_chunk, data) + size);
+    if (new_chunk == NULL)
+      return NULL;
+    new_chunk->size = size;
+    new_chunk->used = 0;
+
+    if (chunk != NULL && n > ARENA_CHUNK_SIZE / 4) {
+      new_chunk->next = chunk->next;
+      chunk->next = new_chunk;
+    }
+    else {
+      new_chunk->next = chunk;
+      qopts->arena = new_chunk;
+    }
+    chunk = new_chunk;
+  }
+
+  ret = &chunk->data[chunk->used];
+  chunk->used += n;
+  return ret;
 }
 
-static size_t
-count_strings (char **argv)
+/* Characters which need neither shell quoting nor qemu comma
+ * quoting.
+ */
+static const char safe_chars[] =
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_=:/";
+
+/**
+ * Copy C<len> bytes of C<str> into the arena and fill in C<ret>.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+static int
+arena_qstr (struct qemuopts *qopts, const char *str, size_t len,
+            struct qstr *ret)
 {
-  size_t i;
+  char *copy;
+  const char *p, *end;
 
-  for (i = 0; argv[i] != NULL; ++i)
-    ;
-  return i;
+  copy = arena_alloc (qopts, len+1);
+  if (copy == NULL)
+    return -1;
+  memcpy (copy, str, len);
+  copy[len] = '\0';
+
+  ret->str = copy;
+  ret->len = len;
+  ret->nr_commas = 0;
+  for (p = copy, end = copy + len;
+       (p = memchr (p, ',', end - p)) != NULL; ++p)
+    ret->nr_commas++;
+  ret->safe = strspn (copy, safe_chars) == len;
+  return 0;
 }
 
 /**
- * Free the list of qemu options.
+ * Format a string into the arena.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
  */
-void
-qemuopts_free (struct qemuopts *qopts)
+static int
+arena_vqstr (struct qemuopts *qopts, struct qstr *ret,
+             const char *fs, va_list args)
 {
-  size_t i;
+  va_list args_copy;
+  char buf[256];
+  char *tmp;
+  int len, r;
+
+  /* Most formatted values are short, so format into a buffer on the
+   * stack first and only fall back to a heap temporary if it is too
+   * small.
+   */
+  va_copy (args_copy, args);
+  len = vsnprintf (buf, sizeof buf, fs, args_copy);
+  va_end (args_copy);
+  if (len < 0)
+    return -1;
+  if ((size_t) len < sizeof buf)
+    return arena_qstr (qopts, buf, len, ret);
 
-  for (i = 0; i < qopts->nr_options; ++i) {
-    free (qopts->options[i].flag);
-    free (qopts->options[i].value);
-    free_string_list (qopts->options[i].values);
-  }
-  free (qopts->options);
-  free (qopts->binary);
-  free (qopts);
+  tmp = malloc (len+1);
+  if (tmp == NULL)
+    return -1;
+  vsnprintf (tmp, len+1, fs, args);
+  r = arena_qstr (qopts, tmp, len, ret);
+  free (tmp);
+  return r;
 }
 
 static struct qopt *
@@ -166,7 +320,7 @@ extend_options (struct qemuopts *qopts)
 
   if (qopts->nr_options >= qopts->nr_alloc) {
     if (qopts->nr_alloc == 0)
-      qopts->nr_alloc = 1;
+      qopts->nr_alloc = 16;
     else
       qopts->nr_alloc *= 2;
     new_options = realloc (qopts->options,
@@ -177,16 +331,23 @@ extend_options (struct qemuopts *qopts)
   }
 
   ret = &qopts->options[qopts->nr_options];
-  qopts->nr_options++;
 
-  ret->type = 0;
-  ret->flag = NULL;
-  ret->value = NULL;
-  ret->values = NULL;
+  memset (ret, 0, sizeof *ret);
 
   return ret;
 }
 
+/* Strings are copied into the arena before the option is committed
+ * by incrementing nr_options, so a failure part way through leaves
+ * the option list unchanged (the partly used arena space is simply
+ * released by qemuopts_free).
+ */
+static void
+commit_option (struct qemuopts *qopts)
+{
+  qopts->nr_options++;
+}
+
 static struct qopt *
 last_option (struct qemuopts *qopts)
 {
@@ -205,24 +366,42 @@ int
 qemuopts_add_flag (struct qemuopts *qopts, const char *flag)
 {
   struct qopt *qopt;
-  char *flag_copy;
 
   if (flag[0] != '-') {
     errno = EINVAL;
     return -1;
   }
 
-  flag_copy = strdup (flag);
-  if (flag_copy == NULL)
+  if ((qopt = extend_options (qopts)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, flag, strlen (flag), &qopt->flag) == -1)
     return -1;
 
-  if ((qopt = extend_options (qopts)) == NULL) {
-    free (flag_copy);
+  qopt->type = QOPT_FLAG;
+  commit_option (qopts);
+  return 0;
+}
+
+/* Common code for adding an option with a flag and a single value. */
+static int
+add_arg (struct qemuopts *qopts, enum qopt_type type,
+         const char *flag, const char *value, size_t value_len)
+{
+  struct qopt *qopt;
+
+  if (flag[0] != '-') {
+    errno = EINVAL;
     return -1;
   }
 
-  qopt->type = QOPT_FLAG;
-  qopt->flag = flag_copy;
+  if ((qopt = extend_options (qopts)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, flag, strlen (flag), &qopt->flag) == -1 ||
+      arena_qstr (qopts, value, value_len, &qopt->value) == -1)
+    return -1;
+
+  qopt->type = type;
+  commit_option (qopts);
   return 0;
 }
 
@@ -239,35 +418,7 @@ qemuopts_add_flag (struct qemuopts *qopts, const char *flag)
 int
 qemuopts_add_arg (struct qemuopts *qopts, const char *flag, const char *value)
 {
-  struct qopt *qopt;
-  char *flag_copy;
-  char *value_copy;
-
-  if (flag[0] != '-') {
-    errno = EINVAL;
-    return -1;
-  }
-
-  flag_copy = strdup (flag);
-  if (flag_copy == NULL)
-    return -1;
-
-  value_copy = strdup (value);
-  if (value_copy == NULL) {
-    free (flag_copy);
-    return -1;
-  }
-
-  if ((qopt = extend_options (qopts)) == NULL) {
-    free (flag_copy);
-    free (value_copy);
-    return -1;
-  }
-
-  qopt->type = QOPT_ARG;
-  qopt->flag = flag_copy;
-  qopt->value = value_copy;
-  return 0;
+  return add_arg (qopts, QOPT_ARG, flag, value, strlen (value));
 }
 
 /**
@@ -284,7 +435,7 @@ int
 qemuopts_add_arg_format (struct qemuopts *qopts, const char *flag,
                          const char *fs, ...)
 {
-  char *value;
+  struct qopt *qopt;
   int r;
   va_list args;
 
@@ -293,15 +444,20 @@ qemuopts_add_arg_format (struct qemuopts *qopts, const char *flag,
     return -1;
   }
 
+  if ((qopt = extend_options (qopts)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, flag, strlen (flag), &qopt->flag) == -1)
+    return -1;
+
   va_start (args, fs);
-  r = vasprintf (&value, fs, args);
+  r = arena_vqstr (qopts, &qopt->value, fs, args);
   va_end (args);
   if (r == -1)
     return -1;
 
-  r = qemuopts_add_arg (qopts, flag, value);
-  free (value);
-  return r;
+  qopt->type = QOPT_ARG;
+  commit_option (qopts);
+  return 0;
 }
 
 /**
@@ -323,55 +479,21 @@ int
 qemuopts_add_arg_noquote (struct qemuopts *qopts, const char *flag,
                           const char *value)
 {
-  struct qopt *qopt;
-  char *flag_copy;
-  char *value_copy;
-
-  if (flag[0] != '-') {
-    errno = EINVAL;
-    return -1;
-  }
-
-  flag_copy = strdup (flag);
-  if (flag_copy == NULL)
-    return -1;
-
-  value_copy = strdup (value);
-  if (value_copy == NULL) {
-    free (flag_copy);
-    return -1;
-  }
-
-  if ((qopt = extend_options (qopts)) == NULL) {
-    free (flag_copy);
-    free (value_copy);
-    return -1;
-  }
-
-  qopt->type = QOPT_ARG_NOQUOTE;
-  qopt->flag = flag_copy;
-  qopt->value = value_copy;
-  return 0;
+  return add_arg (qopts, QOPT_ARG_NOQUOTE, flag, value, strlen (value));
 }
 
 int
 qemuopts_add_raw (struct qemuopts *qopts, const char *str)
 {
   struct qopt *qopt;
-  char *value_copy;
 
-  value_copy = strdup (str);
-  if (value_copy == NULL)
+  if ((qopt = extend_options (qopts)) == NULL)
     return -1;
-
-  if ((qopt = extend_options (qopts)) == NULL) {
-    free (value_copy);
+  if (arena_qstr (qopts, str, strlen (str), &qopt->value) == -1)
     return -1;
-  }
 
   qopt->type = QOPT_RAW;
-  qopt->value = value_copy;
-
+  commit_option (qopts);
   return 0;
 }
 
@@ -396,60 +518,62 @@ int
 qemuopts_start_arg_list (struct qemuopts *qopts, const char *flag)
 {
   struct qopt *qopt;
-  char *flag_copy;
-  char **values;
 
   if (flag[0] != '-') {
     errno = EINVAL;
     return -1;
   }
 
-  flag_copy = strdup (flag);
-  if (flag_copy == NULL)
+  if ((qopt = extend_options (qopts)) == NULL)
     return -1;
-
-  values = calloc (1, sizeof (char *));
-  if (values == NULL) {
-    free (flag_copy);
-    return -1;
-  }
-
-  if ((qopt = extend_options (qopts)) == NULL) {
-    free (flag_copy);
-    free (values);
+  if (arena_qstr (qopts, flag, strlen (flag), &qopt->flag) == -1)
     return -1;
-  }
 
   qopt->type = QOPT_ARG_LIST;
-  qopt->flag = flag_copy;
-  qopt->values = values;
+  commit_option (qopts);
   return 0;
 }
 
-int
-qemuopts_append_arg_list (struct qemuopts *qopts, const char *value)
+/* Return a pointer to the next free value in the current list,
+ * growing the list if necessary.  The old list is left in the arena.
+ */
+static struct qstr *
+extend_values (struct qemuopts *qopts)
 {
   struct qopt *qopt;
-  char **new_values;
-  char *value_copy;
-  size_t len;
+  struct qstr *new_values;
 
   qopt = last_option (qopts);
   assert (qopt->type == QOPT_ARG_LIST);
-  len = count_strings (qopt->values);
 
-  value_copy = strdup (value);
-  if (value_copy == NULL)
-    return -1;
+  if (qopt->nr_values >= qopt->nr_values_alloc) {
+    const size_t nr_alloc =
+      qopt->nr_values_alloc == 0 ? 8 : qopt->nr_values_alloc * 2;
 
-  new_values = realloc (qopt->values, (len+2) * sizeof (char *));
-  if (new_values == NULL) {
-    free (value_copy);
-    return -1;
+    new_values = arena_alloc (qopts, nr_alloc * sizeof (struct qstr));
+    if (new_values == NULL)
+      return NULL;
+    if (qopt->nr_values > 0)
+      memcpy (new_values, qopt->values,
+              qopt->nr_values * sizeof (struct qstr));
+    qopt->values = new_values;
+    qopt->nr_values_alloc = nr_alloc;
   }
-  qopt->values = new_values;
-  qopt->values[len] = value_copy;
-  qopt->values[len+1] = NULL;
+
+  return &qopt->values[qopt->nr_values];
+}
+
+int
+qemuopts_append_arg_list (struct qemuopts *qopts, const char *value)
+{
+  struct qstr *qstr;
+
+  if ((qstr = extend_values (qopts)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, value, strlen (value), qstr) == -1)
+    return -1;
+
+  last_option (qopts)->nr_values++;
   return 0;
 }
 
@@ -457,31 +581,31 @@ int
 qemuopts_append_arg_list_format (struct qemuopts *qopts,
                                  const char *fs, ...)
 {
-  char *value;
+  struct qstr *qstr;
   int r;
   va_list args;
 
+  if ((qstr = extend_values (qopts)) == NULL)
+    return -1;
+
   va_start (args, fs);
-  r = vasprintf (&value, fs, args);
+  r = arena_vqstr (qopts, qstr, fs, args);
   va_end (args);
   if (r == -1)
     return -1;
 
-  r = qemuopts_append_arg_list (qopts, value);
-  free (value);
-  return r;
+  last_option (qopts)->nr_values++;
+  return 0;
 }
 
 int
 qemuopts_end_arg_list (struct qemuopts *qopts)
 {
   struct qopt *qopt;
-  size_t len;
 
   qopt = last_option (qopts);
   assert (qopt->type == QOPT_ARG_LIST);
-  len = count_strings (qopt->values);
-  if (len == 0)
+  if (qopt->nr_values == 0)
     return -1;
 
   return 0;
@@ -525,6 +649,211 @@ qemuopts_add_arg_list (struct qemuopts *qopts, const char *flag,
   return 0;
 }
 
+/**
+ * Start a structured option, typically one of C<-blockdev>,
+ * C<-object>, C<-device> or C<-netdev>, whose value is a JSON
+ * object.
+ *
+ * Typical usage is like this (with error handling omitted):
+ *
+ *  qemuopts_start_object (qopts, "-blockdev");
+ *  qemuopts_append_object_string (qopts, "driver", "qcow2");
+ *  qemuopts_append_object_string (qopts, "node-name", "hd0");
+ *  qemuopts_append_object_bool (qopts, "read-only", 1);
+ *  qemuopts_append_object_string (qopts, "file.driver", "file");
+ *  qemuopts_append_object_string (qopts, "file.filename", "/tmp/foo");
+ *  qemuopts_end_object (qopts);
+ *
+ * which would construct:
+ *
+ *  -blockdev {"driver":"qcow2","node-name":"hd0","read-only":true,"file":{"driver":"file","filename":"/tmp/foo"}}
+ *
+ * As shown, dotted keys are turned into nested objects.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+int
+qemuopts_start_object (struct qemuopts *qopts, const char *flag)
+{
+  struct qopt *qopt;
+
+  if (flag[0] != '-') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((qopt = extend_options (qopts)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, flag, strlen (flag), &qopt->flag) == -1)
+    return -1;
+
+  qopt->type = QOPT_OBJECT;
+  commit_option (qopts);
+  return 0;
+}
+
+/* Return a pointer to the next free property in the current object,
+ * growing the array if necessary.  The old array is left in the arena.
+ */
+static struct qprop *
+extend_props (struct qemuopts *qopts, const char *key)
+{
+  struct qopt *qopt;
+  struct qprop *new_props, *ret;
+
+  qopt = last_option (qopts);
+  assert (qopt->type == QOPT_OBJECT);
+
+  if (qopt->nr_props >= qopt->nr_props_alloc) {
+    const size_t nr_alloc =
+      qopt->nr_props_alloc == 0 ? 8 : qopt->nr_props_alloc * 2;
+
+    new_props = arena_alloc (qopts, nr_alloc * sizeof (struct qprop));
+    if (new_props == NULL)
+      return NULL;
+    if (qopt->nr_props > 0)
+      memcpy (new_props, qopt->props,
+              qopt->nr_props * sizeof (struct qprop));
+    qopt->props = new_props;
+    qopt->nr_props_alloc = nr_alloc;
+  }
+
+  ret = &qopt->props[qopt->nr_props];
+  memset (ret, 0, sizeof *ret);
+  if (arena_qstr (qopts, key, strlen (key), &ret->key) == -1)
+    return NULL;
+  return ret;
+}
+
+int
+qemuopts_append_object_string (struct qemuopts *qopts,
+                               const char *key, const char *value)
+{
+  struct qprop *qprop;
+
+  if ((qprop = extend_props (qopts, key)) == NULL)
+    return -1;
+  if (arena_qstr (qopts, value, strlen (value), &qprop->str) == -1)
+    return -1;
+
+  qprop->type = QPROP_STRING;
+  last_option (qopts)->nr_props++;
+  return 0;
+}
+
+int
+qemuopts_append_object_format (struct qemuopts *qopts,
+                               const char *key, const char *fs, ...)
+{
+  struct qprop *qprop;
+  int r;
+  va_list args;
+
+  if ((qprop = extend_props (qopts, key)) == NULL)
+    return -1;
+
+  va_start (args, fs);
+  r = arena_vqstr (qopts, &qprop->str, fs, args);
+  va_end (args);
+  if (r == -1)
+    return -1;
+
+  qprop->type = QPROP_STRING;
+  last_option (qopts)->nr_props++;
+  return 0;
+}
+
+int
+qemuopts_append_object_int (struct qemuopts *qopts,
+                            const char *key, int64_t value)
+{
+  struct qprop *qprop;
+
+  if ((qprop = extend_props (qopts, key)) == NULL)
+    return -1;
+
+  qprop->type = QPROP_INT;
+  qprop->i = value;
+  last_option (qopts)->nr_props++;
+  return 0;
+}
+
+int
+qemuopts_append_object_bool (struct qemuopts *qopts,
+                             const char *key, int value)
+{
+  struct qprop *qprop;
+
+  if ((qprop = extend_props (qopts, key)) == NULL)
+    return -1;
+
+  qprop->type = QPROP_BOOL;
+  qprop->i = value != 0;
+  last_option (qopts)->nr_props++;
+  return 0;
+}
+
+/* Does the key of 'prop', after skipping 'skip' bytes, start with
+ * the path segment 'seg'?
+ */
+static int
+key_segment_eq (const struct qprop *prop, size_t skip,
+                const char *seg, size_t seglen)
+{
+  return prop->key.len - skip >= seglen &&
+    memcmp (&prop->key.str[skip], seg, seglen) == 0 &&
+    (prop->key.len - skip == seglen || prop->key.str[skip+seglen] == '.');
+}
+
+/* Check that the keys of an object can be turned into a tree of
+ * JSON objects: no empty segments, no duplicate keys, and no key
+ * which is used both for a value and for a nested object.
+ */
+static int
+check_props (const struct qprop *props, size_t nr)
+{
+  size_t i, j, len;
+  const char *seg;
+
+  for (i = 0; i < nr; ++i) {
+    const struct qprop *a = &props[i];
+
+    if (a->key.len == 0 || a->key.str[0] == '.' ||
+        a->key.str[a->key.len-1] == '.' ||
+        memmem (a->key.str, a->key.len, "..", 2) != NULL)
+      return -1;
+
+    for (j = i+1; j < nr; ++j) {
+      const struct qprop *b = &props[j];
+
+      /* One key must not be equal to, or a dotted prefix of, the
+       * other.
+       */
+      len = a->key.len < b->key.len ? a->key.len : b->key.len;
+      seg = a->key.len < b->key.len ? a->key.str : b->key.str;
+      if (key_segment_eq (a->key.len < b->key.len ? b : a, 0, seg, len))
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+int
+qemuopts_end_object (struct qemuopts *qopts)
+{
+  struct qopt *qopt;
+
+  qopt = last_option (qopts);
+  assert (qopt->type == QOPT_OBJECT);
+  if (check_props (qopt->props, qopt->nr_props) == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * Set the qemu binary name.
  *
@@ -533,14 +862,12 @@ qemuopts_add_arg_list (struct qemuopts *qopts, const char *flag,
 int
 qemuopts_set_binary (struct qemuopts *qopts, const char *binary)
 {
-  char *binary_copy;
+  struct qstr qstr;
 
-  binary_copy = strdup (binary);
-  if (binary_copy == NULL)
+  if (arena_qstr (qopts, binary, strlen (binary), &qstr) == -1)
     return -1;
 
-  free (qopts->binary);
-  qopts->binary = binary_copy;
+  qopts->binary = qstr.str;
   return 0;
 }
 
@@ -558,39 +885,48 @@ int
 qemuopts_set_binary_by_arch (struct qemuopts *qopts, const char *arch)
 {
   char *binary;
+  const size_t prefix_len = strlen ("qemu-system-");
 
-  free (qopts->binary);
   qopts->binary = NULL;
 
-  if (arch) {
-    if (asprintf (&binary, "qemu-system-%s", arch) == -1)
-      return -1;
-    qopts->binary = binary;
-  }
-  else {
+  if (!arch) {
 #if defined(__i386__) || defined(__x86_64__)
-    binary = strdup ("qemu-system-x86_64");
+    arch = "x86_64";
 #elif defined(__aarch64__)
-    binary = strdup ("qemu-system-aarch64");
+    arch = "aarch64";
 #elif defined(__arm__)
-    binary = strdup ("qemu-system-arm");
+    arch = "arm";
 #elif defined(__powerpc64__)
-    binary = strdup ("qemu-system-ppc64");
+    arch = "ppc64";
 #elif defined(__s390x__)
-    binary = strdup ("qemu-system-s390x");
+    arch = "s390x";
 #else
     /* There is no KVM capability on this architecture. */
     errno = ENXIO;
-    binary = NULL;
+    return -1;
 #endif
-    if (binary == NULL)
-      return -1;
-    qopts->binary = binary;
   }
 
+  binary = arena_alloc (qopts, prefix_len + strlen (arch) + 1);
+  if (binary == NULL)
+    return -1;
+  memcpy (binary, "qemu-system-", prefix_len);
+  strcpy (&binary[prefix_len], arch);
+  qopts->binary = binary;
+
   return 0;
 }
 
+/**
+ * Return the qemu binary name, or C<NULL> if C<qemuopts_set_binary*>
+ * has not been called.  The returned string is owned by C<qopts>.
+ */
+const char *
+qemuopts_get_binary (struct qemuopts *qopts)
+{
+  return qopts->binary;
+}
+
 /**
  * Write the qemu options to a script.
  *
@@ -634,19 +970,239 @@ qemuopts_to_script (struct qemuopts *qopts, const char *filename)
   return 0;
 }
 
+/**
+ * Print C<len> bytes of C<str> to C<fp> as a JSON string.
+ *
+ * Runs of characters which don't need escaping are written with a
+ * single C<fwrite>.
+ */
+static void
+json_quote (const char *str, size_t len, FILE *fp)
+{
+  const unsigned char *p = (const unsigned char *) str;
+  const unsigned char *end = p + len;
+  const unsigned char *run = p;
+
+  fputc ('"', fp);
+  for (; p < end; ++p) {
+    if (*p >= 0x20 && *p != '"' && *p != '\\')
+      continue;
+    fwrite (run, 1, p - run, fp);
+    run = p+1;
+    switch (*p) {
+    case '"': fputs ("\\\"", fp); break;
+    case '\\': fputs ("\\\\", fp); break;
+    case '\n': fputs ("\\n", fp); break;
+    case '\t': fputs ("\\t", fp); break;
+    default: fprintf (fp, "\\u%04x", *p);
+    }
+  }
+  fwrite (run, 1, p - run, fp);
+  fputc ('"', fp);
+}
+
+/**
+ * Print the properties C<props[0..nr-1]> as a JSON object, ignoring
+ * the first C<skip> bytes of each key.  Properties sharing the same
+ * next key segment are gathered into a nested object.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+static int
+json_props (const struct qprop **props, size_t nr, size_t skip, FILE *fp)
+{
+  CLEANUP_FREE const struct qprop **sub = NULL;
+  CLEANUP_FREE char *done = NULL;
+  size_t i, j, nr_sub, seglen;
+  const char *seg, *dot;
+  int first = 1;
+
+  if (nr > 0) {
+    sub = malloc (nr * sizeof (struct qprop *));
+    done = calloc (nr, 1);
+    if (sub == NULL || done == NULL)
+      return -1;
+  }
+
+  fputc ('{', fp);
+  for (i = 0; i < nr; ++i) {
+    if (done[i])
+      continue;
+
+    seg = &props[i]->key.str[skip];
+    dot = memchr (seg, '.', props[i]->key.len - skip);
+    seglen = dot ? (size_t) (dot - seg) : props[i]->key.len - skip;
+    if (seglen == 0) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (!first) fputc (',', fp);
+    first = 0;
+    json_quote (seg, seglen, fp);
+    fputc (':', fp);
+
+    if (dot == NULL) {          /* Plain value. */
+      done[i] = 1;
+      switch (props[i]->type) {
+      case QPROP_STRING:
+        json_quote (props[i]->str.str, props[i]->str.len, fp);
+        break;
+      case QPROP_INT:
+        fprintf (fp, "%" PRIi64, props[i]->i);
+        break;
+      case QPROP_BOOL:
+        fputs (props[i]->i ? "true" : "false", fp);
+        break;
+      }
+      for (j = i+1; j < nr; ++j) {
+        if (key_segment_eq (props[j], skip, seg, seglen)) {
+          errno = EINVAL;       /* duplicate key */
+          return -1;
+        }
+      }
+    }
+    else {                      /* Nested object. */
+      nr_sub = 0;
+      for (j = i; j < nr; ++j) {
+        if (!done[j] && key_segment_eq (props[j], skip, seg, seglen)) {
+          if (props[j]->key.len - skip == seglen) {
+            errno = EINVAL;     /* key is both a value and an object */
+            return -1;
+          }
+          sub[nr_sub++] = props[j];
+          done[j] = 1;
+        }
+      }
+      if (json_props (sub, nr_sub, skip + seglen + 1, fp) == -1)
+        return -1;
+    }
+  }
+  fputc ('}', fp);
+
+  return 0;
+}
+
+/* For key=value lists, the first element of some options may
+ * omit the key, eg. C<-device virtio-scsi-pci,id=scsi>.
+ */
+static const char *
+implied_key (const char *flag)
+{
+  if (strcmp (flag, "-device") == 0 || strcmp (flag, "-blockdev") == 0)
+    return "driver";
+  if (strcmp (flag, "-object") == 0)
+    return "qom-type";
+  if (strcmp (flag, "-netdev") == 0)
+    return "type";
+  return NULL;
+}
+
+/**
+ * Print the value of a C<QOPT_OBJECT> or C<QOPT_ARG_LIST> option as
+ * a JSON object.  For key=value lists all values are strings, and
+ * an element without C<=> is treated as a boolean C<"on">.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+static int
+json_option_value (const struct qopt *qopt, FILE *fp)
+{
+  CLEANUP_FREE const struct qprop **ptrs = NULL;
+  CLEANUP_FREE struct qprop *list_props = NULL;
+  const struct qprop *props;
+  size_t i, nr;
+  const char *implied, *eq;
+
+  switch (qopt->type) {
+  case QOPT_OBJECT:
+    props = qopt->props;
+    nr = qopt->nr_props;
+    break;
+
+  case QOPT_ARG_LIST:
+    nr = qopt->nr_values;
+    list_props = calloc (nr, sizeof (struct qprop));
+    if (list_props == NULL)
+      return -1;
+    implied = implied_key (qopt->flag.str);
+    for (i = 0; i < nr; ++i) {
+      const struct qstr *v = &qopt->values[i];
+
+      list_props[i].type = QPROP_STRING;
+      eq = memchr (v->str, '=', v->len);
+      if (eq) {
+        list_props[i].key.str = v->str;
+        list_props[i].key.len = eq - v->str;
+        list_props[i].str.str = eq+1;
+        list_props[i].str.len = v->len - (eq+1 - v->str);
+      }
+      else if (i == 0 && implied) {
+        list_props[i].key.str = implied;
+        list_props[i].key.len = strlen (implied);
+        list_props[i].str = *v;
+      }
+      else {
+        list_props[i].key = *v;
+        list_props[i].str.str = "on";
+        list_props[i].str.len = 2;
+      }
+    }
+    props = list_props;
+    break;
+
+  default:
+    abort ();
+  }
+
+  if (nr > 0) {
+    ptrs = malloc (nr * sizeof (struct qprop *));
+    if (ptrs == NULL)
+      return -1;
+    for (i = 0; i < nr; ++i)
+      ptrs[i] = &props[i];
+  }
+  return json_props (ptrs, nr, 0, fp);
+}
+
+/**
+ * Return the value of a C<QOPT_OBJECT> option as a JSON string.
+ * The caller must free the string.
+ */
+static char *
+json_option_value_string (const struct qopt *qopt)
+{
+  char *ret = NULL;
+  size_t len;
+  FILE *fp;
+  int r;
+
+  fp = open_memstream (&ret, &len);
+  if (fp == NULL)
+    return NULL;
+  r = json_option_value (qopt, fp);
+  if (fclose (fp) == EOF || r == -1) {
+    const int saved_errno = errno;
+    free (ret);
+    errno = saved_errno;
+    return NULL;
+  }
+  return ret;
+}
+
 /**
  * Print C<str> to C<fp>, shell-quoting it if necessary.
  */
 static void
 shell_quote (const char *str, FILE *fp)
 {
-  const char *safe_chars =
+  const char *shell_safe_chars =
     "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_=,:/";
   size_t i, len;
 
   /* If the string consists only of safe characters, output it as-is. */
   len = strlen (str);
-  if (len == strspn (str, safe_chars)) {
+  if (len == strspn (str, shell_safe_chars)) {
     fputs (str, fp);
     return;
   }
@@ -666,35 +1222,41 @@ shell_quote (const char *str, FILE *fp)
 }
 
 /**
- * Print C<str> to C<fp> doing both shell and qemu comma quoting.
+ * Print C<qstr> to C<fp> doing both shell and qemu comma quoting.
+ *
+ * Runs of characters which don't need quoting are written with a
+ * single C<fwrite>.
  */
 static void
-shell_and_comma_quote (const char *str, FILE *fp)
+shell_and_comma_quote (const struct qstr *qstr, FILE *fp)
 {
-  const char *safe_chars =
-    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_=:/";
-  size_t i, len;
+  const char *p = qstr->str;
+  const char *end = qstr->str + qstr->len;
+  size_t n;
 
   /* If the string consists only of safe characters, output it as-is. */
-  len = strlen (str);
-  if (len == strspn (str, safe_chars)) {
-    fputs (str, fp);
+  if (qstr->safe) {
+    fwrite (qstr->str, 1, qstr->len, fp);
     return;
   }
 
   fputc ('"', fp);
-  for (i = 0; i < len; ++i) {
-    switch (str[i]) {
+  while (p < end) {
+    n = strcspn (p, ",$`\\\"");
+    fwrite (p, 1, n, fp);
+    p += n;
+    if (p >= end)
+      break;
+    switch (*p) {
     case ',':
       /* qemu comma-quoting doubles commas. */
       fputs (",,", fp);
       break;
-    case '$': case '`': case '\\': case '"':
+    default:                    /* '$', '`', '\\', '"' */
       fputc ('\\', fp);
-      /*FALLTHROUGH*/
-    default:
-      fputc (str[i], fp);
+      fputc (*p, fp);
     }
+    p++;
   }
   fputc ('"', fp);
 }
@@ -713,7 +1275,8 @@ int
 qemuopts_to_channel (struct qemuopts *qopts, FILE *fp)
 {
   size_t i, j;
-  const char *nl = " \\\n    ";
+  const char nl[] = " \\\n    ";
+  const struct qopt *qopt;
 
   if (qopts->binary == NULL) {
     errno = ENOENT;
@@ -722,36 +1285,49 @@ qemuopts_to_channel (struct qemuopts *qopts, FILE *fp)
 
   shell_quote (qopts->binary, fp);
   for (i = 0; i < qopts->nr_options; ++i) {
-    switch (qopts->options[i].type) {
+    qopt = &qopts->options[i];
+
+    fwrite (nl, 1, sizeof nl - 1, fp);
+    switch (qopt->type) {
     case QOPT_FLAG:
-      fprintf (fp, "%s%s", nl, qopts->options[i].flag);
+      fwrite (qopt->flag.str, 1, qopt->flag.len, fp);
       break;
 
     case QOPT_ARG_NOQUOTE:
-      fprintf (fp, "%s%s %s",
-               nl, qopts->options[i].flag, qopts->options[i].value);
+      fwrite (qopt->flag.str, 1, qopt->flag.len, fp);
+      fputc (' ', fp);
+      fwrite (qopt->value.str, 1, qopt->value.len, fp);
       break;
 
     case QOPT_ARG:
-      fprintf (fp, "%s%s ",
-               nl, qopts->options[i].flag);
-      shell_and_comma_quote (qopts->options[i].value, fp);
+      fwrite (qopt->flag.str, 1, qopt->flag.len, fp);
+      fputc (' ', fp);
+      shell_and_comma_quote (&qopt->value, fp);
       break;
 
     case QOPT_ARG_LIST:
-      fprintf (fp, "%s%s ",
-               nl, qopts->options[i].flag);
-      for (j = 0; qopts->options[i].values[j] != NULL; ++j) {
+      fwrite (qopt->flag.str, 1, qopt->flag.len, fp);
+      fputc (' ', fp);
+      for (j = 0; j < qopt->nr_values; ++j) {
         if (j > 0) fputc (',', fp);
-        shell_and_comma_quote (qopts->options[i].values[j], fp);
+        shell_and_comma_quote (&qopt->values[j], fp);
       }
       break;
 
     case QOPT_RAW:
-      fprintf (fp, "%s%s",
-               nl, qopts->options[i].value);
+      fwrite (qopt->value.str, 1, qopt->value.len, fp);
       break;
 
+    case QOPT_OBJECT: {
+      char *json = json_option_value_string (qopt);
+      if (json == NULL)
+        return -1;
+      fwrite (qopt->flag.str, 1, qopt->flag.len, fp);
+      fputc (' ', fp);
+      shell_quote (json, fp);
+      free (json);
+      break;
+    }
     }
   }
   fputc ('\n', fp);
@@ -764,6 +1340,45 @@ qemuopts_to_channel (struct qemuopts *qopts, FILE *fp)
   return 0;
 }
 
+/**
+ * Copy C<qstr> to C<dest> doing qemu comma quoting, returning a
+ * pointer to the byte after the copied string.  C<dest> must have
+ * space for C<qstr-E<gt>len + qstr-E<gt>nr_commas> bytes.
+ */
+static char *
+comma_quote_copy (char *dest, const struct qstr *qstr)
+{
+  const char *p = qstr->str;
+  const char *end = qstr->str + qstr->len;
+  const char *comma;
+
+  if (qstr->nr_commas == 0) {
+    memcpy (dest, p, qstr->len);
+    return dest + qstr->len;
+  }
+
+  while ((comma = memchr (p, ',', end - p)) != NULL) {
+    memcpy (dest, p, comma - p + 1);
+    dest += comma - p + 1;
+    *dest++ = ',';
+    p = comma + 1;
+  }
+  memcpy (dest, p, end - p);
+  return dest + (end - p);
+}
+
+static char *
+copy_qstr (const struct qstr *qstr)
+{
+  char *ret;
+
+  ret = malloc (qstr->len + 1);
+  if (ret == NULL)
+    return NULL;
+  memcpy (ret, qstr->str, qstr->len + 1);
+  return ret;
+}
+
 /**
  * Return a NULL-terminated argument list, of the kind that can be
  * passed directly to L<execv(3)>.
@@ -779,8 +1394,9 @@ qemuopts_to_channel (struct qemuopts *qopts, FILE *fp)
 char **
 qemuopts_to_argv (struct qemuopts *qopts)
 {
-  char **ret, **values;
-  size_t n, i, j, k, len;
+  char **ret, *p;
+  const struct qopt *qopt;
+  size_t n, i, j, len;
 
   if (qopts->binary == NULL) {
     errno = ENOENT;
@@ -801,6 +1417,7 @@ qemuopts_to_argv (struct qemuopts *qopts)
     case QOPT_ARG_NOQUOTE:
     case QOPT_ARG:
     case QOPT_ARG_LIST:
+    case QOPT_OBJECT:
       n += 2;
       break;
 
@@ -826,63 +1443,58 @@ qemuopts_to_argv (struct qemuopts *qopts)
   }
   n++;
 
+  /* The length of every string and the number of commas in it were
+   * recorded when it was added, so each argument is allocated at
+   * its exact final size and copied in a single pass.
+   */
   for (i = 0; i < qopts->nr_options; ++i) {
-    ret[n] = strdup (qopts->options[i].flag);
+    qopt = &qopts->options[i];
+
+    ret[n] = copy_qstr (&qopt->flag);
     if (ret[n] == NULL) goto error;
     n++;
 
-    switch (qopts->options[i].type) {
+    switch (qopt->type) {
     case QOPT_FLAG:
       /* nothing */
       break;
 
     case QOPT_ARG_NOQUOTE:
-      ret[n] = strdup (qopts->options[i].value);
+      ret[n] = copy_qstr (&qopt->value);
       if (ret[n] == NULL) goto error;
       n++;
       break;
 
     case QOPT_ARG:
       /* We only have to do comma-quoting here. */
-      len = 0;
-      for (k = 0; k < strlen (qopts->options[i].value); ++k) {
-        if (qopts->options[i].value[k] == ',') len++;
-        len++;
-      }
-      ret[n] = malloc (len+1);
+      ret[n] = malloc (qopt->value.len + qopt->value.nr_commas + 1);
       if (ret[n] == NULL) goto error;
-      len = 0;
-      for (k = 0; k < strlen (qopts->options[i].value); ++k) {
-        if (qopts->options[i].value[k] == ',') ret[n][len++] = ',';
-        ret[n][len++] = qopts->options[i].value[k];
-      }
-      ret[n][len] = '\0';
+      p = comma_quote_copy (ret[n], &qopt->value);
+      *p = '\0';
       n++;
       break;
 
     case QOPT_ARG_LIST:
       /* We only have to do comma-quoting here. */
-      values = qopts->options[i].values;
-      len = count_strings (values);
-      assert (len > 0);
-      len -= 1 /* one for each comma */;
-      for (j = 0; values[j] != NULL; ++j) {
-        for (k = 0; k < strlen (values[j]); ++k) {
-          if (values[j][k] == ',') len++;
-          len++;
-        }
-      }
+      assert (qopt->nr_values > 0);
+      len = qopt->nr_values - 1 /* one for each comma */;
+      for (j = 0; j < qopt->nr_values; ++j)
+        len += qopt->values[j].len + qopt->values[j].nr_commas;
       ret[n] = malloc (len+1);
       if (ret[n] == NULL) goto error;
-      len = 0;
-      for (j = 0; values[j] != NULL; ++j) {
-        if (j > 0) ret[n][len++] = ',';
-        for (k = 0; k < strlen (values[j]); ++k) {
-          if (values[j][k] == ',') ret[n][len++] = ',';
-          ret[n][len++] = values[j][k];
-        }
+      p = ret[n];
+      for (j = 0; j < qopt->nr_values; ++j) {
+        if (j > 0) *p++ = ',';
+        p = comma_quote_copy (p, &qopt->values[j]);
       }
-      ret[n][len] = '\0';
+      *p = '\0';
+      n++;
+      break;
+
+    case QOPT_OBJECT:
+      /* JSON needs no comma-quoting. */
+      ret[n] = json_option_value_string (qopt);
+      if (ret[n] == NULL) goto error;
       n++;
       break;
 
@@ -950,9 +1562,9 @@ qemuopts_to_config_file (struct qemuopts *qopts, const char *filename)
 int
 qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
 {
-  size_t i, j, k;
+  size_t i, j, k, nr_values;
   ssize_t id_param;
-  char **values;
+  const struct qstr *values;
 
   /* Before starting, try to detect some illegal options which
    * cannot be translated into a qemu config file.
@@ -972,6 +1584,13 @@ qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
       errno = EINVAL;
       return -1;
 
+    case QOPT_OBJECT:
+      /* Typed values and nested objects cannot be expressed in the
+       * config file format.
+       */
+      errno = EINVAL;
+      return -1;
+
     case QOPT_ARG:
       /* Single arguments can be expressed, but we would have to do
        * special translation as outlined in the description of
@@ -986,8 +1605,9 @@ qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
        * https://bugs.launchpad.net/qemu/+bug/1686364.
        */
       values = qopts->options[i].values;
-      for (j = 0; values[j] != NULL; ++j) {
-        if (strchr (values[j], '"') != NULL) {
+      nr_values = qopts->options[i].nr_values;
+      for (j = 0; j < nr_values; ++j) {
+        if (memchr (values[j].str, '"', values[j].len) != NULL) {
           errno = EINVAL;
           return -1;
         }
@@ -1005,14 +1625,16 @@ qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
     case QOPT_ARG_NOQUOTE:
     case QOPT_ARG:
     case QOPT_RAW:
+    case QOPT_OBJECT:
       abort ();
 
     case QOPT_ARG_LIST:
       values = qopts->options[i].values;
+      nr_values = qopts->options[i].nr_values;
       /* The id=... parameter is special. */
       id_param = -1;
-      for (j = 0; values[j] != NULL; ++j) {
-        if (strncmp (values[j], "id=", 2) == 0) {
+      for (j = 0; j < nr_values; ++j) {
+        if (strncmp (values[j].str, "id=", 2) == 0) {
           id_param = j;
           break;
         }
@@ -1020,20 +1642,20 @@ qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
 
       if (id_param >= 0)
         fprintf (fp, "[%s \"%s\"]\n",
-                 &qopts->options[i].flag[1],
-                 &values[id_param][3]);
+                 &qopts->options[i].flag.str[1],
+                 &values[id_param].str[3]);
       else
-        fprintf (fp, "[%s]\n", &qopts->options[i].flag[1]);
+        fprintf (fp, "[%s]\n", &qopts->options[i].flag.str[1]);
 
-      for (j = 0; values[j] != NULL; ++j) {
+      for (j = 0; j < nr_values; ++j) {
         if ((ssize_t) j != id_param) {
-          k = strcspn (values[j], "=");
-          if (k < strlen (values[j])) {
-            fprintf (fp, "  %.*s = ", (int) k, values[j]);
-            fprintf (fp, "\"%s\"\n", &values[j][k+1]);
+          k = strcspn (values[j].str, "=");
+          if (k < values[j].len) {
+            fprintf (fp, "  %.*s = ", (int) k, values[j].str);
+            fprintf (fp, "\"%s\"\n", &values[j].str[k+1]);
           }
           else
-            fprintf (fp, "  %s = \"on\"\n", values[j]);
+            fprintf (fp, "  %s = \"on\"\n", values[j].str);
         }
       }
     }
@@ -1047,3 +1669,138 @@ qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp)
 
   return 0;
 }
+
+/**
+ * Write the qemu options to C<fp> as a JSON array, with one element
+ * per option, for example:
+ *
+ *  [
+ *    {"flag":"-m","value":"1024"},
+ *    {"flag":"-no-user-config"},
+ *    {"flag":"-drive","value":{"file":"/tmp/foo","if":"ide"}},
+ *    {"flag":"-blockdev","value":{"driver":"file","read-only":true}}
+ *  ]
+ *
+ * Key=value lists and structured options both become JSON objects.
+ * The binary is not included.  Raw options cannot be represented
+ * and cause this function to fail.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+int
+qemuopts_to_json (struct qemuopts *qopts, FILE *fp)
+{
+  size_t i;
+  const struct qopt *qopt;
+
+  for (i = 0; i < qopts->nr_options; ++i) {
+    if (qopts->options[i].type == QOPT_RAW) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  fputc ('[', fp);
+  for (i = 0; i < qopts->nr_options; ++i) {
+    qopt = &qopts->options[i];
+
+    fputs (i > 0 ? ",\n  {\"flag\":" : "\n  {\"flag\":", fp);
+    json_quote (qopt->flag.str, qopt->flag.len, fp);
+    switch (qopt->type) {
+    case QOPT_FLAG:
+      break;
+
+    case QOPT_ARG:
+    case QOPT_ARG_NOQUOTE:
+      fputs (",\"value\":", fp);
+      json_quote (qopt->value.str, qopt->value.len, fp);
+      break;
+
+    case QOPT_ARG_LIST:
+    case QOPT_OBJECT:
+      fputs (",\"value\":", fp);
+      if (json_option_value (qopt, fp) == -1)
+        return -1;
+      break;
+
+    case QOPT_RAW:
+      abort ();
+    }
+    fputc ('}', fp);
+  }
+  fputs (qopts->nr_options > 0 ? "\n]\n" : "]\n", fp);
+
+  if (ferror (fp)) {
+    errno = EIO;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Map an option to the QMP command which hot-plugs the same thing. */
+static const char *
+qmp_command (const struct qopt *qopt)
+{
+  const char *flag = qopt->flag.str;
+
+  if (qopt->type != QOPT_OBJECT && qopt->type != QOPT_ARG_LIST)
+    return NULL;
+
+  if (strcmp (flag, "-blockdev") == 0)
+    return "blockdev-add";
+  if (strcmp (flag, "-object") == 0)
+    return "object-add";
+  if (strcmp (flag, "-device") == 0)
+    return "device_add";
+  if (strcmp (flag, "-netdev") == 0)
+    return "netdev_add";
+  return NULL;
+}
+
+/**
+ * Write the qemu options to C<fp> as a series of QMP commands, one
+ * per line, which will add the same block nodes, objects, devices
+ * and network backends to a running qemu.  For example:
+ *
+ *  {"execute":"blockdev-add","arguments":{"driver":"file","node-name":"hd1","filename":"/tmp/foo"}}
+ *  {"execute":"device_add","arguments":{"driver":"scsi-hd","drive":"hd1"}}
+ *
+ * Only C<-blockdev>, C<-object>, C<-device> and C<-netdev> options
+ * can be converted, and this function fails if there are any other
+ * options.  Note that C<blockdev-add> checks the types of its
+ * arguments strictly, so block nodes should be built with
+ * C<qemuopts_start_object> rather than as key=value lists.
+ *
+ * The caller is responsible for the QMP capabilities negotiation.
+ *
+ * Returns C<0> on success.  Returns C<-1> on error, setting C<errno>.
+ */
+int
+qemuopts_to_qmp (struct qemuopts *qopts, FILE *fp)
+{
+  size_t i;
+
+  /* Before starting, check that every option can be converted. */
+  for (i = 0; i < qopts->nr_options; ++i) {
+    if (qmp_command (&qopts->options[i]) == NULL) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  for (i = 0; i < qopts->nr_options; ++i) {
+    fprintf (fp, "{\"execute\":\"%s\",\"arguments\":",
+             qmp_command (&qopts->options[i]));
+    if (json_option_value (&qopts->options[i], fp) == -1)
+      return -1;
+    fputs ("}\n", fp);
+  }
+
+  if (ferror (fp)) {
+    errno = EIO;
+    return -1;
+  }
+
+  return 0;
+}
@@ -22,6 +22,7 @@
 #define QEMUOPTS_H_
 
 #include <stdarg.h>
+#include <stdint.h>
 
 struct qemuopts;
 
@@ -37,12 +38,30 @@ extern int qemuopts_append_arg_list (struct qemuopts *qopts, const char *value);
 extern int qemuopts_append_arg_list_format (struct qemuopts *qopts, const char *fs, ...) __attribute__((format (printf,2,3)));
 extern int qemuopts_end_arg_list (struct qemuopts *qopts);
 extern int qemuopts_add_arg_list (struct qemuopts *qopts, const char *flag, const char *elem0, ...) __attribute__((sentinel));
+extern int qemuopts_start_object (struct qemuopts *qopts, const char *flag);
+extern int qemuopts_append_object_string (struct qemuopts *qopts, const char *key, const char *value);
+extern int qemuopts_append_object_format (struct qemuopts *qopts, const char *key, const char *fs, ...) __attribute__((format (printf,3,4)));
+extern int qemuopts_append_object_int (struct qemuopts *qopts, const char *key, int64_t value);
+extern int qemuopts_append_object_bool (struct qemuopts *qopts, const char *key, int value);
+extern int qemuopts_end_object (struct qemuopts *qopts);
 extern int qemuopts_set_binary (struct qemuopts *qopts, const char *binary);
 extern int qemuopts_set_binary_by_arch (struct qemuopts *qopts, const char *arch);
+extern const char *qemuopts_get_binary (struct qemuopts *qopts);
 extern int qemuopts_to_script (struct qemuopts *qopts, const char *filename);
 extern int qemuopts_to_channel (struct qemuopts *qopts, FILE *fp);
 extern char **qemuopts_to_argv (struct qemuopts *qopts);
 extern int qemuopts_to_config_file (struct qemuopts *qopts, const char *filename);
 extern int qemuopts_to_config_channel (struct qemuopts *qopts, FILE *fp);
+extern int qemuopts_to_json (struct qemuopts *qopts, FILE *fp);
+extern int qemuopts_to_qmp (struct qemuopts *qopts, FILE *fp);
+
+/* qemuopts-caps.c */
+struct qemuopts_caps;
+
+extern struct qemuopts_caps *qemuopts_caps_get (struct qemuopts *qopts, const char *cachedir);
+extern void qemuopts_caps_free (struct qemuopts_caps *caps);
+extern int qemuopts_caps_has_option (const struct qemuopts_caps *caps, const char *option);
+extern int qemuopts_caps_has_device (const struct qemuopts_caps *caps, const char *device);
+extern int qemuopts_caps_has_machine (const struct qemuopts_caps *caps, const char *machine);
 
 #endif /* QEMUOPTS_H_ */
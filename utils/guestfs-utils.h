@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "guestfs-internal-all.h"
 #include "cleanups.h"
@@ -46,6 +47,8 @@
 extern char *guestfs_int_replace_string (const char *str, const char *s1, const char *s2);
 extern char *guestfs_int_exit_status_to_string (int status, const char *cmd_name, char *buffer, size_t buflen);
 extern int guestfs_int_random_string (char *ret, size_t len);
+extern int guestfs_int_random_bytes (void *buf, size_t len);
+extern int guestfs_int_random_uniform (char *ret, size_t len, const char *chars, size_t nr_chars);
 extern char *guestfs_int_drive_name (size_t index, char *ret);
 extern ssize_t guestfs_int_drive_index (const char *);
 extern int guestfs_int_is_true (const char *str);
@@ -57,6 +60,7 @@ extern void guestfs_int_fadvise_sequential (int fd);
 extern void guestfs_int_fadvise_random (int fd);
 extern void guestfs_int_fadvise_noreuse (int fd);
 //extern void guestfs_int_fadvise_dontneed (int fd);
+extern void guestfs_int_fadvise_dontneed_range (int fd, off_t offset, off_t len);
 //extern void guestfs_int_fadvise_willneed (int fd);
 extern char *guestfs_int_shell_unquote (const char *str);
 extern int guestfs_int_is_reg (int64_t mode);
@@ -116,5 +120,14 @@ extern char **guestfs_int_copy_environ (char **env, ...);
 /* whole-file.c */
 extern int read_whole_file (const char *filename,
                             char **data_r, size_t *size_r);
+extern int map_whole_file (const char *filename,
+                           const char **data_r, size_t *size_r);
+extern void unmap_whole_file (const char *data, size_t size, int copied);
+#define READ_FILE_CHUNKS_DONTNEED 1
+extern int read_file_chunks (const char *filename, size_t chunk_size,
+                             unsigned flags,
+                             int (*fn) (const char *buf, size_t len,
+                                        void *opaque),
+                             void *opaque);
 
 #endif /* GUESTFS_UTILS_H_ */
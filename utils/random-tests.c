@@ -0,0 +1,151 @@
+/* libguestfs
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Unit tests of the random functions in F<utils.c>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "guestfs-utils.h"
+
+#define CHECK(expr)                                                     \
+  do {                                                                  \
+    if (!(expr)) {                                                      \
+      fprintf (stderr, "%s:%d: test failed: %s\n",                      \
+               __FILE__, __LINE__, #expr);                              \
+      exit (EXIT_FAILURE);                                              \
+    }                                                                   \
+  } while (0)
+
+/* With 200 characters, 256 % 200 = 56 bytes must be rejected.  If
+ * they were not, the first 56 characters would be picked twice as
+ * often as the others.
+ */
+#define NR_CHARS 200
+#define PER_CHAR 1000
+
+static void
+test_uniform (void)
+{
+  char chars[NR_CHARS];
+  char *ret;
+  size_t counts[NR_CHARS] = { 0 };
+  const size_t len = NR_CHARS * PER_CHAR;
+  size_t i;
+
+  for (i = 0; i < NR_CHARS; ++i)
+    chars[i] = i + 1;
+
+  ret = malloc (len + 1);
+  CHECK (ret != NULL);
+  CHECK (guestfs_int_random_uniform (ret, len, chars, NR_CHARS) == 0);
+  CHECK (ret[len] == '\0');
+  for (i = 0; i < len; ++i) {
+    const unsigned char c = ret[i];
+    CHECK (c >= 1 && c <= NR_CHARS);
+    counts[c - 1]++;
+  }
+  free (ret);
+
+  /* The standard deviation of each count is about 32, so these
+   * bounds are more than 7 sigma away, but well inside the counts
+   * that a modulo bias would give (about 1560 and 780).
+   */
+  for (i = 0; i < NR_CHARS; ++i)
+    CHECK (counts[i] > PER_CHAR - 230 && counts[i] < PER_CHAR + 230);
+
+  /* The size of the character set is checked. */
+  ret = malloc (2);
+  CHECK (ret != NULL);
+  errno = 0;
+  CHECK (guestfs_int_random_uniform (ret, 1, chars, 0) == -1);
+  CHECK (errno == EINVAL);
+  errno = 0;
+  CHECK (guestfs_int_random_uniform (ret, 1, chars, 257) == -1);
+  CHECK (errno == EINVAL);
+  /* A single character needs no random bytes to be useful. */
+  CHECK (guestfs_int_random_uniform (ret, 1, "x", 1) == 0);
+  CHECK (strcmp (ret, "x") == 0);
+  free (ret);
+}
+
+static void
+test_string (void)
+{
+  char ret[65];
+  size_t i;
+
+  CHECK (guestfs_int_random_string (ret, 64) == 0);
+  CHECK (strlen (ret) == 64);
+  for (i = 0; i < 64; ++i)
+    CHECK ((ret[i] >= '0' && ret[i] <= '9') ||
+           (ret[i] >= 'a' && ret[i] <= 'z'));
+}
+
+/* The parent and child must not hand out the same bytes from the
+ * pool that they shared at the time of the fork.
+ */
+static void
+test_fork (void)
+{
+  unsigned char parent[32], child[32];
+  int pipefd[2];
+  pid_t pid;
+  int status;
+
+  /* Fill the pool. */
+  CHECK (guestfs_int_random_bytes (parent, 1) == 0);
+
+  CHECK (pipe (pipefd) == 0);
+  pid = fork ();
+  CHECK (pid >= 0);
+  if (pid == 0) {
+    close (pipefd[0]);
+    if (guestfs_int_random_bytes (child, sizeof child) == -1 ||
+        write (pipefd[1], child, sizeof child) != sizeof child)
+      _exit (EXIT_FAILURE);
+    _exit (EXIT_SUCCESS);
+  }
+  close (pipefd[1]);
+  CHECK (guestfs_int_random_bytes (parent, sizeof parent) == 0);
+  CHECK (read (pipefd[0], child, sizeof child) == sizeof child);
+  close (pipefd[0]);
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+  CHECK (memcmp (parent, child, sizeof parent) != 0);
+}
+
+int
+main (void)
+{
+  test_uniform ();
+  test_string ();
+  test_fork ();
+
+  exit (EXIT_SUCCESS);
+}
@@ -32,8 +32,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
 #include <libintl.h>
 
 /* NB: MUST NOT require linking to gnulib, because that will break the
@@ -126,6 +130,185 @@ guestfs_int_exit_status_to_string (int status, const char *cmd_name,
   return buffer;
 }
 
+/* Source of random bytes.
+ *
+ * Random bytes come from L<getrandom(2)> (or F</dev/urandom> if the
+ * kernel does not have it), but callers usually want only a few
+ * bytes at a time, so each thread keeps a small pool which is
+ * refilled with a single system call.  Bytes are wiped from the
+ * pool as soon as they are handed out.  The pool is discarded in
+ * the child after L<fork(2)> so that parent and child never return
+ * the same bytes.
+ */
+#define RANDOM_POOL_SIZE 256
+
+struct random_pool {
+  unsigned char buf[RANDOM_POOL_SIZE];
+  size_t avail;         /* unused bytes are at the end of buf */
+};
+
+static __thread struct random_pool random_pool;
+static pthread_once_t random_pool_once = PTHREAD_ONCE_INIT;
+
+static void
+random_pool_clear (void)
+{
+  memset (random_pool.buf, 0, sizeof random_pool.buf);
+  random_pool.avail = 0;
+}
+
+static void
+random_pool_init (void)
+{
+  pthread_atfork (NULL, NULL, random_pool_clear);
+}
+
+static int
+read_urandom (unsigned char *buf, size_t len)
+{
+  int fd;
+  ssize_t r;
+  int saved_errno;
+
+  fd = open ("/dev/urandom", O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  while (len > 0) {
+    r = read (fd, buf, len);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      saved_errno = r == 0 ? EIO : errno;
+      close (fd);
+      errno = saved_errno;
+      return -1;
+    }
+    buf += r;
+    len -= r;
+  }
+
+  return close (fd);
+}
+
+/* Fill the buffer directly from the kernel. */
+static int
+random_fill (unsigned char *buf, size_t len)
+{
+#ifdef HAVE_GETRANDOM
+  ssize_t r;
+
+  while (len > 0) {
+    r = getrandom (buf, len, 0);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOSYS)
+        return read_urandom (buf, len);
+      return -1;
+    }
+    buf += r;
+    len -= r;
+  }
+
+  return 0;
+#else
+  return read_urandom (buf, len);
+#endif
+}
+
+/* Copy the next C<len> bytes from this thread's pool, refilling it
+ * as required.
+ */
+static int
+random_pool_get (unsigned char *ret, size_t len)
+{
+  size_t n;
+  unsigned char *p;
+
+  pthread_once (&random_pool_once, random_pool_init);
+
+  while (len > 0) {
+    if (random_pool.avail == 0) {
+      if (random_fill (random_pool.buf, sizeof random_pool.buf) == -1)
+        return -1;
+      random_pool.avail = sizeof random_pool.buf;
+    }
+
+    n = len < random_pool.avail ? len : random_pool.avail;
+    p = &random_pool.buf[sizeof random_pool.buf - random_pool.avail];
+    memcpy (ret, p, n);
+    memset (p, 0, n);
+    random_pool.avail -= n;
+    ret += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ * Fill C<buf> with C<len> random bytes suitable for cryptographic
+ * use (keys, seeds, salts).
+ *
+ * Returns C<0> on success or C<-1> on error, setting C<errno>.
+ */
+int
+guestfs_int_random_bytes (void *buf, size_t len)
+{
+  /* Large requests bypass the pool. */
+  if (len >= RANDOM_POOL_SIZE)
+    return random_fill (buf, len);
+
+  return random_pool_get (buf, len);
+}
+
+/**
+ * Fill C<ret> with C<len> characters chosen uniformly at random from
+ * the C<nr_chars> characters in C<chars>, and add a final C<\0>
+ * (so C<ret> must have length C<len+1>).  C<nr_chars> must be
+ * between 1 and 256.
+ *
+ * Random bytes which would introduce a modulo bias are rejected,
+ * so every character is equally likely.
+ *
+ * Returns C<0> on success or C<-1> on error, setting C<errno>.
+ */
+int
+guestfs_int_random_uniform (char *ret, size_t len,
+                            const char *chars, size_t nr_chars)
+{
+  unsigned char buf[64];
+  size_t i, n, used;
+  unsigned threshold;
+
+  if (nr_chars == 0 || nr_chars > 256) {
+    errno = EINVAL;
+    return -1;
+  }
+  threshold = 256 % nr_chars;
+
+  /* Fetch random bytes in batches, which is more than enough for
+   * any one output character even with rejections.
+   */
+  i = 0;
+  while (i < len) {
+    n = len - i;
+    if (n > sizeof buf)
+      n = sizeof buf;
+    if (random_pool_get (buf, n) == -1)
+      return -1;
+    for (used = 0; used < n && i < len; ++used) {
+      if (buf[used] >= threshold)
+        ret[i++] = chars[buf[used] % nr_chars];
+    }
+  }
+  ret[len] = '\0';
+  memset (buf, 0, sizeof buf);
+
+  return 0;
+}
+
 /**
  * Return a random string of characters.
  *
@@ -148,29 +331,17 @@ guestfs_int_exit_status_to_string (int status, const char *cmd_name,
 int
 guestfs_int_random_string (char *ret, size_t len)
 {
-  int fd;
   size_t i;
   unsigned char c;
-  int saved_errno;
-
-  fd = open ("/dev/urandom", O_RDONLY|O_CLOEXEC);
-  if (fd == -1)
-    return -1;
 
   for (i = 0; i < len; ++i) {
-    if (read (fd, &c, 1) != 1) {
-      saved_errno = errno;
-      close (fd);
-      errno = saved_errno;
+    if (random_pool_get (&c, 1) == -1)
       return -1;
-    }
     /* Do not change this! */
     ret[i] = "0123456789abcdefghijklmnopqrstuvwxyz"[c % 36];
   }
   ret[len] = '\0';
-
-  if (close (fd) == -1)
-    return -1;
+  c = 0;
 
   return 0;
 }
@@ -423,6 +594,26 @@ guestfs_int_fadvise_dontneed (int fd)
 }
 #endif
 
+/**
+ * Hint that we will not access the C<len> bytes at C<offset> in the
+ * near future, so they can be dropped from the page cache.
+ *
+ * On Linux, pages which are mapped or in use by other processes are
+ * kept.  This is only safe to call on data which is not shared with
+ * anything that will read it again soon (eg. not on template disk
+ * images), since those pages will have to be read from disk again.
+ *
+ * It's OK to call this on a non-file since we ignore failure as it is
+ * only a hint.
+ */
+void
+guestfs_int_fadvise_dontneed_range (int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+  ignore_value (posix_fadvise (fd, offset, len, POSIX_FADV_DONTNEED));
+#endif
+}
+
 #if 0 /* not used yet */
 /**
  * Hint that we will access the data in the near future.
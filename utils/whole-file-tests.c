@@ -0,0 +1,184 @@
+/* libguestfs
+ * Copyright (C) 2026 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Unit tests of the functions in F<whole-file.c>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "guestfs-utils.h"
+
+#define CHECK(expr)                                                     \
+  do {                                                                  \
+    if (!(expr)) {                                                      \
+      fprintf (stderr, "%s:%d: test failed: %s\n",                      \
+               __FILE__, __LINE__, #expr);                              \
+      exit (EXIT_FAILURE);                                              \
+    }                                                                   \
+  } while (0)
+
+/* Not a multiple of the page size, so the last page is partial. */
+#define TEST_SIZE (3 * 4096 + 123)
+
+static char test_data[TEST_SIZE];
+
+struct chunks {
+  char data[TEST_SIZE];
+  size_t len;
+  size_t calls;
+  size_t stop_after;
+};
+
+static int
+collect_chunk (const char *buf, size_t len, void *opaque)
+{
+  struct chunks *c = opaque;
+
+  CHECK (len > 0 && len <= 1000);
+  CHECK (c->len + len <= TEST_SIZE);
+  memcpy (&c->data[c->len], buf, len);
+  c->len += len;
+  c->calls++;
+  return c->calls == c->stop_after ? -1 : 0;
+}
+
+static void
+test_map (const char *filename, const char *expected, size_t expected_len,
+          int expected_r)
+{
+  const char *data;
+  size_t size;
+  int r;
+
+  r = map_whole_file (filename, &data, &size);
+  CHECK (r == expected_r);
+  CHECK (size == expected_len);
+  CHECK (memcmp (data, expected, size) == 0);
+  CHECK (data[size] == '\0');
+  unmap_whole_file (data, size, r);
+}
+
+int
+main (void)
+{
+  char filename[] = "/tmp/whole-file-tests.XXXXXX";
+  char empty[] = "/tmp/whole-file-tests-empty.XXXXXX";
+  char pipename[64];
+  struct chunks c;
+  char *data;
+  const char *cdata;
+  size_t i, size;
+  int fd, pipefd[2];
+  pid_t pid;
+  int status;
+
+  for (i = 0; i < TEST_SIZE; ++i)
+    test_data[i] = 'a' + i % 26;
+
+  fd = mkstemp (filename);
+  CHECK (fd >= 0);
+  CHECK (write (fd, test_data, TEST_SIZE) == TEST_SIZE);
+  CHECK (close (fd) == 0);
+  fd = mkstemp (empty);
+  CHECK (fd >= 0);
+  CHECK (close (fd) == 0);
+
+  /* read_whole_file. */
+  CHECK (read_whole_file (filename, &data, &size) == 0);
+  CHECK (size == TEST_SIZE);
+  CHECK (memcmp (data, test_data, size) == 0);
+  CHECK (data[size] == '\0');
+  free (data);
+
+  /* map_whole_file maps regular files, and reads empty ones. */
+  test_map (filename, test_data, TEST_SIZE, 0);
+  test_map (empty, "", 0, 1);
+
+  /* Pipes cannot be mapped, so they are read, growing the buffer
+   * several times.
+   */
+  CHECK (pipe (pipefd) == 0);
+  pid = fork ();
+  CHECK (pid >= 0);
+  if (pid == 0) {
+    close (pipefd[0]);
+    for (i = 0; i < 10; ++i)
+      if (write (pipefd[1], test_data, TEST_SIZE) != TEST_SIZE)
+        _exit (EXIT_FAILURE);
+    _exit (EXIT_SUCCESS);
+  }
+  close (pipefd[1]);
+  snprintf (pipename, sizeof pipename, "/dev/fd/%d", pipefd[0]);
+  {
+    const char *pdata;
+    size_t psize;
+    int r;
+
+    r = map_whole_file (pipename, &pdata, &psize);
+    CHECK (r == 1);
+    CHECK (psize == 10 * TEST_SIZE);
+    for (i = 0; i < 10; ++i)
+      CHECK (memcmp (&pdata[i * TEST_SIZE], test_data, TEST_SIZE) == 0);
+    CHECK (pdata[psize] == '\0');
+    unmap_whole_file (pdata, psize, r);
+  }
+  close (pipefd[0]);
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+  /* read_file_chunks reads the whole file in chunks. */
+  memset (&c, 0, sizeof c);
+  CHECK (read_file_chunks (filename, 1000, 0, collect_chunk, &c) == 0);
+  CHECK (c.len == TEST_SIZE);
+  CHECK (memcmp (c.data, test_data, TEST_SIZE) == 0);
+  CHECK (c.calls == (TEST_SIZE + 999) / 1000);
+
+  memset (&c, 0, sizeof c);
+  CHECK (read_file_chunks (empty, 1000, 0, collect_chunk, &c) == 0);
+  CHECK (c.calls == 0);
+
+  /* Dropping the pages from the cache doesn't change what is read. */
+  memset (&c, 0, sizeof c);
+  CHECK (read_file_chunks (filename, 1000, READ_FILE_CHUNKS_DONTNEED,
+                           collect_chunk, &c) == 0);
+  CHECK (c.len == TEST_SIZE);
+  CHECK (memcmp (c.data, test_data, TEST_SIZE) == 0);
+
+  /* It stops when the callback fails. */
+  memset (&c, 0, sizeof c);
+  c.stop_after = 2;
+  CHECK (read_file_chunks (filename, 1000, 0, collect_chunk, &c) == -1);
+  CHECK (c.calls == 2);
+
+  /* Missing files are errors. */
+  unlink (empty);
+  CHECK (read_whole_file (empty, &data, &size) == -1);
+  CHECK (map_whole_file (empty, &cdata, &size) == -1);
+  CHECK (read_file_chunks (empty, 1000, 0, collect_chunk, &c) == -1);
+
+  unlink (filename);
+  exit (EXIT_SUCCESS);
+}
@@ -22,7 +22,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <libintl.h>
 
 #include "guestfs-utils.h"
@@ -109,3 +112,274 @@ read_whole_file (const char *filename, char **data_r, size_t *size_r)
 
   return 0;
 }
+
+/**
+ * Allocate C<len> bytes of zeroed, page-aligned memory with
+ * L<mmap(2)>, so that it can be freed by C<unmap_whole_file>.
+ */
+static char *
+alloc_pages (size_t len)
+{
+  void *p;
+
+  p = mmap (NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+            -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+static size_t
+round_up_to_pages (size_t len)
+{
+  const size_t pagesize = sysconf (_SC_PAGESIZE);
+
+  return (len + pagesize - 1) & ~(pagesize - 1);
+}
+
+/**
+ * Read the rest of C<fd> into memory allocated with C<alloc_pages>,
+ * for files which cannot be mapped.
+ *
+ * The file may be a key, so every copy of the data is cleared before
+ * it is unmapped.
+ */
+static int
+read_into_pages (const char *filename, int fd, size_t size_hint,
+                 char **data_r, size_t *size_r)
+{
+  size_t alloc = round_up_to_pages (size_hint + 1);
+  size_t n = 0;
+  char *data;
+  ssize_t r;
+
+  data = alloc_pages (alloc);
+  if (data == NULL) {
+    perror ("mmap");
+    return -1;
+  }
+
+  for (;;) {
+    /* Always leave room for the trailing \0. */
+    if (n + 1 == alloc) {
+      char *newdata = alloc_pages (2 * alloc);
+
+      if (newdata == NULL) {
+        perror ("mmap");
+        explicit_bzero (data, n);
+        munmap (data, alloc);
+        return -1;
+      }
+      memcpy (newdata, data, n);
+      explicit_bzero (data, n);
+      munmap (data, alloc);
+      data = newdata;
+      alloc *= 2;
+    }
+
+    r = read (fd, &data[n], alloc - n - 1);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r == -1) {
+      perror (filename);
+      explicit_bzero (data, n);
+      munmap (data, alloc);
+      return -1;
+    }
+    if (r == 0)
+      break;
+    n += r;
+  }
+
+  /* Give back the unused pages so that unmap_whole_file can work out
+   * the size of the mapping from the size of the data.
+   */
+  if (round_up_to_pages (n + 1) < alloc)
+    munmap (&data[round_up_to_pages (n + 1)],
+            alloc - round_up_to_pages (n + 1));
+
+  *data_r = data;
+  *size_r = n;
+  return 0;
+}
+
+/**
+ * Map the whole file C<filename> read-only into memory.
+ *
+ * This is like C<read_whole_file>, but the file is not copied: the
+ * returned buffer is a private mapping of the file, so large files
+ * cost no more memory than the page cache they already occupy.  The
+ * returned buffer is read-only and must be freed by calling
+ * C<unmap_whole_file> (not C<free>).
+ *
+ * The buffer is still NUL-terminated (the NUL is not included in the
+ * size).  The file is mapped over a zeroed anonymous mapping which is
+ * at least one byte larger than the file, so there is always a zero
+ * byte after the end of the data.
+ *
+ * Files which cannot be mapped, such as pipes and files in F</proc>,
+ * are read instead, with the same result except that the data is
+ * then a private copy.  Pass the return value to C<unmap_whole_file>
+ * so that it can clear the copy.
+ *
+ * The file must be a B<regular>, B<local>, B<trusted> file, and must
+ * not be truncated while it is mapped, otherwise accessing the
+ * buffer will raise C<SIGBUS>.
+ *
+ * Returns 0 if the file was mapped, or 1 if it was read.  On error
+ * this prints an error on C<stderr> and returns -1.
+ */
+int
+map_whole_file (const char *filename, const char **data_r, size_t *size_r)
+{
+  CLEANUP_CLOSE int fd = -1;
+  struct stat statbuf;
+  size_t size, len;
+  char *data;
+
+  fd = open (filename, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    perror (filename);
+    return -1;
+  }
+
+  if (fstat (fd, &statbuf) == -1) {
+    perror (filename);
+    return -1;
+  }
+
+  /* Empty regular files may be special files in /proc or /sys. */
+  if (!S_ISREG (statbuf.st_mode) || statbuf.st_size == 0) {
+    if (read_into_pages (filename, fd, statbuf.st_size, &data, &size) == -1)
+      return -1;
+    goto copied;
+  }
+
+  size = statbuf.st_size;
+  len = round_up_to_pages (size + 1);
+
+  /* Reserve enough zeroed memory for the file plus the trailing \0,
+   * then map the file over the start of it.
+   */
+  data = mmap (NULL, len, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    perror ("mmap");
+    return -1;
+  }
+  if (mmap (data, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0)
+      == MAP_FAILED) {
+    munmap (data, len);
+    if (errno != ENODEV && errno != EACCES && errno != EINVAL) {
+      perror (filename);
+      return -1;
+    }
+    if (read_into_pages (filename, fd, size, &data, &size) == -1)
+      return -1;
+    goto copied;
+  }
+
+  *data_r = data;
+  if (size_r != NULL)
+    *size_r = size;
+  return 0;
+
+ copied:
+  *data_r = data;
+  if (size_r != NULL)
+    *size_r = size;
+  return 1;
+}
+
+/**
+ * Free a buffer returned by C<map_whole_file>.  C<size> is the size
+ * of the data and C<copied> is the return value of
+ * C<map_whole_file>.  If the file was read rather than mapped, the
+ * copy is cleared first.
+ */
+void
+unmap_whole_file (const char *data, size_t size, int copied)
+{
+  if (data != NULL) {
+    if (copied)
+      explicit_bzero ((char *) data, size);
+    munmap ((void *) data, round_up_to_pages (size + 1));
+  }
+}
+
+/**
+ * Read the file C<filename> in chunks of at most C<chunk_size> bytes,
+ * calling C<fn> on each chunk.  This is the streaming counterpart of
+ * C<read_whole_file> for files which are too large to hold in memory.
+ *
+ * The kernel is told that the file is read sequentially.  If
+ * C<flags> contains C<READ_FILE_CHUNKS_DONTNEED>, the pages which
+ * have been processed are also dropped from the page cache (unless
+ * something else is using them), so reading a large file once does
+ * not evict everything else from the cache.  Don't use this for files
+ * which are likely to be read again soon, such as templates.
+ *
+ * C<fn> returns C<0> to carry on, or C<-1> to stop, in which case it
+ * is responsible for printing an error.
+ *
+ * On error this prints an error on C<stderr> (except for errors from
+ * C<fn>) and returns -1 with C<errno> set.  Otherwise it returns 0.
+ */
+int
+read_file_chunks (const char *filename, size_t chunk_size, unsigned flags,
+                  int (*fn) (const char *buf, size_t len, void *opaque),
+                  void *opaque)
+{
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *buf = NULL;
+  off_t offset = 0, dropped = 0;
+  ssize_t r;
+  int saved_errno;
+
+  fd = open (filename, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    saved_errno = errno;
+    perror (filename);
+    errno = saved_errno;
+    return -1;
+  }
+
+  buf = malloc (chunk_size);
+  if (buf == NULL) {
+    saved_errno = errno;
+    perror ("malloc");
+    errno = saved_errno;
+    return -1;
+  }
+
+  guestfs_int_fadvise_sequential (fd);
+
+  for (;;) {
+    r = read (fd, buf, chunk_size);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r == -1) {
+      saved_errno = errno;
+      perror (filename);
+      errno = saved_errno;
+      return -1;
+    }
+    if (r == 0)
+      break;
+
+    if (fn (buf, r, opaque) == -1)
+      return -1;
+    offset += r;
+
+    /* Drop what has been read every few MB, rather than after every
+     * chunk, to keep the number of system calls down.
+     */
+    if ((flags & READ_FILE_CHUNKS_DONTNEED) &&
+        offset - dropped >= 8 * 1024 * 1024) {
+      guestfs_int_fadvise_dontneed_range (fd, dropped, offset - dropped);
+      dropped = offset;
+    }
+  }
+
+  if ((flags & READ_FILE_CHUNKS_DONTNEED) && offset > dropped)
+    guestfs_int_fadvise_dontneed_range (fd, dropped, offset - dropped);
+
+  return 0;
+}